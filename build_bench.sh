@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Headless benchmark build of retro-core. It uses the dummy display and audio drivers,
+# feeds the cores scripted input and prints fps, frame time percentiles and video/audio
+# hashes after a fixed number of frames.
+#
+# Usage:
+#   ./build_bench.sh
+#   RG_BENCH_CORE=nes RG_BENCH_ROM=roms/nes/game.nes RG_BENCH_FRAMES=3000 ./rg_bench.exe
+#
+# RG_BENCH_CORE is the app name used by the launcher: nes, gb, gbc, pce, sms, gg, col, gw, snes, lnx.
+# The hashes are only comparable between runs with the same settings (./sd/...).
+
+# Supported systems: Linux / MINGW32 / MINGW64
+# Required: SDL2
+
+CC="gcc"
+CFLAGS="-O2 -no-pie -DRG_TARGET_SDL2 -DRG_BENCHMARK -DRETRO_GO -DCJSON_HIDE_SYMBOLS -DSDL_MAIN_HANDLED=1 -DRG_BUILD_INFO=\"Bench\" -Dapp_main=SDL_Main $(sdl2-config --cflags)"
+INCLUDES="-Icomponents/retro-go -Icomponents/retro-go/libs/cJSON -Icomponents/retro-go/libs/lodepng"
+SRCFILES="components/retro-go/*.c components/retro-go/drivers/audio/*.c components/retro-go/fonts/*.c
+		  components/retro-go/libs/cJSON/*.c components/retro-go/libs/lodepng/*.c"
+LIBS="$(sdl2-config --libs) -lstdc++"
+
+echo "Cleaning..."
+rm -f rg_bench.exe
+
+echo "Building rg_bench..."
+$CC $CFLAGS $INCLUDES \
+	-Iretro-core/components/gnuboy \
+	-Iretro-core/components/gw-emulator/src \
+	-Iretro-core/components/gw-emulator/src/cpus \
+	-Iretro-core/components/gw-emulator/src/gw_sys \
+	-Iretro-core/components/handy \
+	-Iretro-core/components/nofrendo \
+	-Iretro-core/components/pce-go \
+	-Iretro-core/components/snes9x \
+	-Iretro-core/components/snes9x/src \
+	-Iretro-core/components/smsplus \
+	-Iretro-core/main \
+	$SRCFILES \
+	retro-core/components/gnuboy/*.c \
+	retro-core/components/gw-emulator/src/*.c \
+	retro-core/components/gw-emulator/src/cpus/*.c \
+	retro-core/components/gw-emulator/src/gw_sys/*.c \
+	retro-core/components/handy/*.cpp \
+	retro-core/components/nofrendo/mappers/*.c \
+	retro-core/components/nofrendo/nes/*.c \
+	retro-core/components/nofrendo/*.c \
+	retro-core/components/pce-go/*.c \
+	retro-core/components/snes9x/src/*.c \
+	retro-core/components/smsplus/*.c \
+	retro-core/components/smsplus/cpu/*.c \
+	retro-core/components/smsplus/sound/*.c \
+	retro-core/main/*.c \
+	retro-core/main/*.cpp \
+	$LIBS \
+	-o rg_bench.exe
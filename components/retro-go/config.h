@@ -70,6 +70,10 @@
 // #define RG_ENABLE_PROFILING 0
 // #endif
 
+#ifndef RG_ENABLE_TIMERS
+#define RG_ENABLE_TIMERS 1
+#endif
+
 #ifndef RG_APP_LAUNCHER
 #define RG_APP_LAUNCHER "launcher"
 #endif
@@ -7,15 +7,25 @@
 static SDL_AudioDeviceID audioDevice;
 static int sampleRate;
 
+static void audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    // rg_audio does the buffering, resampling, and pacing for us
+    rg_audio_read((rg_audio_frame_t *)stream, len / 4);
+}
+
 static bool driver_init(int device, int _sampleRate)
 {
+    sampleRate = _sampleRate;
     SDL_AudioSpec desired = {
         .freq = sampleRate,
         .format = AUDIO_S16,
         .channels = 2,
+        .samples = 512,
+        .callback = audio_callback,
     };
-    sampleRate = _sampleRate;
     audioDevice = SDL_OpenAudioDevice(NULL, 0, &desired, NULL, 0);
+    if (audioDevice != 0)
+        SDL_PauseAudioDevice(audioDevice, 0);
     return audioDevice != 0;
 }
 
@@ -27,15 +37,8 @@ static bool driver_deinit(void)
 
 static bool driver_submit(const rg_audio_frame_t *frames, size_t count)
 {
-    SDL_QueueAudio(audioDevice, (void *)frames, count * 4);
-    SDL_PauseAudioDevice(audioDevice, 0);
-    // This is ugly, but we must emulate how it works on the ESP32, where the audio does the pacing!
-    static int64_t frame_start = 0;
-    int64_t frame_end = frame_start + (uint32_t)(count * (1000000.f / sampleRate)) - 500;
-    if (frame_end > rg_system_timer())
-        rg_usleep((frame_end - rg_system_timer()));
-    frame_start = rg_system_timer();
-    return true;
+    // Unused, we pull our frames from rg_audio_read() in audio_callback
+    return false;
 }
 
 static bool driver_set_mute(bool mute)
@@ -62,6 +65,7 @@ const rg_audio_driver_t rg_audio_driver_sdl2 = {
     .set_volume = driver_set_volume,
     .set_sample_rate = NULL,
     .get_error = driver_get_error,
+    .pull = true,
 };
 
 #endif // RG_AUDIO_USE_SDL2
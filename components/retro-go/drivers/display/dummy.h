@@ -10,9 +10,15 @@ static void lcd_set_backlight(float percent)
 {
 }
 
+static void lcd_set_window(int left, int top, int width, int height)
+{
+}
+
 static inline uint16_t *lcd_get_buffer(size_t length)
 {
-    return (void *)0;
+    // We still need somewhere to write to, so that the scaling work is done like on real hardware
+    static uint16_t buffer[LCD_BUFFER_LENGTH];
+    return length <= LCD_BUFFER_LENGTH ? buffer : (void *)0;
 }
 
 static inline void lcd_send_buffer(uint16_t *buffer, size_t length)
@@ -39,16 +39,32 @@ static const rg_audio_sink_t sinks[] = {
     })
 #define RELEASE_DEVICE() rg_mutex_give(audio.lock)
 
+// Dynamic rate control: the resampling ratio is nudged by up to this much to keep the ring half full
+#define DRC_MAX_DEVIATION 0.005f
+// The producer blocks above this fill level, filling the ring completely would only add latency
+#define DRC_TARGET_FILL 0.5f
+// Length of the ring buffer used by pull drivers, in seconds
+#define RING_LENGTH 0.125f
+
 static struct
 {
     const rg_audio_sink_t *sink;
     const rg_audio_driver_t *driver;
     rg_mutex_t *lock;
+    rg_audio_ring_t ring;
+    rg_semaphore_t *ring_read; // Given by the consumer after every read
     int sampleRate;
+    int sourceRate;
     int filter;
     int volume;
     bool muted;
 } audio;
+
+static struct
+{
+    rg_audio_frame_t history[4];
+    uint32_t phase; // Q16 position between history[1] and history[2]
+} resampler;
 static rg_audio_counters_t counters;
 
 static const char *SETTING_DRIVER = "AudioDriver";
@@ -63,6 +79,114 @@ static const char *get_last_driver_error(void)
     return "Unspecified Error";
 }
 
+bool rg_audio_ring_init(rg_audio_ring_t *ring, size_t size)
+{
+    RG_ASSERT_ARG(ring);
+    // A power of two lets the counters wrap around without breaking the indexing
+    size_t real_size = 64;
+    while (real_size < size)
+        real_size <<= 1;
+    memset(ring, 0, sizeof(*ring));
+    if (!(ring->data = calloc(real_size, sizeof(rg_audio_frame_t))))
+        return false;
+    ring->size = real_size;
+    return true;
+}
+
+void rg_audio_ring_free(rg_audio_ring_t *ring)
+{
+    if (!ring)
+        return;
+    free(ring->data);
+    memset(ring, 0, sizeof(*ring));
+}
+
+size_t rg_audio_ring_write(rg_audio_ring_t *ring, const rg_audio_frame_t *frames, size_t count)
+{
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    count = RG_MIN(count, ring->size - (head - tail));
+    for (size_t i = 0; i < count; ++i)
+        ring->data[(head + i) & (ring->size - 1)] = frames[i];
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+size_t rg_audio_ring_read(rg_audio_ring_t *ring, rg_audio_frame_t *frames, size_t count)
+{
+    size_t tail = ring->tail;
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    count = RG_MIN(count, head - tail);
+    for (size_t i = 0; i < count; ++i)
+        frames[i] = ring->data[(tail + i) & (ring->size - 1)];
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// 4-point Hermite interpolation between x1 and x2, t is Q12
+static inline int hermite(int x0, int x1, int x2, int x3, int t)
+{
+    int c1 = (x2 - x0) / 2;
+    int c2 = x0 - (5 * x1) / 2 + 2 * x2 - x3 / 2;
+    int c3 = (x3 - x0) / 2 + (3 * (x1 - x2)) / 2;
+    int y = ((((((c3 * t) >> 12) + c2) * t) >> 12) + c1) * t;
+    y = (y >> 12) + x1;
+    return RG_MIN(RG_MAX(y, -32768), 32767);
+}
+
+// Converts `count` source frames to the output rate and hands them to `output` in small chunks.
+// `step` is the Q16 distance between two output frames, in source frames.
+static void resample(const rg_audio_frame_t *frames, size_t count, uint32_t step,
+                     void (*output)(const rg_audio_frame_t *frames, size_t count))
+{
+    rg_audio_frame_t buffer[128];
+    rg_audio_frame_t *h = resampler.history;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        h[0] = h[1], h[1] = h[2], h[2] = h[3], h[3] = frames[i];
+        while (resampler.phase < 0x10000)
+        {
+            int t = resampler.phase >> 4;
+            buffer[pos].left = hermite(h[0].left, h[1].left, h[2].left, h[3].left, t);
+            buffer[pos].right = hermite(h[0].right, h[1].right, h[2].right, h[3].right, t);
+            if (++pos == RG_COUNT(buffer))
+            {
+                output(buffer, pos);
+                pos = 0;
+            }
+            resampler.phase += step;
+        }
+        resampler.phase -= 0x10000;
+    }
+    if (pos > 0)
+        output(buffer, pos);
+}
+
+static void output_to_driver(const rg_audio_frame_t *frames, size_t count)
+{
+    audio.driver->submit(frames, count);
+}
+
+static void output_to_ring(const rg_audio_frame_t *frames, size_t count)
+{
+    // The consumer does the pacing, we wait for it to drain the ring below the target fill level
+    const size_t target = audio.ring.size * DRC_TARGET_FILL;
+    while (count > 0)
+    {
+        size_t used = rg_audio_ring_used(&audio.ring);
+        if (used >= target)
+        {
+            rg_semaphore_take(audio.ring_read, 100);
+            continue;
+        }
+        size_t written = rg_audio_ring_write(&audio.ring, frames, RG_MIN(count, target - used));
+        frames += written;
+        count -= written;
+    }
+}
+
 void rg_audio_init(int sampleRate)
 {
     RG_ASSERT(audio.sink == NULL, "Audio sink already initialized!");
@@ -91,6 +215,18 @@ void rg_audio_init(int sampleRate)
     audio.sampleRate = sampleRate;
     audio.driver = audio.sink->driver;
 
+    if (audio.driver->pull && !audio.ring_read)
+        audio.ring_read = rg_semaphore_create();
+
+    if (audio.driver->pull && (!audio.ring_read || !rg_audio_ring_init(&audio.ring, sampleRate * RING_LENGTH)))
+    {
+        RG_LOGE("Failed to allocate audio ring buffer!\n");
+        audio.sink = &sinks[0];
+        audio.driver = audio.sink->driver;
+    }
+
+    memset(&resampler, 0, sizeof(resampler));
+
     if (audio.driver->init(audio.sink->device, sampleRate))
     {
         if (audio.driver->set_mute)
@@ -122,6 +258,7 @@ void rg_audio_deinit(void)
     ACQUIRE_DEVICE(1000);
 
     audio.driver->deinit();
+    rg_audio_ring_free(&audio.ring);
 
     RG_LOGI("Audio terminated. sink='%s'\n", audio.sink->name);
 
@@ -141,14 +278,52 @@ void rg_audio_submit(const rg_audio_frame_t *frames, size_t count)
     if (!frames || !count)
         return;
 
+#ifdef RG_BENCHMARK
+    rg_bench_hash_audio(frames, count * sizeof(rg_audio_frame_t), count);
+#endif
+
     if (ACQUIRE_DEVICE(0))
     {
-        audio.driver->submit(frames, count);
+        int sourceRate = audio.sourceRate ?: audio.sampleRate;
+        float ratio = (float)sourceRate / audio.sampleRate;
+
+        // Adjust the ratio slightly depending on how full the ring is, this compensates for the
+        // small clock differences between the emulation and the audio device.
+        if (audio.driver->pull)
+        {
+            float fill = (float)rg_audio_ring_used(&audio.ring) / audio.ring.size;
+            ratio *= 1.f + DRC_MAX_DEVIATION * (fill - DRC_TARGET_FILL) * 2.f;
+        }
+
+        if (audio.driver->pull)
+            resample(frames, count, ratio * 0x10000, output_to_ring);
+        else if (sourceRate != audio.sampleRate)
+            resample(frames, count, ratio * 0x10000, output_to_driver);
+        else
+            audio.driver->submit(frames, count);
         RELEASE_DEVICE();
     }
 
+    int elapsed = rg_system_timer() - time_start;
     counters.totalSamples += count;
-    counters.busyTime += rg_system_timer() - time_start;
+    counters.busyTime += elapsed;
+    RG_TIMER_ADD(RG_TIMER_AUDIO_OUT, elapsed);
+}
+
+size_t rg_audio_read(rg_audio_frame_t *frames, size_t count)
+{
+    // This is called from the driver's own thread, no locking here!
+    size_t read = audio.ring.data ? rg_audio_ring_read(&audio.ring, frames, count) : 0;
+    if (read > 0)
+        rg_semaphore_give(audio.ring_read);
+    if (read < count)
+    {
+        memset(frames + read, 0, (count - read) * sizeof(rg_audio_frame_t));
+        // An empty ring just means that the emulation hasn't started yet
+        if (read > 0)
+            counters.underruns++;
+    }
+    return read;
 }
 
 rg_audio_counters_t rg_audio_get_counters(void)
@@ -223,6 +398,24 @@ int rg_audio_get_sample_rate(void)
     return audio.sampleRate;
 }
 
+int rg_audio_get_source_rate(void)
+{
+    return audio.sourceRate ?: audio.sampleRate;
+}
+
+void rg_audio_set_source_rate(int sampleRate)
+{
+    // 0 means that the source runs at the output rate
+    if (audio.sourceRate == sampleRate)
+        return;
+    if (ACQUIRE_DEVICE(1000))
+    {
+        audio.sourceRate = sampleRate;
+        memset(&resampler, 0, sizeof(resampler));
+        RELEASE_DEVICE();
+    }
+}
+
 void rg_audio_set_sample_rate(int sampleRate)
 {
     RG_ASSERT(audio.driver != NULL, "Audio device not ready!");
@@ -230,12 +423,15 @@ void rg_audio_set_sample_rate(int sampleRate)
     if (audio.sampleRate == sampleRate)
         return;
 
-    if (audio.driver->set_sample_rate)
+    // The ring is sized for the rate and read without locking, pull drivers must be restarted to replace it
+    if (audio.driver->set_sample_rate && !audio.driver->pull)
     {
         if (ACQUIRE_DEVICE(1000))
         {
             audio.driver->set_sample_rate(sampleRate);
             audio.sampleRate = sampleRate;
+            // The resampler's phase and history belong to the previous ratio
+            memset(&resampler, 0, sizeof(resampler));
             RELEASE_DEVICE();
         }
     }
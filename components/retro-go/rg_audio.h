@@ -21,6 +21,7 @@ typedef struct
     bool (*set_volume)(int percent);                              // Optional
     bool (*set_sample_rate)(int sample_rate);                     // Optional
     const char *(*get_error)(void);                               // Optional
+    bool pull;  // The driver reads frames with rg_audio_read() instead of receiving them through submit
 } rg_audio_driver_t;
 
 typedef struct
@@ -34,11 +35,31 @@ typedef struct
 {
     int64_t totalSamples;
     int64_t busyTime;
+    int32_t underruns;
 } rg_audio_counters_t;
 
+// Lock-free single producer, single consumer ring buffer. Each side publishes its index with a release
+// store and reads the other one with an acquire load, so the frames are visible before the index.
+typedef struct
+{
+    rg_audio_frame_t *data;
+    size_t size;
+    size_t head; // Written by the producer only
+    size_t tail; // Written by the consumer only
+} rg_audio_ring_t;
+
+bool rg_audio_ring_init(rg_audio_ring_t *ring, size_t size);
+void rg_audio_ring_free(rg_audio_ring_t *ring);
+size_t rg_audio_ring_write(rg_audio_ring_t *ring, const rg_audio_frame_t *frames, size_t count);
+size_t rg_audio_ring_read(rg_audio_ring_t *ring, rg_audio_frame_t *frames, size_t count);
+#define rg_audio_ring_used(ring) \
+    (__atomic_load_n(&(ring)->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&(ring)->tail, __ATOMIC_ACQUIRE))
+#define rg_audio_ring_free_space(ring) ((ring)->size - rg_audio_ring_used(ring))
+
 void rg_audio_init(int sample_rate);
 void rg_audio_deinit(void);
 void rg_audio_submit(const rg_audio_frame_t *frames, size_t count);
+size_t rg_audio_read(rg_audio_frame_t *frames, size_t count);
 rg_audio_counters_t rg_audio_get_counters(void);
 
 // const char **rg_audio_get_drivers(void);
@@ -54,3 +75,5 @@ bool rg_audio_get_mute(void);
 void rg_audio_set_mute(bool mute);
 int rg_audio_get_sample_rate(void);
 void rg_audio_set_sample_rate(int sample_rate);
+int rg_audio_get_source_rate(void);
+void rg_audio_set_source_rate(int sample_rate);
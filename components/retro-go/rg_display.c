@@ -8,6 +8,25 @@
 
 // static rg_display_driver_t driver;
 static rg_task_t *display_task_queue;
+static struct
+{
+    const rg_surface_t *surface;
+    int64_t submitted;
+} frame_queue[RG_DISPLAY_MAX_FRAMES];
+// Single producer, single consumer. Each index is written by one side only and the acquire/release
+// pairs make sure an entry's contents are visible before the index that publishes it.
+static unsigned frame_queue_head; // Written by the producer only
+static unsigned frame_queue_tail; // Written by the display task only
+static struct
+{
+    rg_surface_t *surface;
+    bool acquired; // Owned by the producer
+    int pending;   // Number of times it is present in frame_queue
+} frames[RG_DISPLAY_MAX_FRAMES];
+static size_t frames_count;
+static size_t frames_next; // Round-robin so the previous frame is still intact when the next is drawn
+static rg_mutex_t *frames_lock;
+static rg_semaphore_t *frame_done; // Given by the display task every time a frame leaves the queue
 static rg_display_counters_t counters;
 static rg_display_config_t config;
 static rg_surface_t *osd;
@@ -16,6 +35,11 @@ static rg_display_t display;
 static int16_t map_viewport_to_source_x[RG_SCREEN_WIDTH + 1];
 static int16_t map_viewport_to_source_y[RG_SCREEN_HEIGHT + 1];
 static uint32_t screen_line_checksum[RG_SCREEN_HEIGHT + 1];
+static bool screen_line_damaged[RG_SCREEN_HEIGHT + 1];
+static uint32_t palette_checksum;
+static int16_t filter_x_list[RG_SCREEN_WIDTH];
+static int filter_x_count;
+static int scaler_kind;
 
 #define LINE_IS_REPEATED(Y) (map_viewport_to_source_y[(Y)] == map_viewport_to_source_y[(Y) - 1])
 // This is to avoid flooring a number that is approximated to .9999999 and be explicit about it
@@ -54,11 +78,102 @@ static inline unsigned blend_pixels(unsigned a, unsigned b)
     // return (((a ^ b) & 0b1101111011110110U) >> 1) + (a & b);
 }
 
+// Line scalers, one set per source format. They all output 565BE and the kind is picked by
+// update_viewport_scaling() based on the exact source/viewport width ratio:
+// - 1X:   Same width, straight conversion
+// - 2X:   Every source pixel is doubled
+// - 5X4:  4 source pixels become 5 (256 => 320 and friends), filtered version blends the inserted pixel.
+//         The viewport width must be a multiple of 5.
+// - MAP:  Anything else, goes through map_viewport_to_source_x
+typedef void (*scaler_t)(uint16_t *dst, const void *src, const uint16_t *palette, int width);
+
+enum
+{
+    SCALER_1X = 0,
+    SCALER_2X,
+    SCALER_5X4,
+    SCALER_5X4_FILTER,
+    SCALER_MAP,
+    SCALER_COUNT,
+};
+
+#define PIXEL_PAL(i) palette[buffer[i]]
+#define PIXEL_565_LE(i) ((buffer[i] << 8) | (buffer[i] >> 8))
+#define PIXEL_565_BE(i) buffer[i]
+
+#define DEFINE_SCALERS(NAME, PTR_TYPE, PIXEL)                                                        \
+    static void scale_##NAME##_1x(uint16_t *dst, const void *src, const uint16_t *palette, int width) \
+    {                                                                                                \
+        const PTR_TYPE *buffer = src;                                                                \
+        int x = 0;                                                                                   \
+        for (; x + 4 <= width; x += 4)                                                               \
+        {                                                                                            \
+            dst[x + 0] = PIXEL(x + 0);                                                               \
+            dst[x + 1] = PIXEL(x + 1);                                                               \
+            dst[x + 2] = PIXEL(x + 2);                                                               \
+            dst[x + 3] = PIXEL(x + 3);                                                               \
+        }                                                                                            \
+        for (; x < width; ++x)                                                                       \
+            dst[x] = PIXEL(x);                                                                       \
+    }                                                                                                \
+    static void scale_##NAME##_2x(uint16_t *dst, const void *src, const uint16_t *palette, int width) \
+    {                                                                                                \
+        const PTR_TYPE *buffer = src;                                                                \
+        for (int x = 0; x < width / 2; ++x, dst += 2)                                                \
+            dst[0] = dst[1] = PIXEL(x);                                                              \
+    }                                                                                                \
+    static void scale_##NAME##_5x4(uint16_t *dst, const void *src, const uint16_t *palette, int width) \
+    {                                                                                                \
+        const PTR_TYPE *buffer = src;                                                                \
+        for (int x = 0; x < width; x += 5, dst += 5, buffer += 4)                                    \
+        {                                                                                            \
+            dst[0] = dst[1] = PIXEL(0);                                                              \
+            dst[2] = PIXEL(1);                                                                       \
+            dst[3] = PIXEL(2);                                                                       \
+            dst[4] = PIXEL(3);                                                                       \
+        }                                                                                            \
+    }                                                                                                \
+    static void scale_##NAME##_5x4_filter(uint16_t *dst, const void *src, const uint16_t *palette, int width) \
+    {                                                                                                \
+        const PTR_TYPE *buffer = src;                                                                \
+        for (int x = 0; x < width; x += 5, dst += 5, buffer += 4)                                    \
+        {                                                                                            \
+            unsigned a = PIXEL(0), b = PIXEL(1);                                                     \
+            dst[0] = a;                                                                              \
+            dst[1] = blend_pixels(a, b);                                                             \
+            dst[2] = b;                                                                              \
+            dst[3] = PIXEL(2);                                                                       \
+            dst[4] = PIXEL(3);                                                                       \
+        }                                                                                            \
+    }                                                                                                \
+    static void scale_##NAME##_map(uint16_t *dst, const void *src, const uint16_t *palette, int width) \
+    {                                                                                                \
+        const PTR_TYPE *buffer = src;                                                                \
+        const int16_t *map = map_viewport_to_source_x;                                               \
+        int x = 0;                                                                                   \
+        for (; x + 2 <= width; x += 2)                                                               \
+        {                                                                                            \
+            dst[x + 0] = PIXEL(map[x + 0]);                                                          \
+            dst[x + 1] = PIXEL(map[x + 1]);                                                          \
+        }                                                                                            \
+        for (; x < width; ++x)                                                                       \
+            dst[x] = PIXEL(map[x]);                                                                  \
+    }
+
+DEFINE_SCALERS(pal, uint8_t, PIXEL_PAL)
+DEFINE_SCALERS(565_le, uint16_t, PIXEL_565_LE)
+DEFINE_SCALERS(565_be, uint16_t, PIXEL_565_BE)
+
+static const scaler_t scalers[3][SCALER_COUNT] = {
+    {scale_pal_1x, scale_pal_2x, scale_pal_5x4, scale_pal_5x4_filter, scale_pal_map},
+    {scale_565_le_1x, scale_565_le_2x, scale_565_le_5x4, scale_565_le_5x4_filter, scale_565_le_map},
+    {scale_565_be_1x, scale_565_be_2x, scale_565_be_5x4, scale_565_be_5x4_filter, scale_565_be_map},
+};
+
 static inline void write_update(const rg_surface_t *update)
 {
     const int64_t time_start = rg_system_timer();
 
-    bool filter_x = display.viewport.filter_x;
     bool filter_y = display.viewport.filter_y;
     int draw_left = display.viewport.left;
     int draw_top = display.viewport.top;
@@ -86,6 +201,34 @@ static inline void write_update(const rg_surface_t *update)
     const int stride = update->stride;
     const void *data = update->data + update->offset + (crop_top * stride) + (crop_left * RG_PIXEL_GET_SIZE(format));
     const uint16_t *palette = update->palette;
+    const scaler_t scaler = scalers[(format & RG_PIXEL_PALETTE) ? 0 : (format == RG_PIXEL_565_LE ? 1 : 2)][scaler_kind];
+
+    // When the producer tracks damage we trust it and skip the rendering of clean lines entirely,
+    // otherwise we have to render everything and compare checksums of the result.
+    uint8_t *damage = update->damage;
+    bool force_update = false;
+
+    if (damage)
+    {
+        damage += (update->offset / stride) + crop_top;
+        // A palette change affects every line without touching the source data
+        if (palette && (format & RG_PIXEL_PALETTE))
+        {
+            uint32_t checksum = rg_hash((void *)palette, 256 * 2);
+            force_update = checksum != palette_checksum;
+            palette_checksum = checksum;
+        }
+        // Some producers keep rendering while we run, a line flagged between a test and a separate
+        // clear would be lost. Each flag is consumed once per frame with a single atomic exchange,
+        // repeated lines (always consecutive) reuse it because they can straddle two blocks.
+        for (int y = 0; y < draw_height; ++y)
+        {
+            if (y > 0 && LINE_IS_REPEATED(y))
+                screen_line_damaged[y] = screen_line_damaged[y - 1];
+            else
+                screen_line_damaged[y] = __atomic_exchange_n(&damage[map_viewport_to_source_y[y]], 0, __ATOMIC_ACQUIRE);
+        }
+    }
 
     int lines_per_buffer = LCD_BUFFER_LENGTH / draw_width;
     int lines_remaining = draw_height;
@@ -108,39 +251,73 @@ static inline void write_update(const rg_surface_t *update)
                 --lines_to_copy;
         }
 
+        if (damage)
+        {
+            bool dirty = force_update;
+            for (int i = 0; i < lines_to_copy; ++i)
+            {
+                if (screen_line_damaged[y + i])
+                    dirty = true;
+                else if (screen_line_checksum[draw_top + y + i] == 0)
+                    dirty = true;
+            }
+            if (!dirty)
+            {
+                lines_remaining -= lines_to_copy;
+                y += lines_to_copy;
+                continue;
+            }
+        }
+
         uint16_t *line_buffer = lcd_get_buffer(LCD_BUFFER_LENGTH);
         uint16_t *line_buffer_ptr = line_buffer;
+        uint16_t *pending_blend = NULL;
 
         uint32_t checksum = 0xFFFFFFFF;
-        bool need_update = !partial;
+        bool need_update = !partial || damage;
 
         for (int i = 0; i < lines_to_copy; ++i)
         {
             if (i > 0 && LINE_IS_REPEATED(y))
             {
-                memcpy(line_buffer_ptr, line_buffer_ptr - draw_width, draw_width * 2);
+                // The vertical filter blends this line with the next one, which isn't rendered yet.
+                // The block always ends with an unscaled line so we know that it will come.
+                if (pending_blend) // More than one repeat, only blend the last one
+                {
+                    memcpy(pending_blend, pending_blend - draw_width, draw_width * 2);
+                    pending_blend = NULL;
+                }
+                if (filter_y)
+                    pending_blend = line_buffer_ptr;
+                else
+                    memcpy(line_buffer_ptr, line_buffer_ptr - draw_width, draw_width * 2);
                 line_buffer_ptr += draw_width;
             }
             else
             {
-                #define RENDER_LINE(PTR_TYPE, PIXEL) { \
-                    PTR_TYPE *buffer = (PTR_TYPE *)(data + map_viewport_to_source_y[y] * stride);\
-                    for (int xx = 0; xx < draw_width; ++xx) { \
-                        int x = map_viewport_to_source_x[xx]; \
-                        *line_buffer_ptr++ = (PIXEL); \
-                    } \
+                scaler(line_buffer_ptr, data + map_viewport_to_source_y[y] * stride, palette, draw_width);
+
+                for (int j = 0; j < filter_x_count; ++j)
+                {
+                    int x = filter_x_list[j];
+                    line_buffer_ptr[x] = blend_pixels(line_buffer_ptr[x - 1], line_buffer_ptr[x + 1]);
                 }
-                if (format & RG_PIXEL_PALETTE)
-                    RENDER_LINE(uint8_t, palette[buffer[x]])
-                else if (format == RG_PIXEL_565_LE)
-                    RENDER_LINE(uint16_t, (buffer[x] << 8) | (buffer[x] >> 8))
-                else
-                    RENDER_LINE(uint16_t, buffer[x])
 
-                if (partial)
+                if (pending_blend)
                 {
-                    checksum = rg_hash((void*)(line_buffer_ptr - draw_width), draw_width * 2);
+                    uint16_t *lineA = pending_blend - draw_width;
+                    uint16_t *lineC = line_buffer_ptr;
+                    for (int x = 0; x < draw_width; ++x)
+                        pending_blend[x] = blend_pixels(lineA[x], lineC[x]);
+                    pending_blend = NULL;
                 }
+
+                if (partial && !damage)
+                {
+                    checksum = rg_hash((void*)line_buffer_ptr, draw_width * 2);
+                }
+
+                line_buffer_ptr += draw_width;
             }
 
             if (screen_line_checksum[draw_top + y] != checksum)
@@ -152,39 +329,6 @@ static inline void write_update(const rg_surface_t *update)
             ++y;
         }
 
-        if (filter_x && need_update)
-        {
-            for (int i = 0; i < lines_to_copy; ++i)
-            {
-                uint16_t *buffer = line_buffer + i * draw_width;
-                for (int x = 1; x < draw_width - 1; ++x)
-                {
-                    if (map_viewport_to_source_x[x] == map_viewport_to_source_x[x - 1])
-                    {
-                        buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
-                    }
-                }
-            }
-        }
-
-        if (filter_y && need_update)
-        {
-            int top = y - lines_to_copy;
-            for (int i = 1; i < lines_to_copy - 1; ++i)
-            {
-                if (LINE_IS_REPEATED(top + i))
-                {
-                    uint16_t *lineA = line_buffer + (i - 1) * draw_width;
-                    uint16_t *lineB = line_buffer + (i + 0) * draw_width;
-                    uint16_t *lineC = line_buffer + (i + 1) * draw_width;
-                    for (size_t x = 0; x < draw_width; ++x)
-                    {
-                        lineB[x] = blend_pixels(lineA[x], lineC[x]);
-                    }
-                }
-            }
-        }
-
         if (need_update)
         {
             int left = display.screen.margin_left + draw_left;
@@ -214,7 +358,9 @@ static inline void write_update(const rg_surface_t *update)
         counters.fullFrames++;
     else
         counters.partFrames++;
-    counters.busyTime += rg_system_timer() - time_start;
+    int elapsed = rg_system_timer() - time_start;
+    counters.busyTime += elapsed;
+    RG_TIMER_ADD(RG_TIMER_BLIT, elapsed);
 }
 
 static void update_viewport_scaling(void)
@@ -268,9 +414,38 @@ static void update_viewport_scaling(void)
     for (int y = 0; y < display.screen.height; ++y)
         map_viewport_to_source_y[y] = FLOAT_TO_INT(y * display.viewport.step_y);
 
-    RG_LOGI("%dx%d@%.3f => %dx%d@%.3f left:%d top:%d step_x:%.2f step_y:%.2f", src_width, src_height,
+    // Pick the fastest line scaler that produces exactly the same output as the generic one
+    int draw_width = display.viewport.width + RG_MIN(display.viewport.left, 0) * 2;
+    bool is_1x = true, is_2x = (draw_width % 2) == 0, is_5x4 = (draw_width % 5) == 0;
+    for (int x = 0; x < draw_width; ++x)
+    {
+        int src_x = map_viewport_to_source_x[x];
+        is_1x = is_1x && src_x == x;
+        is_2x = is_2x && src_x == x / 2;
+        is_5x4 = is_5x4 && src_x == (x / 5) * 4 + (x % 5 ? x % 5 - 1 : 0);
+    }
+
+    if (is_1x)
+        scaler_kind = SCALER_1X;
+    else if (is_2x)
+        scaler_kind = SCALER_2X;
+    else if (is_5x4)
+        scaler_kind = display.viewport.filter_x ? SCALER_5X4_FILTER : SCALER_5X4;
+    else
+        scaler_kind = SCALER_MAP;
+
+    // The horizontal filter blends every repeated pixel with its neighbours, unless the scaler does it
+    filter_x_count = 0;
+    for (int x = 1; x < draw_width - 1 && display.viewport.filter_x && scaler_kind != SCALER_5X4_FILTER; ++x)
+    {
+        if (map_viewport_to_source_x[x] == map_viewport_to_source_x[x - 1])
+            filter_x_list[filter_x_count++] = x;
+    }
+
+    RG_LOGI("%dx%d@%.3f => %dx%d@%.3f left:%d top:%d step_x:%.2f step_y:%.2f scaler:%d", src_width, src_height,
             (float)src_width / src_height, new_width, new_height, (float)new_width / new_height,
-            display.viewport.left, display.viewport.top, display.viewport.step_x, display.viewport.step_y);
+            display.viewport.left, display.viewport.top, display.viewport.step_x, display.viewport.step_y,
+            scaler_kind);
 }
 
 static bool load_border_file(const char *filename)
@@ -280,20 +455,42 @@ static bool load_border_file(const char *filename)
     free(border), border = NULL;
     display.changed = true;
 
-    if (filename && (border = rg_surface_load_image_file(filename, 0)))
+    if (filename)
+        border = rg_surface_load_image_file_scaled(filename, display.screen.width, display.screen.height, 0);
+    return border != NULL;
+}
+
+// Can be called from any task, so both indexes are read atomically
+static inline bool frame_queue_empty(void)
+{
+    return __atomic_load_n(&frame_queue_tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&frame_queue_head, __ATOMIC_ACQUIRE);
+}
+
+// Blocks until the display task is done with a frame. A binary semaphore only wakes one waiter and
+// the producer and another task may both be waiting, so the timeout is what unblocks the other one.
+static inline void wait_frame_done(void)
+{
+    rg_semaphore_take(frame_done, 10);
+}
+
+// Submitting a frame also hands it back to us, a frame is free once it's neither acquired nor pending
+static bool update_frame(const rg_surface_t *surface, int pending_delta)
+{
+    bool found = false;
+    if (!frames_count)
+        return false;
+    rg_mutex_take(frames_lock, -1);
+    for (size_t i = 0; i < frames_count; ++i)
     {
-        if (border->width != display.screen.width || border->height != display.screen.height)
+        if (frames[i].surface == surface)
         {
-            rg_surface_t *resized = rg_surface_resize(border, display.screen.width, display.screen.height);
-            if (resized)
-            {
-                rg_surface_free(border);
-                border = resized;
-            }
+            frames[i].pending += pending_delta;
+            frames[i].acquired = false;
+            found = true;
         }
-        return true;
     }
-    return false;
+    rg_mutex_give(frames_lock);
+    return found;
 }
 
 IRAM_ATTR
@@ -301,30 +498,45 @@ static void display_task(void *arg)
 {
     rg_task_msg_t msg;
 
-    while (rg_task_peek(&msg))
+    // Messages are only used to wake us up, the frames themselves go through frame_queue
+    while (rg_task_receive(&msg))
     {
         // Received a shutdown request!
         if (msg.type == RG_TASK_MSG_STOP)
             break;
 
-        if (display.changed)
+        unsigned tail = frame_queue_tail;
+        while (tail != __atomic_load_n(&frame_queue_head, __ATOMIC_ACQUIRE))
         {
-            if (config.scaling != RG_DISPLAY_SCALING_FULL)
+            const rg_surface_t *update = frame_queue[tail % RG_DISPLAY_MAX_FRAMES].surface;
+            int64_t submitted = frame_queue[tail % RG_DISPLAY_MAX_FRAMES].submitted;
+
+            if (display.changed)
             {
-                if (border)
-                    rg_display_write(0, 0, border->width, border->height, 0, border->data, RG_DISPLAY_WRITE_NOSYNC);
-                else
-                    rg_display_clear(C_BLACK);
+                if (config.scaling != RG_DISPLAY_SCALING_FULL)
+                {
+                    if (border)
+                        rg_display_write(0, 0, border->width, border->height, 0, border->data, RG_DISPLAY_WRITE_NOSYNC);
+                    else
+                        rg_display_clear(C_BLACK);
+                }
+                update_viewport_scaling();
+                display.changed = false;
             }
-            update_viewport_scaling();
-            display.changed = false;
-        }
 
-        write_update(msg.dataPtr);
+            write_update(update);
 
-        rg_task_receive(&msg);
+            lcd_sync();
 
-        lcd_sync();
+            int64_t latency = rg_system_timer() - submitted;
+            counters.latencyTime += latency;
+            counters.latencyMax = RG_MAX(counters.latencyMax, latency);
+
+            if (frames_count)
+                update_frame(update, -1);
+            __atomic_store_n(&frame_queue_tail, ++tail, __ATOMIC_RELEASE);
+            rg_semaphore_give(frame_done);
+        }
     }
 }
 
@@ -437,6 +649,10 @@ void rg_display_submit(const rg_surface_t *update, uint32_t flags)
     if (!update || !update->data)
         return;
 
+#ifdef RG_BENCHMARK
+    rg_bench_hash_video(update);
+#endif
+
     if (display.source.width != update->width || display.source.height != update->height)
     {
         rg_display_sync(true);
@@ -445,7 +661,23 @@ void rg_display_submit(const rg_surface_t *update, uint32_t flags)
         display.changed = true;
     }
 
-    rg_task_send(display_task_queue, &(rg_task_msg_t){.dataPtr = update});
+    bool is_frame = update_frame(update, 1);
+
+    // Frames from our pool can be queued up to the queue depth because the producer can't touch them
+    // until they're released. Other surfaces may be reused as soon as we return, so we keep the old
+    // behaviour of waiting for everything else to be on screen first.
+    unsigned max_pending = is_frame ? RG_DISPLAY_MAX_FRAMES : 1;
+    unsigned head = frame_queue_head;
+    while (head - __atomic_load_n(&frame_queue_tail, __ATOMIC_ACQUIRE) >= max_pending)
+        wait_frame_done();
+
+    frame_queue[head % RG_DISPLAY_MAX_FRAMES].surface = update;
+    frame_queue[head % RG_DISPLAY_MAX_FRAMES].submitted = time_start;
+    __atomic_store_n(&frame_queue_head, head + 1, __ATOMIC_RELEASE);
+
+    // Wake up the display task if it isn't already
+    if (!rg_task_messages_waiting(display_task_queue))
+        rg_task_send(display_task_queue, &(rg_task_msg_t){0});
 
     counters.blockTime += rg_system_timer() - time_start;
     counters.totalFrames++;
@@ -453,9 +685,64 @@ void rg_display_submit(const rg_surface_t *update, uint32_t flags)
 
 bool rg_display_sync(bool block)
 {
-    while (block && rg_task_messages_waiting(display_task_queue))
-        continue; // We should probably yield?
-    return !rg_task_messages_waiting(display_task_queue);
+#ifdef RG_BENCHMARK
+    block = true; // Never let the cores think they're late
+#endif
+    while (block && !frame_queue_empty())
+        wait_frame_done();
+    return frame_queue_empty();
+}
+
+bool rg_display_set_frames(rg_surface_t **surfaces, size_t count)
+{
+    if (count > RG_DISPLAY_MAX_FRAMES)
+    {
+        RG_LOGE("Too many frames: %d, max: %d", (int)count, RG_DISPLAY_MAX_FRAMES);
+        return false;
+    }
+    rg_display_sync(true);
+    rg_mutex_take(frames_lock, -1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        frames[i].surface = surfaces[i];
+        frames[i].acquired = false;
+        frames[i].pending = 0;
+    }
+    frames_count = count;
+    frames_next = 0;
+    rg_mutex_give(frames_lock);
+    return true;
+}
+
+rg_surface_t *rg_display_acquire_frame(bool block)
+{
+    if (!frames_count)
+        return NULL;
+
+    while (true)
+    {
+        rg_surface_t *frame = NULL;
+        rg_mutex_take(frames_lock, -1);
+        for (size_t n = 0; n < frames_count && !frame; ++n)
+        {
+            size_t i = (frames_next + n) % frames_count;
+            if (!frames[i].acquired && frames[i].pending == 0)
+            {
+                frames[i].acquired = true;
+                frame = frames[i].surface;
+                frames_next = i + 1;
+            }
+        }
+        rg_mutex_give(frames_lock);
+        if (frame || !block)
+            return frame;
+        wait_frame_done();
+    }
+}
+
+void rg_display_release_frame(rg_surface_t *frame)
+{
+    update_frame(frame, 0);
 }
 
 void rg_display_write(int left, int top, int width, int height, int stride, const uint16_t *buffer, uint32_t flags)
@@ -572,6 +859,8 @@ void rg_display_init(void)
         .changed = true,
     };
     lcd_init();
+    frames_lock = rg_mutex_create();
+    frame_done = rg_semaphore_create();
     display_task_queue = rg_task_create("rg_display", &display_task, NULL, 4 * 1024, RG_TASK_PRIORITY_6, 1);
     if (config.border_file)
         load_border_file(config.border_file);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum
@@ -30,6 +31,8 @@ typedef enum
     RG_DISPLAY_ROTATION_COUNT,
 } display_rotation_t;
 
+#define RG_DISPLAY_MAX_FRAMES 4
+
 typedef enum
 {
     RG_DISPLAY_BACKLIGHT_MIN = 1,
@@ -59,6 +62,8 @@ typedef struct
     int32_t partFrames;
     int64_t blockTime;
     int64_t busyTime;
+    int64_t latencyTime; // Sum of all submit => scan-out delays
+    int64_t latencyMax;  // Worst submit => scan-out delay
 } rg_display_counters_t;
 
 typedef struct
@@ -106,6 +111,9 @@ void rg_display_clear(uint16_t color_le);
 bool rg_display_sync(bool block);
 void rg_display_force_redraw(void);
 void rg_display_submit(const rg_surface_t *update, uint32_t flags);
+bool rg_display_set_frames(rg_surface_t **frames, size_t count);
+rg_surface_t *rg_display_acquire_frame(bool block);
+void rg_display_release_frame(rg_surface_t *frame);
 
 rg_display_counters_t rg_display_get_counters(void);
 const rg_display_t *rg_display_get_info(void);
@@ -181,7 +181,7 @@ rg_image_t *rg_gui_get_theme_image(const char *name)
     if (!name || !gui.theme_name[0])
         return NULL;
     snprintf(pathbuf, RG_PATH_MAX, "%s/%s/%s", RG_BASE_PATH_THEMES, gui.theme_name, name);
-    return rg_surface_load_image_file(pathbuf, 0);
+    return rg_surface_load_image_cached(pathbuf, 0, 0);
 }
 
 const char *rg_gui_get_theme_name(void)
@@ -1226,6 +1226,27 @@ static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rewind_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_emu_set_rewind(!rg_emu_get_rewind());
+    strcpy(option->value, rg_emu_get_rewind() ? "On " : "Off");
+    return RG_DIALOG_VOID;
+}
+
+static rg_gui_event_t runahead_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV)
+        rg_emu_set_runahead(rg_emu_get_runahead() - 1);
+    else if (event == RG_DIALOG_NEXT)
+        rg_emu_set_runahead(rg_emu_get_runahead() + 1);
+    if (rg_emu_get_runahead() > 0)
+        sprintf(option->value, "%d frame%s", rg_emu_get_runahead(), rg_emu_get_runahead() > 1 ? "s" : "");
+    else
+        strcpy(option->value, "Off");
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t led_indicator_opt_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -1513,6 +1534,10 @@ void rg_gui_options_menu(void)
         *opt++ = (rg_gui_option_t){0, "Filter",    "-", RG_DIALOG_FLAG_NORMAL, &filter_update_cb};
         *opt++ = (rg_gui_option_t){0, "Border",    "-", RG_DIALOG_FLAG_NORMAL, &border_update_cb};
         *opt++ = (rg_gui_option_t){0, "Speed",     "-", RG_DIALOG_FLAG_NORMAL, &speedup_update_cb};
+        if (app->handlers.saveStateMem && app->handlers.loadStateMem)
+            *opt++ = (rg_gui_option_t){0, "Rewind",    "-", RG_DIALOG_FLAG_NORMAL, &rewind_update_cb};
+        if (app->handlers.saveSnapshot && app->handlers.loadSnapshot)
+            *opt++ = (rg_gui_option_t){0, "Run-ahead", "-", RG_DIALOG_FLAG_NORMAL, &runahead_update_cb};
     }
 
     size_t extra_options = get_dialog_items_count(app->options);
@@ -1590,8 +1615,10 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
     char screen_res[20], source_res[20], scaled_res[20];
     char stack_hwm[20], heap_free[20], block_free[20];
     char local_time[32], timezone[32], uptime[20];
-    char battery_info[25], frame_time[32];
+    char battery_info[25], frame_time[32], frame_latency[32];
     char app_name[32], network_str[64];
+    char timer_stats[RG_TIMER_COUNT][32];
+    int timer_flag = RG_ENABLE_TIMERS ? RG_DIALOG_FLAG_NORMAL : RG_DIALOG_FLAG_HIDDEN;
 
     const rg_gui_option_t options[] = {
         {0, "Screen res", screen_res,   RG_DIALOG_FLAG_NORMAL, NULL},
@@ -1607,6 +1634,13 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
         {0, "Uptime    ", uptime,       RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Battery   ", battery_info, RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Blit time ", frame_time,   RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Latency   ", frame_latency, RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Emu CPU   ", timer_stats[RG_TIMER_CPU], timer_flag, NULL},
+        {0, "Emu submit", timer_stats[RG_TIMER_PRESENT], timer_flag, NULL},
+        {0, "Emu audio ", timer_stats[RG_TIMER_AUDIO], timer_flag, NULL},
+        {0, "Disp blit ", timer_stats[RG_TIMER_BLIT], timer_flag, NULL},
+        {0, "Audio out ", timer_stats[RG_TIMER_AUDIO_OUT], timer_flag, NULL},
+        {0, "Input     ", timer_stats[RG_TIMER_INPUT], timer_flag, NULL},
         RG_DIALOG_SEPARATOR,
         {0, "Overclock", "-", RG_DIALOG_FLAG_NORMAL, &overclock_update_cb},
         {1, "Reboot to firmware", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
@@ -1616,6 +1650,7 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
         {5, "Cheats    ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {6, "Crash     ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {7, "Log=debug ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        {8, "Save timers", NULL, timer_flag, NULL},
         RG_DIALOG_END
     };
 
@@ -1633,10 +1668,20 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
     {
         int total = (float)display_stats.busyTime / display_stats.totalFrames / 1000.f;
         int block = (float)display_stats.blockTime / display_stats.totalFrames / 1000.f;
+        int latency = (float)display_stats.latencyTime / display_stats.totalFrames / 1000.f;
+        int latency_max = display_stats.latencyMax / 1000;
         snprintf(frame_time, 20, "%dms (block: %dms)", total, block);
+        snprintf(frame_latency, 32, "%dms (max: %dms)", latency, latency_max);
     }
     else
+    {
         snprintf(frame_time, 20, "N/A");
+        snprintf(frame_latency, 32, "N/A");
+    }
+    // Per-frame time: avg / p95 / max
+    for (size_t i = 0; i < RG_TIMER_COUNT; ++i)
+        snprintf(timer_stats[i], 32, "%.1f/%.1f/%.1fms", stats.timers[i].avg / 1000.f,
+                 stats.timers[i].p95 / 1000.f, stats.timers[i].max / 1000.f);
     snprintf(stack_hwm, 20, "%d", stats.freeStackMain);
     snprintf(heap_free, 20, "%d+%d", stats.freeMemoryInt, stats.freeMemoryExt);
     snprintf(block_free, 20, "%d+%d", stats.freeBlockInt, stats.freeBlockExt);
@@ -1688,6 +1733,9 @@ void rg_gui_debug_menu(const rg_gui_option_t *extra_options)
     case 7:
         rg_system_set_log_level(RG_LOG_DEBUG);
         break;
+    case 8:
+        rg_system_save_timers(RG_STORAGE_ROOT "/timers.csv");
+        break;
     }
 }
 
@@ -1703,7 +1751,7 @@ static rg_gui_event_t slot_select_cb(rg_gui_option_t *option, rg_gui_event_t eve
         char buffer[100];
         if (slot->is_used)
         {
-            preview = rg_surface_load_image_file(slot->preview, 0);
+            preview = rg_surface_load_image_file_scaled(slot->preview, gui.screen_width, gui.screen_height - margin * 2, 0);
             if (slot->is_lastused)
                 snprintf(buffer, sizeof(buffer), "Slot %d (last used)", slot->id);
             else
@@ -1773,8 +1821,31 @@ void rg_gui_game_menu(void)
         {7000, "Quit    ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         RG_DIALOG_END
     };
+    static bool rewinding = false;
     int slot, sel;
 
+    // When rewind is enabled the menu opens on release and holding MENU+LEFT steps back in time.
+    // Cores call us every frame while MENU is down, so we only do one step per call.
+    if (rg_emu_get_rewind())
+    {
+        uint32_t joystick;
+        while ((joystick = rg_input_read_gamepad()) & RG_KEY_MENU)
+        {
+            if (joystick & RG_KEY_LEFT)
+            {
+                rewinding = true;
+                rg_emu_rewind();
+                return;
+            }
+            rg_task_delay(10);
+        }
+        if (rewinding)
+        {
+            rewinding = false;
+            return;
+        }
+    }
+
     rg_audio_set_mute(true);
 
     sel = rg_gui_dialog("Retro-Go", choices, 0);
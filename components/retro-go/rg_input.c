@@ -203,6 +203,7 @@ static void input_task(void *arg)
 
     while (input_task_running)
     {
+        int64_t time_start = rg_system_timer();
         if (rg_input_read_gamepad_raw(&state))
         {
             for (int i = 0; i < RG_KEY_COUNT; ++i)
@@ -221,6 +222,7 @@ static void input_task(void *arg)
             }
             gamepad_state = local_gamepad_state;
         }
+        RG_TIMER_ADD(RG_TIMER_INPUT, rg_system_timer() - time_start);
 
         if (rg_system_timer() >= next_battery_update)
         {
@@ -338,6 +340,9 @@ void rg_input_deinit(void)
 
 uint32_t rg_input_read_gamepad(void)
 {
+#ifdef RG_BENCHMARK
+    return rg_bench_input();
+#endif
 #ifdef RG_TARGET_SDL2
     SDL_PumpEvents();
 #endif
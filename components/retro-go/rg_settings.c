@@ -5,12 +5,273 @@
 #include <string.h>
 #include <cJSON.h>
 
-static cJSON *config_root = NULL;
+/**
+ * Settings live in memory as small arrays of hashed keys, one per namespace. On disk each namespace
+ * is a binary log (<name>.bin) to which commits append only the values that changed. The log is
+ * rewritten atomically (compacted) once it grows past twice the size of its live values.
+ * <name>.json is exported for users along with each compaction and when the app exits, it is imported
+ * back (replacing the namespace) if its mtime no longer matches the one recorded in the log header.
+ */
 
+#define STORE_MAGIC 0x31534752 // "RGS1"
 
-static cJSON *json_root(const char *name, bool set_dirty)
+enum
 {
-    if (!config_root)
+    VALUE_DELETED = 0,
+    VALUE_NULL,
+    VALUE_NUMBER,
+    VALUE_STRING,
+};
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t json_mtime; // mtime of the JSON we exported, if it no longer matches the user edited it
+    uint32_t json_size;  // Size of the log when the JSON was exported, anything past it isn't in the JSON
+} store_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t checksum; // CRC32 of the rest of the record, an incomplete append will fail this check
+    uint8_t type;
+    uint8_t key_len;
+    uint16_t value_len;
+    // char key[key_len];
+    // uint8_t value[value_len];
+} record_header_t;
+
+typedef struct
+{
+    uint32_t hash;
+    uint8_t type;
+    bool dirty;
+    char *key;
+    union
+    {
+        double number;
+        char *string;
+    };
+} setting_t;
+
+typedef struct
+{
+    char *name;
+    setting_t *items;
+    size_t count;
+    size_t log_size;
+    uint32_t json_mtime;
+    bool dirty, compact;
+    bool json_stale; // Values were appended since the last export
+} namespace_t;
+
+static namespace_t *namespaces;
+static size_t namespaces_count;
+static bool initialized;
+
+
+static void get_path(char *buffer, const char *name, const char *ext)
+{
+    snprintf(buffer, RG_PATH_MAX, "%s/%s.%s", RG_BASE_PATH_CONFIG, name, ext);
+}
+
+static size_t record_size(const setting_t *item)
+{
+    size_t value_len = item->type == VALUE_NUMBER ? sizeof(double) : item->type == VALUE_STRING ? strlen(item->string) : 0;
+    return sizeof(record_header_t) + strlen(item->key) + RG_MIN(value_len, 0xFFFF);
+}
+
+static size_t write_record(const setting_t *item, uint8_t *buffer)
+{
+    record_header_t *header = (record_header_t *)buffer;
+    size_t key_len = strlen(item->key);
+    size_t value_len = item->type == VALUE_NUMBER ? sizeof(double) : item->type == VALUE_STRING ? strlen(item->string) : 0;
+    value_len = RG_MIN(value_len, 0xFFFF);
+    header->type = item->type;
+    header->key_len = key_len;
+    header->value_len = value_len;
+    memcpy(buffer + sizeof(*header), item->key, key_len);
+    if (value_len > 0)
+        memcpy(buffer + sizeof(*header) + key_len, item->type == VALUE_NUMBER ? (void *)&item->number : item->string, value_len);
+    header->checksum = rg_crc32(0, buffer + 4, sizeof(*header) - 4 + key_len + value_len);
+    return sizeof(*header) + key_len + value_len;
+}
+
+static void free_value(setting_t *item)
+{
+    if (item->type == VALUE_STRING)
+        free(item->string);
+    item->type = VALUE_DELETED;
+}
+
+static setting_t *find_setting(namespace_t *ns, const char *key, uint32_t hash)
+{
+    for (size_t i = 0; i < ns->count; ++i)
+    {
+        if (ns->items[i].hash == hash && strcmp(ns->items[i].key, key) == 0)
+            return &ns->items[i];
+    }
+    return NULL;
+}
+
+static void set_value(namespace_t *ns, const char *key, int type, double number, const char *string, bool dirty)
+{
+    if (!ns || !key || strlen(key) > 0xFF)
+        return;
+
+    uint32_t hash = rg_hash(key, strlen(key));
+    setting_t *item = find_setting(ns, key, hash);
+
+    if (!item)
+    {
+        if (type == VALUE_DELETED)
+            return;
+        setting_t *items = realloc(ns->items, (ns->count + 1) * sizeof(setting_t));
+        if (!items)
+            return;
+        ns->items = items;
+        item = memset(&ns->items[ns->count++], 0, sizeof(setting_t));
+        item->hash = hash;
+        item->key = strdup(key);
+    }
+    else if (item->type == type && (type == VALUE_DELETED || type == VALUE_NULL
+                                    || (type == VALUE_NUMBER && item->number == number)
+                                    || (type == VALUE_STRING && strcmp(item->string, string) == 0)))
+    {
+        return; // Unchanged
+    }
+
+    free_value(item);
+    item->type = type;
+    if (type == VALUE_NUMBER)
+        item->number = number;
+    else if (type == VALUE_STRING)
+        item->string = strdup(string);
+    item->dirty |= dirty;
+    ns->dirty |= dirty;
+}
+
+static void import_json(namespace_t *ns, const char *path)
+{
+    void *data;
+    size_t data_len;
+
+    if (!rg_storage_read_file(path, &data, &data_len, 0))
+        return;
+
+    cJSON *values = cJSON_Parse((char *)data);
+    free(data);
+
+    if (!cJSON_IsObject(values))
+    {
+        RG_LOGE("Config file parsing failed: '%s'", path);
+        cJSON_Delete(values);
+        return;
+    }
+
+    // The JSON holds the whole namespace, whatever isn't in it must go
+    for (size_t i = 0; i < ns->count; ++i)
+        set_value(ns, ns->items[i].key, VALUE_DELETED, 0, NULL, true);
+
+    for (cJSON *obj = values->child; obj; obj = obj->next)
+    {
+        if (cJSON_IsNumber(obj))
+            set_value(ns, obj->string, VALUE_NUMBER, obj->valuedouble, NULL, true);
+        else if (cJSON_IsBool(obj))
+            set_value(ns, obj->string, VALUE_NUMBER, cJSON_IsTrue(obj), NULL, true);
+        else if (cJSON_IsString(obj))
+            set_value(ns, obj->string, VALUE_STRING, 0, obj->valuestring, true);
+        else if (cJSON_IsNull(obj))
+            set_value(ns, obj->string, VALUE_NULL, 0, NULL, true);
+    }
+
+    cJSON_Delete(values);
+    ns->compact = true;
+    RG_LOGI("Config file imported: '%s'", path);
+}
+
+static void load_namespace(namespace_t *ns)
+{
+    char pathbuf[RG_PATH_MAX];
+    uint8_t *data;
+    size_t data_len;
+
+    get_path(pathbuf, ns->name, "bin");
+    if (rg_storage_read_file(pathbuf, (void **)&data, &data_len, 0))
+    {
+        const store_header_t *header = (const store_header_t *)data;
+        size_t pos = sizeof(store_header_t);
+
+        if (data_len >= pos && header->magic == STORE_MAGIC)
+        {
+            ns->json_mtime = header->json_mtime;
+            while (pos + sizeof(record_header_t) <= data_len)
+            {
+                const record_header_t *record = (const record_header_t *)(data + pos);
+                size_t length = sizeof(record_header_t) + record->key_len + record->value_len;
+                if (pos + length > data_len || rg_crc32(0, data + pos + 4, length - 4) != record->checksum)
+                    break;
+
+                char key[256], *value = (char *)record + sizeof(record_header_t) + record->key_len;
+                memcpy(key, (char *)record + sizeof(record_header_t), record->key_len);
+                key[record->key_len] = 0;
+
+                if (record->type == VALUE_NUMBER && record->value_len == sizeof(double))
+                {
+                    double number;
+                    memcpy(&number, value, sizeof(double));
+                    set_value(ns, key, VALUE_NUMBER, number, NULL, false);
+                }
+                else if (record->type == VALUE_STRING)
+                {
+                    char *string = malloc(record->value_len + 1);
+                    if (string)
+                    {
+                        memcpy(string, value, record->value_len);
+                        string[record->value_len] = 0;
+                        set_value(ns, key, VALUE_STRING, 0, string, false);
+                        free(string);
+                    }
+                }
+                else
+                {
+                    set_value(ns, key, record->type == VALUE_NULL ? VALUE_NULL : VALUE_DELETED, 0, NULL, false);
+                }
+                pos += length;
+            }
+            ns->log_size = pos;
+            ns->json_stale = pos != header->json_size;
+        }
+
+        // A truncated log (interrupted append) or unknown format will be rewritten on the next commit
+        if (pos != data_len)
+        {
+            RG_LOGW("Config store '%s' is damaged, it will be rebuilt.", pathbuf);
+            ns->compact = true;
+        }
+        RG_LOGI("Config store loaded: '%s'", pathbuf);
+        free(data);
+    }
+
+    get_path(pathbuf, ns->name, "json");
+    rg_stat_t info = rg_storage_stat(pathbuf);
+    if (info.exists && (uint32_t)info.mtime != ns->json_mtime)
+        import_json(ns, pathbuf);
+
+    // Deleted values are only needed to produce tombstones
+    size_t count = 0;
+    for (size_t i = 0; i < ns->count; ++i)
+    {
+        if (ns->items[i].type != VALUE_DELETED || ns->items[i].dirty)
+            ns->items[count++] = ns->items[i];
+        else
+            free(ns->items[i].key);
+    }
+    ns->count = count;
+}
+
+static namespace_t *get_namespace(const char *name)
+{
+    if (!initialized)
         return NULL;
 
     if (name == NS_GLOBAL)
@@ -24,94 +285,208 @@ static cJSON *json_root(const char *name, bool set_dirty)
     else if (name == NS_BOOT)
         name = "boot";
 
-    cJSON *branch = cJSON_GetObjectItem(config_root, name);
-    if (!branch)
+    if (!name)
+        return NULL;
+
+    for (size_t i = 0; i < namespaces_count; ++i)
+    {
+        if (strcmp(namespaces[i].name, name) == 0)
+            return &namespaces[i];
+    }
+
+    namespace_t *list = realloc(namespaces, (namespaces_count + 1) * sizeof(namespace_t));
+    if (!list)
+        return NULL;
+    namespaces = list;
+
+    namespace_t *ns = memset(&namespaces[namespaces_count++], 0, sizeof(namespace_t));
+    ns->name = strdup(name);
+    load_namespace(ns);
+    return ns;
+}
+
+static bool write_log(namespace_t *ns, const char *path, bool compact)
+{
+    size_t buffer_len = compact ? sizeof(store_header_t) : 0;
+    for (size_t i = 0; i < ns->count; ++i)
     {
-        branch = cJSON_AddObjectToObject(config_root, name);
-        cJSON_AddStringToObject(branch, "namespace", name);
-        cJSON_AddNumberToObject(branch, "changed", 0);
+        if (compact ? (ns->items[i].type != VALUE_DELETED) : ns->items[i].dirty)
+            buffer_len += record_size(&ns->items[i]);
+    }
+
+    uint8_t *buffer = malloc(buffer_len);
+    if (!buffer)
+        return false;
 
-        void *data; size_t data_len;
-        char pathbuf[RG_PATH_MAX];
-        snprintf(pathbuf, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, name);
-        if (rg_storage_read_file(pathbuf, &data, &data_len, 0))
+    size_t pos = 0;
+    if (compact)
+    {
+        *(store_header_t *)buffer = (store_header_t){STORE_MAGIC, ns->json_mtime, buffer_len};
+        pos += sizeof(store_header_t);
+    }
+    for (size_t i = 0; i < ns->count; ++i)
+    {
+        if (compact ? (ns->items[i].type != VALUE_DELETED) : ns->items[i].dirty)
+            pos += write_record(&ns->items[i], buffer + pos);
+    }
+
+    bool success = false;
+    if (compact)
+    {
+        success = rg_storage_write_file(path, buffer, pos, RG_FILE_ATOMIC_WRITE);
+    }
+    else
+    {
+        FILE *fp = fopen(path, "ab");
+        if (fp)
         {
-            cJSON *values = cJSON_Parse((char *)data);
-            if (values)
-            {
-                RG_LOGI("Config file loaded: '%s'", pathbuf);
-                cJSON_AddItemToObject(branch, "values", values);
-            }
-            else
-                RG_LOGE("Config file parsing failed: '%s'", pathbuf);
-            free(data);
+            success = fwrite(buffer, pos, 1, fp) == 1;
+            success &= fclose(fp) == 0;
         }
     }
+    free(buffer);
+
+    if (success)
+        ns->log_size = compact ? pos : ns->log_size + pos;
+    else if (!compact)
+        ns->compact = true; // The log may be gone or damaged, rebuild it next time
+
+    return success;
+}
 
-    cJSON *root = cJSON_GetObjectItem(branch, "values");
-    if (!cJSON_IsObject(root))
+static bool export_json(namespace_t *ns, const char *path)
+{
+    cJSON *values = cJSON_CreateObject();
+    for (size_t i = 0; i < ns->count; ++i)
+    {
+        setting_t *item = &ns->items[i];
+        if (item->type == VALUE_NUMBER)
+            cJSON_AddNumberToObject(values, item->key, item->number);
+        else if (item->type == VALUE_STRING)
+            cJSON_AddStringToObject(values, item->key, item->string);
+        else if (item->type == VALUE_NULL)
+            cJSON_AddNullToObject(values, item->key);
+    }
+
+    char *buffer = cJSON_Print(values);
+    cJSON_Delete(values);
+    if (!buffer)
+        return false;
+
+    bool success = rg_storage_write_file(path, buffer, strlen(buffer) + 1, RG_FILE_ATOMIC_WRITE);
+    cJSON_free(buffer);
+
+    ns->json_mtime = success ? rg_storage_stat(path).mtime : 0;
+    return success;
+}
+
+static bool commit_namespace(namespace_t *ns)
+{
+    size_t live_size = 0, append_size = 0;
+    char pathbuf[RG_PATH_MAX];
+
+    for (size_t i = 0; i < ns->count; ++i)
+    {
+        size_t size = record_size(&ns->items[i]);
+        if (ns->items[i].type != VALUE_DELETED)
+            live_size += size;
+        if (ns->items[i].dirty)
+            append_size += size;
+    }
+
+    if (!rg_storage_mkdir(RG_BASE_PATH_CONFIG))
+        return false;
+
+    if (ns->compact || ns->log_size == 0 || ns->log_size + append_size > live_size * 2 + 512)
+    {
+        // The header records the mtime of the JSON, so it has to be exported first
+        get_path(pathbuf, ns->name, "json");
+        export_json(ns, pathbuf);
+        get_path(pathbuf, ns->name, "bin");
+        if (!write_log(ns, pathbuf, true))
+            return false;
+        ns->compact = false;
+        ns->json_stale = false;
+    }
+    else
     {
-        cJSON_DeleteItemFromObject(branch, "values");
-        root = cJSON_AddObjectToObject(branch, "values");
+        // A JSON lagging behind isn't imported as long as its mtime is unchanged
+        get_path(pathbuf, ns->name, "bin");
+        if (!write_log(ns, pathbuf, false))
+            return false;
+        ns->json_stale = true;
     }
 
-    if (set_dirty)
+    // Everything is on disk, tombstones can go now
+    size_t count = 0;
+    for (size_t i = 0; i < ns->count; ++i)
     {
-        cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 1);
+        ns->items[i].dirty = false;
+        if (ns->items[i].type != VALUE_DELETED)
+            ns->items[count++] = ns->items[i];
+        else
+            free(ns->items[i].key);
     }
+    ns->count = count;
+    ns->dirty = false;
 
-    return root;
+    return true;
 }
 
-static void update_value(const char *section, const char *key, cJSON *new_value)
+static void free_namespaces(void)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (obj == NULL)
-        cJSON_AddItemToObject(json_root(section, 1), key, new_value);
-    else if (!cJSON_Compare(obj, new_value, true))
-        cJSON_ReplaceItemInObject(json_root(section, 1), key, new_value);
-    else
-        cJSON_Delete(new_value);
+    for (size_t i = 0; i < namespaces_count; ++i)
+    {
+        for (size_t j = 0; j < namespaces[i].count; ++j)
+        {
+            free_value(&namespaces[i].items[j]);
+            free(namespaces[i].items[j].key);
+        }
+        free(namespaces[i].items);
+        free(namespaces[i].name);
+    }
+    free(namespaces);
+    namespaces = NULL;
+    namespaces_count = 0;
 }
 
 void rg_settings_init(void)
 {
-    config_root = cJSON_CreateObject();
-    json_root(NS_GLOBAL, 0);
-    json_root(NS_BOOT, 0);
+    initialized = true;
+    get_namespace(NS_GLOBAL);
+    get_namespace(NS_BOOT);
 }
 
 void rg_settings_commit(void)
 {
-    if (!config_root)
+    if (!initialized)
         return;
 
-    for (cJSON *branch = config_root->child; branch; branch = branch->next)
+    for (size_t i = 0; i < namespaces_count; ++i)
     {
-        char *name = cJSON_GetStringValue(cJSON_GetObjectItem(branch, "namespace"));
-        int changed = cJSON_GetNumberValue(cJSON_GetObjectItem(branch, "changed"));
-
-        if (!changed)
-            continue;
+        if (namespaces[i].dirty && !commit_namespace(&namespaces[i]))
+            RG_LOGE("Failed to save config namespace '%s'", namespaces[i].name);
+    }
 
-        char *buffer = cJSON_Print(cJSON_GetObjectItem(branch, "values"));
-        if (!buffer)
-            continue;
+    rg_storage_commit();
+}
 
-        size_t buffer_len = strlen(buffer) + 1;
+void rg_settings_deinit(void)
+{
+    if (!initialized)
+        return;
 
-        char pathbuf[RG_PATH_MAX];
-        snprintf(pathbuf, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, name);
-        if (rg_storage_write_file(pathbuf, buffer, buffer_len, 0) ||
-            (rg_storage_mkdir(rg_dirname(pathbuf)) && rg_storage_write_file(pathbuf, buffer, buffer_len, 0)))
+    // Bring the JSON files up to date for users, only once per run because it's the expensive part
+    for (size_t i = 0; i < namespaces_count; ++i)
+    {
+        if (namespaces[i].json_stale || namespaces[i].dirty)
         {
-            cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 0);
+            namespaces[i].compact = true;
+            namespaces[i].dirty = true;
         }
-
-        cJSON_free(buffer);
     }
 
-    rg_storage_commit();
+    rg_settings_commit();
 }
 
 void rg_settings_reset(void)
@@ -119,38 +494,36 @@ void rg_settings_reset(void)
     RG_LOGI("Clearing settings...\n");
     rg_storage_delete(RG_BASE_PATH_CONFIG);
     rg_storage_mkdir(RG_BASE_PATH_CONFIG);
-    if (config_root)
-    {
-        cJSON_Delete(config_root);
-        config_root = cJSON_CreateObject();
-    }
+    free_namespaces();
 }
 
 double rg_settings_get_number(const char *section, const char *key, double default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    return obj ? obj->valuedouble : default_value;
+    namespace_t *ns = get_namespace(section);
+    setting_t *item = (ns && key) ? find_setting(ns, key, rg_hash(key, strlen(key))) : NULL;
+    return (item && item->type == VALUE_NUMBER) ? item->number : default_value;
 }
 
 void rg_settings_set_number(const char *section, const char *key, double value)
 {
-    update_value(section, key, cJSON_CreateNumber(value));
+    set_value(get_namespace(section), key, VALUE_NUMBER, value, NULL, true);
 }
 
 char *rg_settings_get_string(const char *section, const char *key, const char *default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (cJSON_IsString(obj))
-        return strdup(obj->valuestring);
+    namespace_t *ns = get_namespace(section);
+    setting_t *item = (ns && key) ? find_setting(ns, key, rg_hash(key, strlen(key))) : NULL;
+    if (item && item->type == VALUE_STRING)
+        return strdup(item->string);
     return default_value ? strdup(default_value) : NULL;
 }
 
 void rg_settings_set_string(const char *section, const char *key, const char *value)
 {
-    update_value(section, key, value ? cJSON_CreateString(value) : cJSON_CreateNull());
+    set_value(get_namespace(section), key, value ? VALUE_STRING : VALUE_NULL, 0, value, true);
 }
 
 void rg_settings_delete(const char *section, const char *key)
 {
-    cJSON_DeleteItemFromObject(json_root(section, 1), key);
+    set_value(get_namespace(section), key, VALUE_DELETED, 0, NULL, true);
 }
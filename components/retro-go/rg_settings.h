@@ -12,6 +12,7 @@
 
 void rg_settings_init(void);
 void rg_settings_commit(void);
+void rg_settings_deinit(void);
 void rg_settings_reset(void);
 double rg_settings_get_number(const char *section, const char *key, double default_value);
 void rg_settings_set_number(const char *section, const char *key, double value);
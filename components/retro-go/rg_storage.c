@@ -423,6 +423,18 @@ bool rg_storage_read_file(const char *path, void **data_out, size_t *data_len, u
     size_t file_size;
 
     FILE *fp = fopen(path, "rb");
+    if (!fp && errno == ENOENT)
+    {
+        // An atomic write interrupted between removing the target and renaming its temp file
+        // leaves only the temp file behind, it's the newest copy we have so finish the job
+        char temp_path[RG_PATH_MAX + 8];
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+        if (rename(temp_path, path) == 0)
+        {
+            RG_LOGW("Recovered '%s' from its temp file", path);
+            fp = fopen(path, "rb");
+        }
+    }
     if (!fp)
     {
         RG_LOGE("Fopen failed (%d): '%s'", errno, path);
@@ -472,35 +484,78 @@ bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_l
     RG_ASSERT_ARG(data_ptr || !data_len);
     CHECK_PATH(path);
 
-    // TODO: If atomic is true we should write to a temp file and only replace the target on success
-    FILE *fp = fopen(path, "wb");
+    char temp_path[RG_PATH_MAX + 8];
+    const char *write_path = path;
+
+    // Atomic writes go to a temp file that replaces the target only once it's complete
+    if (flags & RG_FILE_ATOMIC_WRITE)
+    {
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+        write_path = temp_path;
+    }
+
+    FILE *fp = fopen(write_path, "wb");
     if (!fp)
     {
-        RG_LOGE("Fopen failed (%d): '%s'", errno, path);
+        RG_LOGE("Fopen failed (%d): '%s'", errno, write_path);
         return false;
     }
 
     if (data_len && !fwrite(data_ptr, data_len, 1, fp))
     {
-        RG_LOGE("Fwrite failed (%d): '%s'", errno, path);
+        RG_LOGE("Fwrite failed (%d): '%s'", errno, write_path);
         fclose(fp);
+        if (write_path != path)
+            remove(write_path);
         return false;
     }
 
-    fclose(fp);
+    if (fclose(fp) != 0)
+    {
+        RG_LOGE("Fclose failed (%d): '%s'", errno, write_path);
+        if (write_path != path)
+            remove(write_path);
+        return false;
+    }
+
+    // FAT can't rename over an existing file, there's a short window where only the temp file exists
+    if (write_path != path && rename(write_path, path) != 0)
+    {
+        if (remove(path) != 0 && errno != ENOENT)
+        {
+            // The original is still intact, the temp file is the one to drop
+            RG_LOGE("Remove failed (%d): '%s'", errno, path);
+            remove(write_path);
+            return false;
+        }
+        if (rename(write_path, path) != 0)
+        {
+            // The original is gone, the temp file is now the only copy. rg_storage_read_file will pick it up.
+            RG_LOGE("Rename failed (%d): '%s'", errno, path);
+            return false;
+        }
+    }
+
     return true;
 }
 
 /**
- * This is a minimal UNZIP implementation that utilizes only the miniz primitives found in ESP32's ROM.
- * I think that we should use miniz' ZIP API instead and bundle miniz with retro-go. But first I need
- * to do some testing to determine if the increased executable size is acceptable...
+ * This is a small UNZIP implementation that utilizes only the miniz primitives found in ESP32's ROM.
+ * Entries are located through the central directory and can be read at random offsets. Forward reads
+ * simply continue inflating, going backward resumes from the closest saved inflate state (checkpoint).
+ * Stored entries are supported everywhere, deflated ones require RG_ZIP_SUPPORT.
  */
 #if RG_ZIP_SUPPORT
 #include <rom/miniz.h>
 #endif
 
 #define ZIP_MAGIC 0x04034b50
+#define ZIP_CDIR_MAGIC 0x02014b50
+#define ZIP_EOCD_MAGIC 0x06054b50
+#define ZIP_READ_BUFFER_SIZE 0x4000
+#define ZIP_CHECKPOINT_INTERVAL 0x40000 // Initial spacing, it doubles every time we run out of slots
+#define ZIP_MAX_CHECKPOINTS 4
+
 typedef struct __attribute__((packed))
 {
     uint32_t magic;
@@ -514,121 +569,415 @@ typedef struct __attribute__((packed))
     uint32_t uncompressed_size;
     uint16_t filename_size;
     uint16_t extra_field_size;
-    uint8_t filename[226];
+    // uint8_t filename[];
     // uint8_t extra_field[];
     // uint8_t compressed_data[];
 } zip_header_t;
 
-bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+typedef struct __attribute__((packed))
 {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t version_needed;
+    uint16_t flags;
+    uint16_t compression;
+    uint16_t modified_time;
+    uint16_t modified_date;
+    uint32_t checksum;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint16_t filename_size;
+    uint16_t extra_field_size;
+    uint16_t comment_size;
+    uint16_t disk_number;
+    uint16_t internal_attr;
+    uint32_t external_attr;
+    uint32_t header_offset;
+    // uint8_t filename[];
+    // uint8_t extra_field[];
+    // uint8_t comment[];
+} zip_cdir_entry_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t disk_number;
+    uint16_t cdir_disk;
+    uint16_t disk_entries;
+    uint16_t total_entries;
+    uint32_t cdir_size;
+    uint32_t cdir_offset;
+    uint16_t comment_size;
+} zip_eocd_t;
+
 #if RG_ZIP_SUPPORT
-    RG_ASSERT_ARG(data_out && data_len);
-    CHECK_PATH(zip_path);
+typedef struct
+{
+    tinfl_decompressor decomp;
+    tinfl_status status;
+    size_t in_offset;  // Compressed bytes consumed
+    size_t out_offset; // Uncompressed bytes produced
+    size_t dict_ofs;   // Write position in window
+    uint8_t window[TINFL_LZ_DICT_SIZE];
+} zip_stream_t;
+#endif
 
-    zip_header_t header = {0};
-    int header_pos = 0;
+struct rg_unzip_s
+{
+    FILE *fp;
+    char name[256];
+    uint32_t checksum;
+    uint16_t compression;
+    size_t data_offset;
+    size_t compressed_size;
+    size_t size;
+#if RG_ZIP_SUPPORT
+    zip_stream_t *stream;
+    zip_stream_t *checkpoints[ZIP_MAX_CHECKPOINTS];
+    size_t checkpoints_count;
+    size_t checkpoints_interval;
+    uint8_t *read_buffer;
+    size_t read_buffer_offset; // Compressed offset of read_buffer[0]
+    size_t read_buffer_len;
+#endif
+};
 
-    FILE *fp = fopen(zip_path, "rb");
-    if (!fp)
+static bool zip_find_entry(FILE *fp, const char *filter, rg_unzip_t *out)
+{
+    zip_eocd_t eocd = {0};
+    uint8_t *tail = NULL;
+    long file_size;
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (file_size = ftell(fp)) < (long)sizeof(eocd))
+        return false;
+
+    // The end of central directory record is followed by a comment of up to 64KB, usually empty
+    for (size_t tail_size = 0x400;; tail_size = 0x10000 + sizeof(eocd))
     {
-        RG_LOGE("Fopen failed (%d): '%s'", errno, zip_path);
+        tail_size = RG_MIN(tail_size, (size_t)file_size);
+        if (!(tail = malloc(tail_size)) || fseek(fp, file_size - tail_size, SEEK_SET) != 0
+            || fread(tail, tail_size, 1, fp) != 1)
+            break;
+        for (long pos = tail_size - sizeof(eocd); pos >= 0 && !eocd.magic; --pos)
+        {
+            if (tail[pos] == 'P' && tail[pos + 1] == 'K' && tail[pos + 2] == 5 && tail[pos + 3] == 6)
+                memcpy(&eocd, tail + pos, sizeof(eocd));
+        }
+        free(tail), tail = NULL;
+        if (eocd.magic || tail_size == (size_t)file_size || tail_size > 0x10000)
+            break;
+    }
+    free(tail);
+
+    if (eocd.magic != ZIP_EOCD_MAGIC || fseek(fp, eocd.cdir_offset, SEEK_SET) != 0)
+    {
+        RG_LOGE("No central directory found!");
         return false;
     }
 
-    // Very inefficient, we should read a block at a time and search it for a header. But I'm lazy.
-    // Thankfully the header is usually found on the very first read :)
-    for (header_pos = 0; !feof(fp) && header_pos < 0x10000; ++header_pos)
+    for (size_t i = 0; i < eocd.total_entries; ++i)
     {
-        fseek(fp, header_pos, SEEK_SET);
-        fread(&header, sizeof(header), 1, fp);
-        if (header.magic == ZIP_MAGIC)
+        zip_cdir_entry_t entry;
+        char filename[256];
+
+        if (fread(&entry, sizeof(entry), 1, fp) != 1 || entry.magic != ZIP_CDIR_MAGIC)
+            break;
+
+        size_t name_len = RG_MIN(entry.filename_size, sizeof(filename) - 1);
+        if (fread(filename, name_len, 1, fp) != 1)
             break;
+        filename[name_len] = 0;
+        fseek(fp, entry.filename_size - name_len + entry.extra_field_size + entry.comment_size, SEEK_CUR);
+
+        if (name_len == 0 || filename[name_len - 1] == '/')
+            continue; // Directory
+        if (filter && !rg_extension_match(filename, filter))
+            continue;
+
+        if (entry.flags & 1)
+            RG_LOGE("Entry '%s' is encrypted!", filename);
+        else if (entry.compression != 0 && entry.compression != 8)
+            RG_LOGE("Entry '%s' uses unsupported compression %d!", filename, entry.compression);
+        else if (entry.compressed_size == 0xFFFFFFFF || entry.uncompressed_size == 0xFFFFFFFF)
+            RG_LOGE("Entry '%s' requires ZIP64!", filename);
+        else
+        {
+            zip_header_t header;
+            if (fseek(fp, entry.header_offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, fp) != 1
+                || header.magic != ZIP_MAGIC)
+            {
+                RG_LOGE("Invalid local header for '%s'!", filename);
+                return false;
+            }
+            // The local extra field can differ from the central directory's, we must use this one
+            out->data_offset = entry.header_offset + sizeof(header) + header.filename_size + header.extra_field_size;
+            out->compressed_size = entry.compressed_size;
+            out->size = entry.uncompressed_size;
+            out->compression = entry.compression;
+            out->checksum = entry.checksum;
+            memcpy(out->name, filename, name_len + 1);
+            return true;
+        }
     }
 
-    if (header.magic != ZIP_MAGIC)
+    RG_LOGE("No matching file found!");
+    return false;
+}
+
+rg_unzip_t *rg_storage_unzip_open(const char *zip_path, const char *filter, size_t *size)
+{
+    CHECK_PATH(zip_path);
+
+    rg_unzip_t *zip = calloc(1, sizeof(rg_unzip_t));
+    if (!zip)
+        return NULL;
+
+    if (!(zip->fp = fopen(zip_path, "rb")))
     {
-        RG_LOGE("No valid header found: '%s'", zip_path);
-        fclose(fp);
-        return false;
+        RG_LOGE("Fopen failed (%d): '%s'", errno, zip_path);
+        free(zip);
+        return NULL;
     }
 
-    // Zero terminate or truncate filename just in case
-    header.filename[RG_MIN(header.filename_size, 225)] = 0;
+    if (!zip_find_entry(zip->fp, filter, zip))
+    {
+        RG_LOGE("Unable to find a file in '%s'", zip_path);
+        rg_storage_unzip_close(zip);
+        return NULL;
+    }
 
-    RG_LOGI("Found file at %d, name: '%s', size: %d", header_pos, header.filename, (int)header.uncompressed_size);
+    RG_LOGI("Found file '%s', size: %d, method: %d", zip->name, (int)zip->size, zip->compression);
+
+    if (zip->compression == 8)
+    {
+    #if RG_ZIP_SUPPORT
+        zip->read_buffer = malloc(ZIP_READ_BUFFER_SIZE);
+        zip->stream = malloc(sizeof(zip_stream_t));
+        zip->checkpoints_interval = ZIP_CHECKPOINT_INTERVAL;
+        if (!zip->read_buffer || !zip->stream)
+        {
+            RG_LOGE("Memory allocation failed: '%s'", zip_path);
+            rg_storage_unzip_close(zip);
+            return NULL;
+        }
+        zip->stream->out_offset = SIZE_MAX; // Forces a reset on first read
+    #else
+        RG_LOGE("ZIP support hasn't been enabled!");
+        rg_storage_unzip_close(zip);
+        return NULL;
+    #endif
+    }
+
+    if (size)
+        *size = zip->size;
+
+    return zip;
+}
+
+#if RG_ZIP_SUPPORT
+static void zip_save_checkpoint(rg_unzip_t *zip)
+{
+    zip_stream_t *stream = zip->stream;
+    size_t last = zip->checkpoints_count ? zip->checkpoints[zip->checkpoints_count - 1]->out_offset : 0;
+
+    if (stream->status != TINFL_STATUS_NEEDS_MORE_INPUT && stream->status != TINFL_STATUS_HAS_MORE_OUTPUT)
+        return;
+    if (stream->out_offset < last + zip->checkpoints_interval)
+        return;
+
+    if (zip->checkpoints_count == ZIP_MAX_CHECKPOINTS)
+    {
+        // Keep every other checkpoint to stay evenly spread over the file
+        for (size_t i = 0; i < ZIP_MAX_CHECKPOINTS; ++i)
+        {
+            if (i & 1)
+                free(zip->checkpoints[i]);
+            else
+                zip->checkpoints[i / 2] = zip->checkpoints[i];
+        }
+        zip->checkpoints_count = ZIP_MAX_CHECKPOINTS / 2;
+        zip->checkpoints_interval *= 2;
+        return;
+    }
+
+    zip_stream_t *checkpoint = malloc(sizeof(zip_stream_t));
+    if (checkpoint)
+    {
+        memcpy(checkpoint, stream, sizeof(zip_stream_t));
+        zip->checkpoints[zip->checkpoints_count++] = checkpoint;
+    }
+}
+
+static size_t zip_inflate(rg_unzip_t *zip, size_t offset, uint8_t *buffer, size_t length)
+{
+    zip_stream_t *stream = zip->stream;
+    size_t done = 0;
+
+    // The window holds the last 32KB we produced, short backward seeks can be served from it
+    while (length > 0 && offset < stream->out_offset && stream->out_offset - offset <= TINFL_LZ_DICT_SIZE)
+    {
+        size_t pos = (stream->dict_ofs - (stream->out_offset - offset)) & (TINFL_LZ_DICT_SIZE - 1);
+        size_t count = RG_MIN(length, RG_MIN(TINFL_LZ_DICT_SIZE - pos, stream->out_offset - offset));
+        memcpy(buffer, stream->window + pos, count);
+        buffer += count, offset += count, length -= count, done += count;
+    }
+
+    if (length > 0 && offset < stream->out_offset)
+    {
+        zip_stream_t *best = NULL;
+        for (size_t i = 0; i < zip->checkpoints_count; ++i)
+        {
+            if (zip->checkpoints[i]->out_offset <= offset)
+                best = zip->checkpoints[i];
+        }
+        if (best)
+        {
+            memcpy(stream, best, sizeof(zip_stream_t));
+        }
+        else
+        {
+            tinfl_init(&stream->decomp);
+            stream->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+            stream->in_offset = 0;
+            stream->out_offset = 0;
+            stream->dict_ofs = 0;
+        }
+        RG_LOGD("Seeking back to %d, resuming from %d", (int)offset, (int)stream->out_offset);
+    }
+
+    while (length > 0)
+    {
+        if (stream->status != TINFL_STATUS_NEEDS_MORE_INPUT && stream->status != TINFL_STATUS_HAS_MORE_OUTPUT)
+        {
+            RG_LOGE("Inflate failed (%d) at %d", (int)stream->status, (int)stream->out_offset);
+            break;
+        }
+
+        if (stream->in_offset < zip->read_buffer_offset
+            || stream->in_offset >= zip->read_buffer_offset + zip->read_buffer_len)
+        {
+            size_t input_size = RG_MIN(ZIP_READ_BUFFER_SIZE, zip->compressed_size - stream->in_offset);
+            if (fseek(zip->fp, zip->data_offset + stream->in_offset, SEEK_SET) != 0
+                || (input_size && fread(zip->read_buffer, input_size, 1, zip->fp) != 1))
+            {
+                RG_LOGE("Read error (%d) at %d", errno, (int)stream->in_offset);
+                zip->read_buffer_len = 0;
+                break;
+            }
+            zip->read_buffer_offset = stream->in_offset;
+            zip->read_buffer_len = input_size;
+        }
+
+        size_t in_pos = stream->in_offset - zip->read_buffer_offset;
+        size_t in_bytes = zip->read_buffer_len - in_pos;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - stream->dict_ofs;
+        bool more_input = stream->in_offset + in_bytes < zip->compressed_size;
+        stream->status = tinfl_decompress(&stream->decomp, zip->read_buffer + in_pos, &in_bytes, stream->window,
+                                          stream->window + stream->dict_ofs, &out_bytes,
+                                          more_input ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+
+        // Copy whatever overlaps with the requested range
+        if (offset < stream->out_offset + out_bytes)
+        {
+            size_t skip = offset - stream->out_offset;
+            size_t count = RG_MIN(length, out_bytes - skip);
+            memcpy(buffer, stream->window + stream->dict_ofs + skip, count);
+            buffer += count, offset += count, length -= count, done += count;
+        }
+
+        stream->in_offset += in_bytes;
+        stream->out_offset += out_bytes;
+        stream->dict_ofs = (stream->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+        zip_save_checkpoint(zip);
+    }
+
+    return done;
+}
+#endif
+
+size_t rg_storage_unzip_read(rg_unzip_t *zip, size_t offset, void *buffer, size_t length)
+{
+    RG_ASSERT_ARG(zip && (buffer || !length));
+
+    if (offset >= zip->size)
+        return 0;
+
+    length = RG_MIN(length, zip->size - offset);
+
+#if RG_ZIP_SUPPORT
+    if (zip->compression == 8)
+        return zip_inflate(zip, offset, buffer, length);
+#endif
+
+    if (fseek(zip->fp, zip->data_offset + offset, SEEK_SET) != 0)
+        return 0;
+    return fread(buffer, 1, length, zip->fp);
+}
+
+void rg_storage_unzip_close(rg_unzip_t *zip)
+{
+    if (!zip)
+        return;
+#if RG_ZIP_SUPPORT
+    for (size_t i = 0; i < zip->checkpoints_count; ++i)
+        free(zip->checkpoints[i]);
+    free(zip->read_buffer);
+    free(zip->stream);
+#endif
+    if (zip->fp)
+        fclose(zip->fp);
+    free(zip);
+}
+
+bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+{
+    RG_ASSERT_ARG(data_out && data_len);
+
+    size_t uncompressed_size;
+    rg_unzip_t *zip = rg_storage_unzip_open(zip_path, filter, &uncompressed_size);
+    if (!zip)
+        return false;
+
+    #if RG_ZIP_SUPPORT
+    // A single sequential pass never seeks back, don't waste memory on checkpoints
+    zip->checkpoints_interval = SIZE_MAX / 2;
+    #endif
 
-    size_t stream_offset = header_pos + 30 + header.filename_size + header.extra_field_size;
-    size_t stream_remaining = header.compressed_size;
     size_t output_buffer_align = RG_MAX(0x1000, (flags & 0xF) * 0x2000);
     size_t output_buffer_size;
-    size_t output_buffer_pos = 0;
     uint8_t *output_buffer = NULL;
 
     if (flags & RG_FILE_USER_BUFFER)
     {
-        output_buffer_size = RG_MIN(*data_len, header.uncompressed_size);
+        output_buffer_size = RG_MIN(*data_len, uncompressed_size);
         output_buffer = *data_out;
     }
     else
     {
-        output_buffer_size = header.uncompressed_size;
+        output_buffer_size = uncompressed_size;
         output_buffer = malloc((output_buffer_size + (output_buffer_align - 1)) & ~(output_buffer_align - 1));
     }
 
-    size_t read_buffer_size = 0x8000;
-    uint8_t *read_buffer = malloc(read_buffer_size);
-    tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
-
-    if (!read_buffer || !output_buffer || !decomp)
+    if (!output_buffer)
     {
         RG_LOGE("Memory allocation failed: '%s'", zip_path);
-        goto _fail;
+        rg_storage_unzip_close(zip);
+        return false;
     }
 
-    tinfl_status status;
-    tinfl_init(decomp);
-
-    do
+    if (rg_storage_unzip_read(zip, 0, output_buffer, output_buffer_size) != output_buffer_size)
     {
-        size_t input_size = RG_MIN(read_buffer_size, stream_remaining);
-        size_t output_size = output_buffer_size - output_buffer_pos;
-        if (fseek(fp, stream_offset, SEEK_SET) != 0 || fread(read_buffer, input_size, 1, fp) != 1)
-        {
-            RG_LOGE("Read error (%d): '%s'", errno, zip_path);
-            goto _fail;
-        }
-        stream_offset += input_size;
-        stream_remaining -= input_size;
-        status = tinfl_decompress(
-            decomp, read_buffer, &input_size, output_buffer, output_buffer + output_buffer_pos, &output_size,
-            TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (stream_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
-        output_buffer_pos += output_size;
-    } while (status == TINFL_STATUS_NEEDS_MORE_INPUT);
-
-    // With user-provided buffer we might not reach TINFL_STATUS_DONE, but it doesn't mean we've failed
-    if (status < TINFL_STATUS_DONE || output_buffer_pos != output_buffer_size) // (status != TINFL_STATUS_DONE)
-    {
-        RG_LOGE("Decompression failed (%d): %s", (int)status, zip_path);
-        goto _fail;
+        RG_LOGE("Decompression failed: '%s'", zip_path);
+        if (!(flags & RG_FILE_USER_BUFFER))
+            free(output_buffer);
+        rg_storage_unzip_close(zip);
+        return false;
     }
 
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
+    rg_storage_unzip_close(zip);
 
     *data_out = output_buffer;
     *data_len = output_buffer_size;
     return true;
-
-_fail:
-    if (!(flags & RG_FILE_USER_BUFFER))
-        free(output_buffer);
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
-    return false;
-#else
-    RG_LOGE("ZIP support hasn't been enabled!");
-    return false;
-#endif
 }
@@ -78,3 +78,9 @@ enum
 bool rg_storage_read_file(const char *path, void **data_out, size_t *data_len, uint32_t flags);
 bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_len, uint32_t flags);
 bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags);
+
+// Streaming access to a single ZIP entry. filter is a list of extensions, NULL matches the first file.
+typedef struct rg_unzip_s rg_unzip_t;
+rg_unzip_t *rg_storage_unzip_open(const char *zip_path, const char *filter, size_t *size);
+size_t rg_storage_unzip_read(rg_unzip_t *zip, size_t offset, void *buffer, size_t length);
+void rg_storage_unzip_close(rg_unzip_t *zip);
@@ -38,6 +38,9 @@ static bool create_window(const rg_surface_t *parent, const rg_rect_t *rect, rg_
     out->height = RG_MIN(rect->height, out->height - rect->top);
     out->free_data = false;
     out->free_palette = false;
+    out->free_damage = false;
+    if (out->damage)
+        out->damage += rect->top;
     return true;
 }
 
@@ -73,9 +76,35 @@ void rg_surface_free(rg_surface_t *surface)
         free(surface->data);
     if (surface->free_palette)
         free(surface->palette);
+    if (surface->free_damage)
+        free(surface->damage);
     free(surface);
 }
 
+bool rg_surface_track_damage(rg_surface_t *surface, bool enable)
+{
+    CHECK_SURFACE(surface, false);
+
+    if (surface->free_damage)
+        free(surface->damage);
+    surface->damage = NULL;
+    surface->free_damage = false;
+
+    if (!enable)
+        return true;
+
+    // Everything starts dirty, the producer then only flags lines that differ from the previous frame
+    // and the display clears them as they are consumed.
+    if (!(surface->damage = malloc(surface->height)))
+    {
+        RG_LOGE("Damage map allocation failed!");
+        return false;
+    }
+    memset(surface->damage, 1, surface->height);
+    surface->free_damage = true;
+    return true;
+}
+
 bool rg_surface_copy(const rg_surface_t *source, const rg_rect_t *source_rect, rg_surface_t *dest,
                      const rg_rect_t *dest_rect, bool scale)
 {
@@ -259,21 +288,381 @@ rg_surface_t *rg_surface_load_image(const uint8_t *data, size_t data_len, uint32
     return NULL;
 }
 
-rg_surface_t *rg_surface_load_image_file(const char *filename, uint32_t flags)
+#if RG_ZIP_SUPPORT
+#include <rom/miniz.h>
+
+#define PNG_INPUT_SIZE 0x800
+#define PNG_RGB565(r, g, b) ((((r) << 8) & 0xF800) | (((g) << 3) & 0x7E0) | (((b) >> 3) & 0x1F))
+
+static inline uint32_t png_read_u32(const uint8_t *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Skips chunks until the next IDAT, collecting the palette along the way. Returns false at IEND/EOF.
+static bool png_next_idat(FILE *fp, uint32_t *chunk_len, uint16_t *palette)
+{
+    uint8_t chunk[8];
+    while (fread(chunk, 8, 1, fp) == 1)
+    {
+        uint32_t length = png_read_u32(chunk);
+        if (memcmp(chunk + 4, "IDAT", 4) == 0)
+        {
+            *chunk_len = length;
+            return true;
+        }
+        else if (memcmp(chunk + 4, "IEND", 4) == 0)
+        {
+            break;
+        }
+        else if (memcmp(chunk + 4, "PLTE", 4) == 0 && length <= 768)
+        {
+            uint8_t rgb[768];
+            if (fread(rgb, length, 1, fp) != 1)
+                break;
+            for (size_t i = 0; i < length / 3; ++i)
+                palette[i] = PNG_RGB565(rgb[i * 3 + 0], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+            length = 0;
+        }
+        if (fseek(fp, length + 4, SEEK_CUR) != 0)
+            break;
+    }
+    return false;
+}
+
+static void png_unfilter(uint8_t *cur, const uint8_t *prev, size_t size, size_t bpp, int filter)
+{
+    if (filter == 1) // Sub
+    {
+        for (size_t i = bpp; i < size; ++i)
+            cur[i] += cur[i - bpp];
+    }
+    else if (filter == 2) // Up
+    {
+        for (size_t i = 0; i < size; ++i)
+            cur[i] += prev[i];
+    }
+    else if (filter == 3) // Average
+    {
+        for (size_t i = 0; i < bpp; ++i)
+            cur[i] += prev[i] >> 1;
+        for (size_t i = bpp; i < size; ++i)
+            cur[i] += (cur[i - bpp] + prev[i]) >> 1;
+    }
+    else if (filter == 4) // Paeth
+    {
+        for (size_t i = 0; i < bpp; ++i)
+            cur[i] += prev[i];
+        for (size_t i = bpp; i < size; ++i)
+        {
+            int a = cur[i - bpp], b = prev[i], c = prev[i - bpp];
+            int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+            cur[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+        }
+    }
+}
+
+// Decodes a PNG one scanline at a time straight into a RGB565 surface, scaling it on the fly if needed.
+// Peak memory is the inflate state and window plus two rows, instead of the inflated data and a 24bit
+// copy of the whole image with lodepng. Interlaced and 16bit images set unsupported so the caller can
+// fall back to lodepng.
+static rg_surface_t *load_png_stream(FILE *fp, int new_width, int new_height, bool *unsupported)
+{
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t header[8 + 25]; // Signature + IHDR chunk
+
+    *unsupported = true;
+
+    if (fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, signature, 8) || memcmp(header + 12, "IHDR", 4))
+        return NULL;
+
+    int width = png_read_u32(header + 16), height = png_read_u32(header + 20);
+    int depth = header[24], color = header[25], interlace = header[28];
+    int channels = (color == 2) ? 3 : (color == 4) ? 2 : (color == 6) ? 4 : 1;
+
+    if (width < 1 || width > 4096 || height < 1 || height > 4096 || interlace || depth > 8
+        || (depth < 8 && color != 0 && color != 3) || (color != 0 && color != 2 && color != 3 && color != 4 && color != 6))
+        return NULL;
+
+    *unsupported = false;
+
+    if (new_width <= 0 && new_height <= 0)
+        new_width = width, new_height = height;
+    else if (new_width <= 0)
+        new_width = width * ((float)new_height / height);
+    else if (new_height <= 0)
+        new_height = height * ((float)new_width / width);
+
+    size_t row_size = (width * channels * depth + 7) / 8;
+    size_t bpp = RG_MAX(1, channels * depth / 8);
+    float step_x = (float)width / new_width;
+    float step_y = (float)height / new_height;
+
+    rg_surface_t *dest = rg_surface_create(new_width, new_height, RG_PIXEL_565_LE, 0);
+    tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
+    uint8_t *window = malloc(TINFL_LZ_DICT_SIZE);
+    uint8_t *work = calloc(1, row_size * 2 + PNG_INPUT_SIZE + new_width * sizeof(short));
+    uint16_t palette[256] = {0};
+
+    if (!dest || !decomp || !window || !work)
+    {
+        RG_LOGE("Out of memory!");
+        goto _fail;
+    }
+
+    uint8_t *prev = work, *cur = work + row_size;
+    uint8_t *input = work + row_size * 2;
+    short *src_x_map = (short *)(input + PNG_INPUT_SIZE);
+
+    for (int x = 0; x < new_width; ++x)
+        src_x_map[x] = x * step_x;
+
+    // Grayscale is handled like a palette of levels, it saves us a few branches below
+    for (int i = 0, max = (1 << depth) - 1; color == 0 && i <= max; ++i)
+        palette[i] = PNG_RGB565(i * 255 / max, i * 255 / max, i * 255 / max);
+
+    size_t in_len = 0, in_pos = 0, row_pos = 0, dict_ofs = 0;
+    uint32_t chunk_left = 0;
+    bool more_input = true, in_idat = false;
+    int filter = -1, y = 0, dest_y = 0;
+    tinfl_status status;
+
+    tinfl_init(decomp);
+
+    while (y < height)
+    {
+        if (in_pos == in_len)
+        {
+            while (more_input && chunk_left == 0)
+            {
+                if (in_idat)
+                    fseek(fp, 4, SEEK_CUR); // Skip the CRC of the previous IDAT
+                more_input = png_next_idat(fp, &chunk_left, palette);
+                in_idat = true;
+            }
+            in_len = more_input ? fread(input, 1, RG_MIN(chunk_left, PNG_INPUT_SIZE), fp) : 0;
+            chunk_left -= in_len;
+            in_pos = 0;
+            if (more_input && in_len == 0)
+                goto _fail;
+        }
+
+        size_t in_bytes = in_len - in_pos;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - dict_ofs;
+        status = tinfl_decompress(decomp, input + in_pos, &in_bytes, window, window + dict_ofs, &out_bytes,
+                                  TINFL_FLAG_PARSE_ZLIB_HEADER | (more_input ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+        in_pos += in_bytes;
+
+        for (const uint8_t *out = window + dict_ofs, *end = out + out_bytes; out < end && y < height;)
+        {
+            if (filter < 0)
+            {
+                filter = *out++;
+                continue;
+            }
+            size_t count = RG_MIN(end - out, row_size - row_pos);
+            memcpy(cur + row_pos, out, count);
+            row_pos += count;
+            out += count;
+            if (row_pos < row_size)
+                continue;
+            if (filter > 4)
+                goto _fail;
+
+            png_unfilter(cur, prev, row_size, bpp, filter);
+
+            for (; dest_y < new_height && (int)(dest_y * step_y) <= y; ++dest_y)
+            {
+                uint16_t *dst = dest->data + dest_y * dest->stride;
+                if (color == 0 || color == 3)
+                {
+                    for (int x = 0, mask = (1 << depth) - 1; x < new_width; ++x)
+                    {
+                        int bit = src_x_map[x] * depth;
+                        dst[x] = palette[(cur[bit >> 3] >> (8 - depth - (bit & 7))) & mask];
+                    }
+                }
+                else if (color == 4)
+                {
+                    for (int x = 0; x < new_width; ++x)
+                    {
+                        int gray = cur[src_x_map[x] * 2];
+                        dst[x] = PNG_RGB565(gray, gray, gray);
+                    }
+                }
+                else
+                {
+                    for (int x = 0; x < new_width; ++x)
+                    {
+                        const uint8_t *pix = &cur[src_x_map[x] * channels];
+                        dst[x] = PNG_RGB565(pix[0], pix[1], pix[2]);
+                    }
+                }
+            }
+
+            uint8_t *temp = prev;
+            prev = cur, cur = temp;
+            row_pos = 0;
+            filter = -1;
+            y++;
+        }
+        dict_ofs = (dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_DONE && y < height))
+            goto _fail;
+    }
+
+    free(decomp);
+    free(window);
+    free(work);
+    return dest;
+
+_fail:
+    RG_LOGE("PNG decoding failed at line %d!", y);
+    rg_surface_free(dest);
+    free(decomp);
+    free(window);
+    free(work);
+    return NULL;
+}
+#endif
+
+rg_surface_t *rg_surface_load_image_file_scaled(const char *filename, int width, int height, uint32_t flags)
 {
     RG_ASSERT_ARG(filename);
 
+    rg_surface_t *img = NULL;
     size_t data_len;
     void *data;
 
+#if RG_ZIP_SUPPORT
+    FILE *fp = fopen(filename, "rb");
+    if (fp)
+    {
+        bool unsupported = false;
+        img = load_png_stream(fp, width, height, &unsupported);
+        fclose(fp);
+        if (img || !unsupported)
+            return img;
+    }
+#endif
+
     if (rg_storage_read_file(filename, &data, &data_len, 0))
     {
-        rg_surface_t *img = rg_surface_load_image(data, data_len, flags);
+        img = rg_surface_load_image(data, data_len, flags);
         free(data);
-        return img;
     }
 
-    return NULL;
+    if (img && (width > 0 || height > 0) && (width != img->width || height != img->height))
+    {
+        rg_surface_t *resized = rg_surface_resize(img, width, height);
+        if (resized)
+        {
+            rg_surface_free(img);
+            img = resized;
+        }
+    }
+
+    return img;
+}
+
+rg_surface_t *rg_surface_load_image_file(const char *filename, uint32_t flags)
+{
+    return rg_surface_load_image_file_scaled(filename, 0, 0, flags);
+}
+
+#define IMAGE_CACHE_PATH RG_BASE_PATH_CACHE "/images"
+#define IMAGE_CACHE_MAGIC 0x35363552 // "R565"
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t source_size;
+    uint32_t source_mtime;
+    uint16_t width;
+    uint16_t height;
+} image_cache_header_t;
+
+rg_surface_t *rg_surface_load_image_cached(const char *filename, int max_width, int max_height)
+{
+    RG_ASSERT_ARG(filename);
+
+    rg_stat_t info = rg_storage_stat(filename);
+    if (!info.exists)
+        return NULL;
+
+    // The cache is keyed by source path and target box, the header then tells us if it's stale
+    char cache_path[RG_PATH_MAX + 1];
+    snprintf(cache_path, RG_PATH_MAX, "%s@%dx%d", filename, max_width, max_height);
+    uint32_t key = rg_hash(cache_path, strlen(cache_path));
+    snprintf(cache_path, RG_PATH_MAX, "%s/%X/%08X.565", IMAGE_CACHE_PATH, (int)(key >> 28), (int)key);
+
+    image_cache_header_t header = {0};
+    rg_surface_t *img = NULL;
+    FILE *fp;
+
+    if ((fp = fopen(cache_path, "rb")))
+    {
+        if (fread(&header, sizeof(header), 1, fp) && header.magic == IMAGE_CACHE_MAGIC
+            && header.source_size == (uint32_t)info.size && header.source_mtime == (uint32_t)info.mtime
+            && (img = rg_surface_create(header.width, header.height, RG_PIXEL_565_LE, 0)))
+        {
+            // The pixels are stored exactly as rg_image_t expects them, no conversion needed
+            if (!fread(img->data, header.height * img->stride, 1, fp))
+                rg_surface_free(img), img = NULL;
+        }
+        fclose(fp);
+        if (img)
+            return img;
+    }
+
+    if (!(img = rg_surface_load_image_file(filename, 0)))
+        return NULL;
+
+    // Fit in the box while preserving the aspect ratio, images are never upscaled
+    int width = img->width, height = img->height;
+    if (max_width > 0 && width > max_width)
+        height = height * max_width / width, width = max_width;
+    if (max_height > 0 && height > max_height)
+        width = width * max_height / height, height = max_height;
+
+    if (width != img->width || height != img->height)
+    {
+        rg_surface_t *resized = rg_surface_resize(img, RG_MAX(width, 1), RG_MAX(height, 1));
+        if (resized)
+        {
+            rg_surface_free(img);
+            img = resized;
+        }
+    }
+
+    header = (image_cache_header_t){
+        .magic = IMAGE_CACHE_MAGIC,
+        .source_size = info.size,
+        .source_mtime = info.mtime,
+        .width = img->width,
+        .height = img->height,
+    };
+
+    if (!(fp = fopen(cache_path, "wb")))
+    {
+        *strrchr(cache_path, '/') = 0;
+        rg_storage_mkdir(cache_path);
+        *strchr(cache_path, 0) = '/';
+        fp = fopen(cache_path, "wb");
+    }
+
+    if (fp)
+    {
+        bool success = fwrite(&header, sizeof(header), 1, fp) && fwrite(img->data, img->height * img->stride, 1, fp);
+        fclose(fp);
+        if (!success)
+        {
+            RG_LOGW("Failed to write image cache '%s'", cache_path);
+            remove(cache_path);
+        }
+    }
+
+    return img;
 }
 
 bool rg_surface_save_image_file(const rg_surface_t *source, const char *filename, int width, int height)
@@ -39,6 +39,8 @@ typedef struct
     void *data;
     bool free_data;
     bool free_palette;
+    uint8_t *damage; // One byte per line, non-zero if the line changed since last displayed (NULL = not tracked)
+    bool free_damage;
 } rg_surface_t;
 
 // rg_image_t always contains a RG_PIXEL_565_LE surface
@@ -50,7 +52,13 @@ typedef rg_surface_t rg_image_t;
 rg_surface_t *rg_surface_create(int width, int height, int format, uint32_t alloc_flags);
 rg_surface_t *rg_surface_load_image(const uint8_t *data, size_t data_len, uint32_t flags);
 rg_surface_t *rg_surface_load_image_file(const char *filename, uint32_t flags);
+// Scales while decoding when possible, width or height <= 0 keeps the aspect ratio
+rg_surface_t *rg_surface_load_image_file_scaled(const char *filename, int width, int height, uint32_t flags);
+// Same as rg_surface_load_image_file but fits the image in max_width x max_height and keeps a raw RGB565
+// copy in the cache folder, so that subsequent loads skip decoding and scaling entirely.
+rg_surface_t *rg_surface_load_image_cached(const char *filename, int max_width, int max_height);
 void rg_surface_free(rg_surface_t *surface);
+bool rg_surface_track_damage(rg_surface_t *surface, bool enable);
 bool rg_surface_copy(const rg_surface_t *source, const rg_rect_t *source_rect, rg_surface_t *dest,
                      const rg_rect_t *dest_rect, bool scale);
 bool rg_surface_fill(rg_surface_t *dest, const rg_rect_t *rect, rg_color_t color);
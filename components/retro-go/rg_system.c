@@ -26,6 +26,18 @@
 
 #define RG_STRUCT_MAGIC 0x12345678
 #define RG_LOGBUF_SIZE 2048
+
+#ifndef RG_REWIND_BUFFER_SIZE
+#define RG_REWIND_BUFFER_SIZE (512 * 1024)
+#endif
+#ifndef RG_REWIND_INTERVAL
+#define RG_REWIND_INTERVAL 4 // Frames between snapshots
+#endif
+#define RG_REWIND_MAX_ENTRIES 512
+#define RG_RUNAHEAD_MAX_FRAMES 3
+#define RG_TIMERS_HISTORY 128 // Frames
+#define RG_TIMERS_MAX_DEPTH 8
+
 typedef struct
 {
     uint32_t magicWord;
@@ -59,6 +71,65 @@ struct rg_task_s
     char name[16];
 };
 
+typedef struct
+{
+    uint32_t offset;     // Position of the compressed delta in the arena
+    uint32_t size;       // Compressed size
+    uint32_t state_size; // Size of the snapshot the delta leads back to
+} rewind_entry_t;
+
+// Snapshots are stored as the XOR of each state against the one that follows it, which is
+// mostly zeroes and compresses very well with a trivial RLE. Only the newest state is kept
+// whole, in `current`, and stepping back means applying the newest delta to it.
+static struct
+{
+    uint8_t *current;      // Newest full snapshot
+    uint8_t *scratch;      // Capture buffer, swapped with current after each capture
+    uint8_t *temp;         // Compressor output, worst case sized
+    size_t capacity;       // Size of current/scratch
+    size_t current_size;   // 0 if we have no snapshot yet
+    uint8_t *arena;        // Circular storage for compressed deltas
+    size_t write_pos;
+    rewind_entry_t entries[RG_REWIND_MAX_ENTRIES];
+    size_t first, count;
+    int counter;
+    bool enabled;
+} rewinder;
+
+static struct
+{
+    uint8_t *buffer;
+    size_t capacity;
+    size_t size;
+    int frames;
+} runahead;
+
+#if RG_ENABLE_TIMERS
+static struct
+{
+    int32_t current[RG_TIMER_COUNT];
+    uint16_t history[RG_TIMERS_HISTORY][RG_TIMER_COUNT];
+    uint32_t frames;
+    uint8_t stack[RG_TIMERS_MAX_DEPTH];
+    int depth;
+    int64_t start;
+} timers;
+#endif
+
+#ifdef RG_BENCHMARK
+static struct
+{
+    const char *core;
+    int frames;
+    int64_t start_time;
+    int32_t *busy_times;
+    uint32_t video_hash;
+    uint32_t audio_hash;
+    int video_frames;
+    int64_t audio_samples;
+} bench;
+#endif
+
 #ifdef RG_ENABLE_PROFILING
 typedef struct
 {
@@ -86,11 +157,19 @@ static rg_stats_t statistics;
 static rg_app_t app;
 static rg_task_t tasks[8];
 
+static void rewind_capture(void);
+#ifdef RG_BENCHMARK
+static void bench_init(void);
+static void bench_tick(int busyTime);
+#endif
+
 static const char *SETTING_BOOT_NAME = "BootName";
 static const char *SETTING_BOOT_ARGS = "BootArgs";
 static const char *SETTING_BOOT_FLAGS = "BootFlags";
 static const char *SETTING_TIMEZONE = "Timezone";
 static const char *SETTING_INDICATOR_MASK = "Indicators";
+static const char *SETTING_REWIND = "Rewind";
+static const char *SETTING_RUNAHEAD = "RunAhead";
 
 #define logbuf_putc(buf, c) (buf)->console[(buf)->cursor++] = c, (buf)->cursor %= RG_LOGBUF_SIZE;
 #define logbuf_puts(buf, str) for (const char *ptr = str; *ptr; ptr++) logbuf_putc(buf, *ptr);
@@ -136,6 +215,36 @@ static void update_memory_statistics(void)
 #endif
 }
 
+#if RG_ENABLE_TIMERS
+static int compare_u16(const void *a, const void *b)
+{
+    return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+static void update_timers_statistics(void)
+{
+    size_t count = RG_MIN(timers.frames, RG_TIMERS_HISTORY);
+    uint16_t samples[RG_TIMERS_HISTORY];
+
+    if (count == 0)
+        return;
+
+    for (size_t id = 0; id < RG_TIMER_COUNT; ++id)
+    {
+        int total = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            samples[i] = timers.history[i][id];
+            total += samples[i];
+        }
+        qsort(samples, count, sizeof(uint16_t), compare_u16);
+        statistics.timers[id].avg = total / count;
+        statistics.timers[id].p95 = samples[(count * 95) / 100];
+        statistics.timers[id].max = samples[count - 1];
+    }
+}
+#endif
+
 static void update_statistics(void)
 {
     static counters_t counters = {0};
@@ -178,6 +287,9 @@ static void update_statistics(void)
     statistics.uptime = rg_system_timer() / 1000000;
 
     update_memory_statistics();
+#if RG_ENABLE_TIMERS
+    update_timers_statistics();
+#endif
 }
 
 static void update_indicators(void)
@@ -229,6 +341,7 @@ static void system_monitor_task(void *arg)
             (int)roundf(statistics.fullFPS),
             (int)roundf((battery.volts * 1000) ?: battery.level));
 
+#ifndef RG_BENCHMARK // Skipped frames depend on the host's speed and would change the frame hashes
         // Auto frameskip
         if (statistics.ticks > app.tickRate * 2)
         {
@@ -246,6 +359,7 @@ static void system_monitor_task(void *arg)
                 RG_LOGI("Raised frameskip to %d", app.frameskip);
             }
         }
+#endif
 
         if (statistics.lastTick < rg_system_timer() - app.tickTimeout)
         {
@@ -317,8 +431,13 @@ static void platform_init(void)
         gpio_set_level(RG_GPIO_LED, 0);
     #endif
 #elif defined(RG_TARGET_SDL2)
+#ifdef RG_BENCHMARK
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    freopen("stderr.txt", "w", stderr); // Keep stdout for the report
+#else
     freopen("stdout.txt", "w", stdout);
     freopen("stderr.txt", "w", stderr);
+#endif
     SDL_SetMainReady();
     if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) < 0)
         RG_PANIC("SDL Init failed!");
@@ -436,6 +555,9 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
     app.romPath = app.bootArgs;
     app.isLauncher = strcmp(app.name, RG_APP_LAUNCHER) == 0; // Might be overriden after init
     app.indicatorsMask = rg_settings_get_number(NS_GLOBAL, SETTING_INDICATOR_MASK, app.indicatorsMask);
+#ifdef RG_BENCHMARK
+    bench_init();
+#endif
 
     rg_display_init();
     rg_gui_init();
@@ -448,6 +570,10 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg
     // Do these last to not interfere with panic handling above
     if (handlers)
         app.handlers = *handlers;
+    rewinder.enabled = rg_settings_get_number(NS_APP, SETTING_REWIND, 0)
+        && app.handlers.saveStateMem && app.handlers.loadStateMem;
+    if (app.handlers.saveSnapshot && app.handlers.loadSnapshot)
+        runahead.frames = RG_MIN(rg_settings_get_number(NS_APP, SETTING_RUNAHEAD, 0), RG_RUNAHEAD_MAX_FRAMES);
 
 #ifdef RG_ENABLE_PROFILING
     RG_LOGI("Profiling has been enabled at compile time!\n");
@@ -592,6 +718,7 @@ bool rg_task_peek(rg_task_msg_t *out)
     while (task->msgWaiting < 1)
         continue;
     *out = task->msg;
+    success = true;
 #endif
     // task->blocked = false;
     return success;
@@ -611,6 +738,7 @@ bool rg_task_receive(rg_task_msg_t *out)
         continue;
     *out = task->msg;
     task->msgWaiting = 0;
+    success = true;
 #endif
     // task->blocked = false;
     return success;
@@ -690,6 +818,51 @@ bool rg_mutex_take(rg_mutex_t *mutex, int timeoutMS)
 #endif
 }
 
+rg_semaphore_t *rg_semaphore_create(void)
+{
+#if defined(ESP_PLATFORM)
+    return (rg_semaphore_t *)xSemaphoreCreateBinary();
+#elif defined(RG_TARGET_SDL2)
+    return (rg_semaphore_t *)SDL_CreateSemaphore(0);
+#endif
+}
+
+void rg_semaphore_free(rg_semaphore_t *sem)
+{
+    if (!sem) return;
+#if defined(ESP_PLATFORM)
+    vSemaphoreDelete((QueueHandle_t)sem);
+#elif defined(RG_TARGET_SDL2)
+    SDL_DestroySemaphore((SDL_sem *)sem);
+#endif
+}
+
+bool rg_semaphore_give(rg_semaphore_t *sem)
+{
+    RG_ASSERT_ARG(sem);
+#if defined(ESP_PLATFORM)
+    xSemaphoreGive((QueueHandle_t)sem); // Fails if it's already given, which is fine
+    return true;
+#elif defined(RG_TARGET_SDL2)
+    if (SDL_SemValue((SDL_sem *)sem) > 0)
+        return true;
+    return SDL_SemPost((SDL_sem *)sem) == 0;
+#endif
+}
+
+bool rg_semaphore_take(rg_semaphore_t *sem, int timeoutMS)
+{
+    RG_ASSERT_ARG(sem);
+#if defined(ESP_PLATFORM)
+    int timeout = timeoutMS >= 0 ? pdMS_TO_TICKS(timeoutMS) : portMAX_DELAY;
+    return xSemaphoreTake((QueueHandle_t)sem, timeout) == pdPASS;
+#elif defined(RG_TARGET_SDL2)
+    if (timeoutMS < 0)
+        return SDL_SemWait((SDL_sem *)sem) == 0;
+    return SDL_SemWaitTimeout((SDL_sem *)sem, timeoutMS) == 0;
+#endif
+}
+
 void rg_system_load_time(void)
 {
     time_t time_sec = RG_MAX(rtcValue, RG_BUILD_TIME);
@@ -759,9 +932,59 @@ void rg_system_tick(int busyTime)
     statistics.lastTick = rg_system_timer();
     statistics.busyTime += busyTime;
     statistics.ticks++;
+    if (rewinder.enabled && ++rewinder.counter >= RG_REWIND_INTERVAL)
+        rewind_capture();
+#ifdef RG_BENCHMARK
+    bench_tick(busyTime);
+#endif
+#if RG_ENABLE_TIMERS
+    uint16_t *history = timers.history[timers.frames++ % RG_TIMERS_HISTORY];
+    for (size_t id = 0; id < RG_TIMER_COUNT; ++id)
+        history[id] = RG_MIN(__atomic_exchange_n(&timers.current[id], 0, __ATOMIC_RELAXED), UINT16_MAX);
+#endif
     // WDT_RELOAD(WDT_TIMEOUT);
 }
 
+#if RG_ENABLE_TIMERS
+IRAM_ATTR void rg_system_timer_begin(rg_timer_id_t id)
+{
+    int64_t now = rg_system_timer();
+    if (timers.depth > 0 && timers.depth <= RG_TIMERS_MAX_DEPTH)
+        __atomic_fetch_add(&timers.current[timers.stack[timers.depth - 1]], now - timers.start, __ATOMIC_RELAXED);
+    if (timers.depth < RG_TIMERS_MAX_DEPTH)
+        timers.stack[timers.depth] = id;
+    timers.depth++;
+    timers.start = now;
+}
+
+IRAM_ATTR void rg_system_timer_end(rg_timer_id_t id)
+{
+    int64_t now = rg_system_timer();
+    if (timers.depth <= 0)
+        return;
+    if (--timers.depth < RG_TIMERS_MAX_DEPTH)
+    {
+        RG_ASSERT(timers.stack[timers.depth] == id, "Mismatched RG_TIMER_END");
+        __atomic_fetch_add(&timers.current[id], now - timers.start, __ATOMIC_RELAXED);
+    }
+    timers.start = now;
+}
+
+IRAM_ATTR void rg_system_timer_add(rg_timer_id_t id, int elapsed)
+{
+    // The display and input tasks report here too, it must not race with the reset in rg_system_tick
+    __atomic_fetch_add(&timers.current[id], elapsed, __ATOMIC_RELAXED);
+#if defined(ESP_PLATFORM)
+    bool main_task = tasks[0].handle == xTaskGetCurrentTaskHandle();
+#else
+    bool main_task = tasks[0].handle == SDL_ThreadID();
+#endif
+    // Work done on the emulation task is excluded from the enclosing timer (eg audio submitted from CPU)
+    if (main_task && timers.depth > 0)
+        timers.start += elapsed;
+}
+#endif
+
 IRAM_ATTR int64_t rg_system_timer(void)
 {
 #if defined(ESP_PLATFORM)
@@ -786,6 +1009,7 @@ static void shutdown_cleanup(void)
     rg_system_event(RG_EVENT_SHUTDOWN, NULL); // Allow apps to save their state if they want
     rg_audio_deinit();                        // Disable sound ASAP to avoid audio garbage
     rg_system_save_time();                    // RTC might save to storage, do it before
+    rg_settings_deinit();                     // Export the settings that were only appended
     rg_storage_deinit();                      // Unmount storage
     rg_input_wait_for_key(RG_KEY_ALL, 0, -1); // Wait for all keys to be released (boot is sensitive to GPIO0,32,33)
     rg_input_deinit();                        // Now we can shutdown input
@@ -844,7 +1068,7 @@ void rg_system_switch_app(const char *partition, const char *name, const char *a
         rg_settings_set_string(NS_BOOT, SETTING_BOOT_NAME, name);
         rg_settings_set_string(NS_BOOT, SETTING_BOOT_ARGS, args);
         rg_settings_set_number(NS_BOOT, SETTING_BOOT_FLAGS, flags);
-        rg_settings_commit();
+        rg_settings_deinit();
     }
 #if defined(ESP_PLATFORM)
     esp_err_t err = esp_ota_set_boot_partition(esp_partition_find_first(
@@ -985,6 +1209,38 @@ bool rg_system_save_trace(const char *filename, bool panic_trace)
     return true;
 }
 
+bool rg_system_save_timers(const char *filename)
+{
+#if RG_ENABLE_TIMERS
+    if (!filename)
+        filename = RG_STORAGE_ROOT "/timers.csv";
+
+    RG_LOGI("Saving timers to '%s'...\n", filename);
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        RG_LOGE("Open file '%s' failed, can't save timers!", filename);
+        return false;
+    }
+
+    // Oldest frame first, all values in microseconds
+    uint32_t count = RG_MIN(timers.frames, RG_TIMERS_HISTORY);
+    fputs("frame,cpu,present,audio,blit,audio_out,input\n", fp);
+    for (uint32_t frame = timers.frames - count; frame < timers.frames; ++frame)
+    {
+        const uint16_t *row = timers.history[frame % RG_TIMERS_HISTORY];
+        fprintf(fp, "%u,%u,%u,%u,%u,%u,%u\n", (unsigned)frame, row[RG_TIMER_CPU], row[RG_TIMER_PRESENT],
+                row[RG_TIMER_AUDIO], row[RG_TIMER_BLIT], row[RG_TIMER_AUDIO_OUT], row[RG_TIMER_INPUT]);
+    }
+    fclose(fp);
+
+    return true;
+#else
+    RG_LOGW("Timers are disabled in this build.\n");
+    return false;
+#endif
+}
+
 void rg_system_set_indicator(rg_indicator_t indicator, bool on)
 {
     indicators &= ~(1 << indicator);
@@ -1374,6 +1630,338 @@ float rg_emu_get_speed(void)
     return app.speed;
 }
 
+// Delta format: repeated [u16 zero count][u16 literal count][literals], literals are a^b
+static size_t rewind_encode(const uint8_t *a, const uint8_t *b, size_t len, uint8_t *out)
+{
+    size_t i = 0, o = 0;
+    while (i < len)
+    {
+        size_t zeros = 0;
+        for (;;)
+        {
+            // Both buffers come from rg_alloc so they share alignment
+            if ((i & 3) == 0 && i + 4 <= len && zeros + 4 <= 0xFFFF
+                && *(const uint32_t *)(a + i) == *(const uint32_t *)(b + i))
+                i += 4, zeros += 4;
+            else if (i < len && zeros < 0xFFFF && a[i] == b[i])
+                i += 1, zeros += 1;
+            else
+                break;
+        }
+
+        // Literals run until we find 4 identical bytes in a row
+        size_t start = i, same = 0;
+        while (i < len && i - start < 0xFFFF)
+        {
+            if (a[i] == b[i] && ++same == 4)
+            {
+                i -= 3;
+                break;
+            }
+            else if (a[i] != b[i])
+                same = 0;
+            i++;
+        }
+
+        size_t literals = i - start;
+        out[o++] = zeros & 0xFF;
+        out[o++] = zeros >> 8;
+        out[o++] = literals & 0xFF;
+        out[o++] = literals >> 8;
+        for (size_t j = start; j < i; j++)
+            out[o++] = a[j] ^ b[j];
+    }
+    return o;
+}
+
+static void rewind_decode(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    const uint8_t *end = src + size;
+    while (src < end)
+    {
+        size_t zeros = src[0] | (src[1] << 8);
+        size_t literals = src[2] | (src[3] << 8);
+        src += 4;
+        dst += zeros;
+        while (literals--)
+            *dst++ ^= *src++;
+    }
+}
+
+static void rewind_reset(size_t capacity)
+{
+    free(rewinder.current);
+    free(rewinder.scratch);
+    free(rewinder.temp);
+    free(rewinder.arena);
+    bool enabled = rewinder.enabled;
+    memset(&rewinder, 0, sizeof(rewinder));
+    rewinder.enabled = enabled;
+    if (capacity == 0)
+        return;
+    rewinder.current = rg_alloc(capacity, MEM_SLOW|MEM_NOPANIC);
+    rewinder.scratch = rg_alloc(capacity, MEM_SLOW|MEM_NOPANIC);
+    rewinder.temp = rg_alloc(capacity + capacity / 16 + 16, MEM_SLOW|MEM_NOPANIC);
+    rewinder.arena = rg_alloc(RG_REWIND_BUFFER_SIZE, MEM_SLOW|MEM_NOPANIC);
+    rewinder.capacity = capacity;
+    if (!rewinder.current || !rewinder.scratch || !rewinder.temp || !rewinder.arena)
+    {
+        RG_LOGE("Not enough memory for rewind buffer!\n");
+        rewind_reset(0);
+    }
+}
+
+static void rewind_capture(void)
+{
+    rewinder.counter = 0;
+
+    size_t size = rewinder.capacity ? app.handlers.saveStateMem(rewinder.scratch, rewinder.capacity) : 0;
+    if (size == 0)
+    {
+        // The state can grow over time (nofrendo only saves dirty RAM), start over with a bigger buffer
+        size_t needed = app.handlers.saveStateMem(NULL, 0);
+        if (needed > rewinder.capacity)
+            rewind_reset(needed + needed / 4);
+        if (needed == 0 || needed > rewinder.capacity)
+        {
+            RG_LOGE("Unable to capture state, rewind disabled.\n");
+            rewinder.enabled = false;
+            rewind_reset(0);
+            return;
+        }
+        if (!(size = app.handlers.saveStateMem(rewinder.scratch, rewinder.capacity)))
+            return;
+    }
+    // Keep the tail zeroed so that states of different sizes can be XORed together
+    memset(rewinder.scratch + size, 0, rewinder.capacity - size);
+
+    if (rewinder.current_size > 0)
+    {
+        size_t length = RG_MAX(size, rewinder.current_size);
+        size_t csize = rewind_encode(rewinder.current, rewinder.scratch, length, rewinder.temp);
+
+        if (csize > RG_REWIND_BUFFER_SIZE / 4)
+        {
+            // Not worth it, we'd keep only a handful of snapshots
+            RG_LOGW("Delta too large (%d bytes), dropping history.\n", (int)csize);
+            rewinder.first = rewinder.count = rewinder.write_pos = 0;
+        }
+        else
+        {
+            if (rewinder.write_pos + csize > RG_REWIND_BUFFER_SIZE)
+            {
+                // Wrapping around: everything past write_pos is older than what we'll overwrite at 0
+                while (rewinder.count > 0 && rewinder.entries[rewinder.first].offset >= rewinder.write_pos)
+                    rewinder.first = (rewinder.first + 1) % RG_REWIND_MAX_ENTRIES, rewinder.count--;
+                rewinder.write_pos = 0;
+            }
+            while (rewinder.count > 0 && (rewinder.count == RG_REWIND_MAX_ENTRIES
+                || (rewinder.entries[rewinder.first].offset >= rewinder.write_pos
+                && rewinder.entries[rewinder.first].offset < rewinder.write_pos + csize)))
+                rewinder.first = (rewinder.first + 1) % RG_REWIND_MAX_ENTRIES, rewinder.count--;
+
+            rewind_entry_t *entry = &rewinder.entries[(rewinder.first + rewinder.count++) % RG_REWIND_MAX_ENTRIES];
+            entry->offset = rewinder.write_pos;
+            entry->size = csize;
+            entry->state_size = rewinder.current_size;
+            memcpy(rewinder.arena + rewinder.write_pos, rewinder.temp, csize);
+            rewinder.write_pos += csize;
+        }
+    }
+
+    uint8_t *temp = rewinder.current;
+    rewinder.current = rewinder.scratch;
+    rewinder.scratch = temp;
+    rewinder.current_size = size;
+}
+
+bool rg_emu_rewind(void)
+{
+    if (!rewinder.enabled || !app.handlers.loadStateMem || rewinder.current_size == 0)
+        return false;
+
+    // If we've run some frames since the last capture, go back to that capture first.
+    // The counter is -1 after a step so that the frame the core runs next doesn't count.
+    if (rewinder.counter <= 0 && rewinder.count > 0)
+    {
+        rewind_entry_t *entry = &rewinder.entries[(rewinder.first + --rewinder.count) % RG_REWIND_MAX_ENTRIES];
+        rewind_decode(rewinder.current, rewinder.arena + entry->offset, entry->size);
+        rewinder.current_size = entry->state_size;
+        rewinder.write_pos = entry->offset;
+    }
+    rewinder.counter = -1;
+
+    return app.handlers.loadStateMem(rewinder.current, rewinder.current_size);
+}
+
+void rg_emu_set_rewind(bool enable)
+{
+    rewinder.enabled = enable && app.handlers.saveStateMem && app.handlers.loadStateMem;
+    if (!rewinder.enabled)
+        rewind_reset(0);
+    rg_settings_set_number(NS_APP, SETTING_REWIND, enable);
+}
+
+bool rg_emu_get_rewind(void)
+{
+    return rewinder.enabled;
+}
+
+bool rg_emu_runahead_save(void)
+{
+    size_t size = runahead.capacity ? app.handlers.saveSnapshot(runahead.buffer, runahead.capacity) : 0;
+    if (size == 0)
+    {
+        size_t needed = app.handlers.saveSnapshot(NULL, 0);
+        if (needed > runahead.capacity)
+        {
+            free(runahead.buffer);
+            runahead.capacity = needed + needed / 4;
+            runahead.buffer = rg_alloc(runahead.capacity, MEM_ANY|MEM_NOPANIC);
+            if (!runahead.buffer)
+                runahead.capacity = 0;
+            else
+                size = app.handlers.saveSnapshot(runahead.buffer, runahead.capacity);
+        }
+        if (size == 0)
+        {
+            RG_LOGE("Unable to capture state, run-ahead disabled.\n");
+            runahead.frames = 0;
+            return false;
+        }
+    }
+    runahead.size = size;
+    return true;
+}
+
+bool rg_emu_runahead_load(void)
+{
+    if (!runahead.buffer || !runahead.size)
+        return false;
+    return app.handlers.loadSnapshot(runahead.buffer, runahead.size);
+}
+
+void rg_emu_set_runahead(int frames)
+{
+    if (!app.handlers.saveSnapshot || !app.handlers.loadSnapshot)
+        frames = 0;
+    runahead.frames = RG_MIN(RG_MAX(frames, 0), RG_RUNAHEAD_MAX_FRAMES);
+    if (runahead.frames == 0)
+    {
+        free(runahead.buffer);
+        runahead.buffer = NULL;
+        runahead.capacity = runahead.size = 0;
+    }
+    rg_settings_set_number(NS_APP, SETTING_RUNAHEAD, runahead.frames);
+}
+
+int rg_emu_get_runahead(void)
+{
+    return runahead.frames;
+}
+
+#ifdef RG_BENCHMARK
+// Headless benchmark mode, see build_bench.sh. The core runs its normal loop with scripted
+// input and we exit with a report once the requested number of frames has been emulated.
+static void bench_init(void)
+{
+    const char *core = getenv("RG_BENCH_CORE");
+    const char *rom = getenv("RG_BENCH_ROM");
+    const char *frames = getenv("RG_BENCH_FRAMES");
+
+    if (!core || !rom)
+    {
+        printf("Usage: RG_BENCH_CORE=nes RG_BENCH_ROM=path/to/rom [RG_BENCH_FRAMES=3000] rg_bench\n");
+        exit(1);
+    }
+
+    bench.core = core;
+    bench.frames = RG_MAX(frames ? atoi(frames) : 3000, 1);
+    bench.busy_times = calloc(bench.frames, sizeof(int32_t));
+    bench.video_hash = bench.audio_hash = 0;
+
+    app.configNs = core;
+    app.romPath = rom;
+    app.bootArgs = rom;
+    app.bootFlags = 0;
+    app.isLauncher = false;
+    // The cores skip frames when they think they're late, which would make the hashes
+    // nondeterministic. Pretending to run at half speed gives them plenty of slack.
+    app.speed = 0.5f;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+static void bench_tick(int busyTime)
+{
+    int frame = statistics.ticks - 1;
+
+    if (frame == 0)
+        bench.start_time = rg_system_timer();
+    if (frame < bench.frames)
+        bench.busy_times[frame] = busyTime;
+    if (frame < bench.frames - 1)
+        return;
+
+    float elapsed = (rg_system_timer() - bench.start_time) / 1000000.f;
+    int64_t total_busy = 0;
+
+    for (int i = 0; i < bench.frames; i++)
+        total_busy += bench.busy_times[i];
+    qsort(bench.busy_times, bench.frames, sizeof(int32_t), bench_compare);
+
+    #define PERCENTILE(p) bench.busy_times[(bench.frames - 1) * (p) / 100]
+    printf("core:    %s\n", bench.core);
+    printf("rom:     %s\n", app.romPath);
+    printf("frames:  %d in %.3fs (%.1f fps)\n", bench.frames, elapsed, bench.frames / RG_MAX(elapsed, 0.001f));
+    printf("busy:    %.1f fps, avg=%dus p50=%dus p90=%dus p99=%dus max=%dus\n",
+           bench.frames / RG_MAX(total_busy / 1000000.f, 0.000001f), (int)(total_busy / bench.frames),
+           (int)PERCENTILE(50), (int)PERCENTILE(90), (int)PERCENTILE(99), (int)PERCENTILE(100));
+    printf("video:   %d frames, hash=%08X\n", bench.video_frames, (unsigned)bench.video_hash);
+    printf("audio:   %d samples, hash=%08X\n", (int)bench.audio_samples, (unsigned)bench.audio_hash);
+    #undef PERCENTILE
+
+    fflush(stdout);
+    exit(0);
+}
+
+uint32_t rg_bench_input(void)
+{
+    // Tap START regularly to get past title screens, and otherwise hold a pseudo-random
+    // direction and A/B combination that changes every 16 frames. Never MENU or OPTION.
+    uint32_t frame = statistics.ticks;
+    uint32_t seed = (frame / 16 + 1) * 2654435761u;
+    uint32_t keys = RG_KEY_UP << ((seed >> 8) & 3); // UP, RIGHT, DOWN, LEFT
+    if (frame % 120 < 4)
+        keys |= RG_KEY_START;
+    if (seed & (1 << 20))
+        keys |= RG_KEY_A;
+    if (seed & (1 << 21))
+        keys |= RG_KEY_B;
+    return keys;
+}
+
+void rg_bench_hash_video(const rg_surface_t *surface)
+{
+    size_t line_size = surface->width * RG_PIXEL_GET_SIZE(surface->format);
+    const uint8_t *data = (const uint8_t *)surface->data + surface->offset;
+    for (int y = 0; y < surface->height; y++)
+        bench.video_hash = rg_crc32(bench.video_hash, data + y * surface->stride, line_size);
+    if (surface->palette && (surface->format & RG_PIXEL_PALETTE))
+        bench.video_hash = rg_crc32(bench.video_hash, (const uint8_t *)surface->palette, 256 * 2);
+    bench.video_frames++;
+}
+
+void rg_bench_hash_audio(const void *data, size_t size, size_t samples)
+{
+    bench.audio_hash = rg_crc32(bench.audio_hash, data, size);
+    bench.audio_samples += samples;
+}
+#endif
+
 #ifdef RG_ENABLE_PROFILING
 // Note this profiler might be inaccurate because of:
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
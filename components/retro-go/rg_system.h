@@ -129,6 +129,8 @@ typedef enum
 } rg_event_t;
 
 typedef bool (*rg_state_handler_t)(const char *filename);
+typedef bool (*rg_state_mem_load_handler_t)(const void *buffer, size_t size);
+typedef size_t (*rg_state_mem_save_handler_t)(void *buffer, size_t size); // Returns bytes used (or needed if buffer is NULL), 0 on error
 typedef bool (*rg_reset_handler_t)(bool hard);
 typedef void (*rg_event_handler_t)(int event, void *data);
 typedef bool (*rg_screenshot_handler_t)(const char *filename, int width, int height);
@@ -137,13 +139,17 @@ typedef int  (*rg_mem_write_handler_t)(int addr, int value);
 
 typedef struct
 {
-    rg_state_handler_t loadState;       // rg_emu_load_state() handler
-    rg_state_handler_t saveState;       // rg_emu_save_state() handler
-    rg_reset_handler_t reset;           // rg_emu_reset() handler
-    rg_screenshot_handler_t screenshot; // rg_emu_screenshot() handler
-    rg_event_handler_t event;           // listen to retro-go system events
-    rg_mem_read_handler_t memRead;      // Used by for cheats and debugging
-    rg_mem_write_handler_t memWrite;    // Used by for cheats and debugging
+    rg_state_handler_t loadState;             // rg_emu_load_state() handler
+    rg_state_handler_t saveState;             // rg_emu_save_state() handler
+    rg_state_mem_load_handler_t loadStateMem; // In-memory state restore (rewind), no file I/O allowed
+    rg_state_mem_save_handler_t saveStateMem; // In-memory state capture (rewind), no file I/O allowed
+    rg_state_mem_load_handler_t loadSnapshot; // Exact restore for run-ahead (every frame), must not reset anything
+    rg_state_mem_save_handler_t saveSnapshot; // Exact capture for run-ahead, can be the same as saveStateMem
+    rg_reset_handler_t reset;                 // rg_emu_reset() handler
+    rg_screenshot_handler_t screenshot;       // rg_emu_screenshot() handler
+    rg_event_handler_t event;                 // listen to retro-go system events
+    rg_mem_read_handler_t memRead;            // Used by for cheats and debugging
+    rg_mem_write_handler_t memWrite;          // Used by for cheats and debugging
 } rg_handlers_t;
 
 typedef struct
@@ -196,6 +202,17 @@ typedef struct
     bool initialized;
 } rg_app_t;
 
+typedef enum
+{
+    RG_TIMER_CPU = 0,   // Emulated CPU(s) and anything not timed separately
+    RG_TIMER_PRESENT,   // Frame hand-off: rg_display_sync/submit (core rendering counts as CPU)
+    RG_TIMER_AUDIO,     // Core's audio synthesis/mixing
+    RG_TIMER_BLIT,      // Display task transfers (runs on its own task)
+    RG_TIMER_AUDIO_OUT, // rg_audio_submit
+    RG_TIMER_INPUT,     // Input task polling (runs on its own task)
+    RG_TIMER_COUNT,
+} rg_timer_id_t;
+
 typedef struct
 {
     float skippedFPS;
@@ -214,6 +231,9 @@ typedef struct
     int freeBlockInt;
     int freeBlockExt;
     int freeStackMain;
+    struct {
+        int avg, p95, max; // Microseconds per frame, over the last RG_TIMERS_HISTORY frames
+    } timers[RG_TIMER_COUNT];
 } rg_stats_t;
 
 rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, const rg_gui_option_t *options);
@@ -237,6 +257,7 @@ void rg_system_tick(int busyTime);
 void rg_system_vlog(int level, const char *context, const char *format, va_list va);
 void rg_system_log(int level, const char *context, const char *format, ...) __attribute__((format(printf,3,4)));
 bool rg_system_save_trace(const char *filename, bool append);
+bool rg_system_save_timers(const char *filename);
 void rg_system_event(int event, void *data);
 int64_t rg_system_timer(void);
 rg_app_t *rg_system_get_app(void);
@@ -280,6 +301,13 @@ void rg_mutex_free(rg_mutex_t *mutex);
 bool rg_mutex_give(rg_mutex_t *mutex);
 bool rg_mutex_take(rg_mutex_t *mutex, int timeoutMS);
 
+// Binary semaphore, to let a task sleep until there's work. Gives are not counted.
+typedef void rg_semaphore_t;
+rg_semaphore_t *rg_semaphore_create(void);
+void rg_semaphore_free(rg_semaphore_t *sem);
+bool rg_semaphore_give(rg_semaphore_t *sem);
+bool rg_semaphore_take(rg_semaphore_t *sem, int timeoutMS);
+
 char *rg_emu_get_path(rg_path_type_t type, const char *arg);
 bool rg_emu_save_state(uint8_t slot);
 bool rg_emu_load_state(uint8_t slot);
@@ -289,6 +317,19 @@ rg_emu_states_t *rg_emu_get_states(const char *romPath, size_t slots);
 uint8_t rg_emu_get_last_used_slot(const char *romPath);
 void rg_emu_set_speed(float speed);
 float rg_emu_get_speed(void);
+bool rg_emu_rewind(void);
+void rg_emu_set_rewind(bool enable);
+bool rg_emu_get_rewind(void);
+bool rg_emu_runahead_save(void);
+bool rg_emu_runahead_load(void);
+void rg_emu_set_runahead(int frames);
+int rg_emu_get_runahead(void);
+
+#ifdef RG_BENCHMARK
+uint32_t rg_bench_input(void);
+void rg_bench_hash_video(const rg_surface_t *surface);
+void rg_bench_hash_audio(const void *data, size_t size, size_t samples);
+#endif
 
 /* Utilities */
 
@@ -316,6 +357,23 @@ float rg_emu_get_speed(void);
 #define RG_LOGV(x, ...) rg_system_log(RG_LOG_VERBOSE, RG_LOG_TAG, x, ## __VA_ARGS__)
 #endif
 
+// Scoped timers: time spent between BEGIN/END is accumulated per frame and pushed into
+// a history by rg_system_tick. Nested timers are exclusive: the outer one is paused.
+// BEGIN/END must only be used from the emulation task, anything else measures its own
+// elapsed time (in microseconds) and reports it with RG_TIMER_ADD.
+#if RG_ENABLE_TIMERS
+void rg_system_timer_begin(rg_timer_id_t id);
+void rg_system_timer_end(rg_timer_id_t id);
+void rg_system_timer_add(rg_timer_id_t id, int elapsed);
+#define RG_TIMER_BEGIN(id) rg_system_timer_begin(id)
+#define RG_TIMER_END(id) rg_system_timer_end(id)
+#define RG_TIMER_ADD(id, elapsed) rg_system_timer_add(id, elapsed)
+#else
+#define RG_TIMER_BEGIN(id)
+#define RG_TIMER_END(id)
+#define RG_TIMER_ADD(id, elapsed)
+#endif
+
 #ifdef RG_ENABLE_PROFILING
 void __cyg_profile_func_enter(void *this_fn, void *call_site);
 void __cyg_profile_func_exit(void *this_fn, void *call_site);
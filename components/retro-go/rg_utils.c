@@ -115,6 +115,29 @@ const char *rg_relpath(const char *path)
     return path;
 }
 
+#ifndef ESP_PLATFORM
+static uint32_t crc32_tables[8][256];
+static bool crc32_tables_ready = false;
+
+static void crc32_init_tables(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        crc32_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        for (int t = 1; t < 8; ++t)
+            crc32_tables[t][i] = (crc32_tables[t - 1][i] >> 8) ^ crc32_tables[0][crc32_tables[t - 1][i] & 0xFF];
+    }
+    // Concurrent initializations are harmless, they all write the same values
+    __atomic_store_n(&crc32_tables_ready, true, __ATOMIC_RELEASE);
+}
+#endif
+
 uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, size_t len)
 {
 #ifdef ESP_PLATFORM
@@ -122,17 +145,27 @@ uint32_t rg_crc32(uint32_t crc, const uint8_t *buf, size_t len)
     extern uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
     return crc32_le(crc, buf, len);
 #else
-    // Derived from: http://www.hackersdelight.org/hdcodetxt/crc.c.txt
+    // Slice-by-8, see: https://create.stephan-brumme.com/crc32/
+    if (!__atomic_load_n(&crc32_tables_ready, __ATOMIC_ACQUIRE))
+        crc32_init_tables();
+
+    const uint32_t (*table)[256] = crc32_tables;
     crc = ~crc;
-    for (size_t i = 0; i < len; ++i)
+    for (; len && ((uintptr_t)buf & 7); --len)
+        crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xFF];
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, buf += 8)
     {
-        crc = crc ^ buf[i];
-        for (int j = 7; j >= 0; j--) // Do eight times.
-        {
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
+        uint32_t one = *(const uint32_t *)buf ^ crc;
+        uint32_t two = *(const uint32_t *)(buf + 4);
+        crc = table[7][one & 0xFF] ^ table[6][(one >> 8) & 0xFF] ^
+              table[5][(one >> 16) & 0xFF] ^ table[4][one >> 24] ^
+              table[3][two & 0xFF] ^ table[2][(two >> 8) & 0xFF] ^
+              table[1][(two >> 16) & 0xFF] ^ table[0][two >> 24];
     }
+#endif
+    for (; len; --len)
+        crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xFF];
     return ~crc;
 #endif
 }
@@ -196,38 +229,107 @@ IRAM_ATTR uint32_t rg_hash(const char *data, size_t len)
 
 typedef struct
 {
+    uint32_t hash;
     uint16_t length;
-    uint16_t unused;
     char data[];
 } unique_string_t;
 
-const char *rg_unique_string(const char *str)
+static struct
+{
+    const unique_string_t **table; // Open addressing, linear probing
+    size_t table_mask;
+    size_t count;
+    struct {uint8_t *start; size_t size;} blocks[16]; // The arena, each block is twice as big as the previous
+    size_t blocks_count;
+    size_t block_used;
+} unique;
+
+static const unique_string_t **unique_find(uint32_t hash, const char *str, size_t len)
+{
+    size_t index = hash & unique.table_mask;
+    while (unique.table[index])
+    {
+        const unique_string_t *obj = unique.table[index];
+        if (obj->hash == hash && obj->length == len && memcmp(obj->data, str, len) == 0)
+            break;
+        index = (index + 1) & unique.table_mask;
+    }
+    return &unique.table[index];
+}
+
+static unique_string_t *unique_alloc(size_t size)
 {
-    static const unique_string_t **strings = NULL;
-    static size_t strings_count = 0;
+    size = (size + 3) & ~3;
+    if (unique.blocks_count == 0 || unique.block_used + size > unique.blocks[unique.blocks_count - 1].size)
+    {
+        if (unique.blocks_count == RG_COUNT(unique.blocks))
+            return malloc(size); // We're at several MB, this should never happen
+        size_t block_size = RG_MAX(size, 0x1000 << unique.blocks_count);
+        uint8_t *block = malloc(block_size);
+        if (!block)
+            return NULL;
+        unique.blocks[unique.blocks_count].start = block;
+        unique.blocks[unique.blocks_count].size = block_size;
+        unique.blocks_count++;
+        unique.block_used = 0;
+    }
+    unique_string_t *obj = (unique_string_t *)(unique.blocks[unique.blocks_count - 1].start + unique.block_used);
+    unique.block_used += size;
+    return obj;
+}
 
+const char *rg_unique_string(const char *str)
+{
     if (!str)
         return NULL;
 
+    // Fast path: if str lives in our arena its header tells us where to look for it in the table
+    for (size_t i = 0; i < unique.blocks_count; i++)
+    {
+        const uint8_t *start = unique.blocks[i].start;
+        if ((const uint8_t *)str < start + sizeof(unique_string_t) || (const uint8_t *)str >= start + unique.blocks[i].size)
+            continue;
+        const unique_string_t *self = (const unique_string_t *)(str - offsetof(unique_string_t, data));
+        size_t index = self->hash & unique.table_mask;
+        while (unique.table[index] && unique.table[index] != self)
+            index = (index + 1) & unique.table_mask;
+        if (unique.table[index] == self)
+            return str;
+        break;
+    }
+
     size_t len = strlen(str);
+    uint32_t hash = rg_hash(str, len);
 
-    for (int i = 0; i < strings_count; i++)
+    if (unique.count + 1 > (unique.table_mask + 1) / 2)
     {
-        if (strings[i]->length != len)
-            continue;
-        if (memcmp(strings[i]->data, str, len + 1) == 0)
-            return strings[i]->data;
+        size_t capacity = RG_MAX(256, (unique.table_mask + 1) * 2);
+        const unique_string_t **old_table = unique.table;
+        size_t old_capacity = old_table ? unique.table_mask + 1 : 0;
+        unique.table = calloc(capacity, sizeof(*unique.table));
+        RG_ASSERT(unique.table, "alloc failed");
+        unique.table_mask = capacity - 1;
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (old_table[i])
+                *unique_find(old_table[i]->hash, old_table[i]->data, old_table[i]->length) = old_table[i];
+        }
+        free(old_table);
     }
 
-    unique_string_t *obj = malloc(sizeof(unique_string_t) + len + 1);
+    const unique_string_t **slot = unique_find(hash, str, len);
+    if (*slot)
+        return (*slot)->data;
 
-    strings = realloc(strings, (strings_count + 1) * sizeof(unique_string_t *));
-    RG_ASSERT(strings && obj, "alloc failed");
+    unique_string_t *obj = unique_alloc(sizeof(unique_string_t) + len + 1);
+    RG_ASSERT(obj, "alloc failed");
 
     memcpy(obj->data, str, len + 1);
     obj->length = len;
+    obj->hash = hash;
 
-    strings[strings_count++] = obj;
+    *slot = obj;
+    unique.count++;
 
     return obj->data;
 }
@@ -59,6 +59,8 @@ unsigned char *screen, *scaled_screen;
 // Define screen buffers for embedded 565 format
 static uint8_t *screen_buffer_line=0;
 static uint8_t *screen_buffer=0;
+static uint8_t *screen_damage=0;
+static uint8_t screen_line_backup[320];
 
     // Overflow is the maximum size we can draw outside to avoid
     // wasting time and code in clipping. The maximum object is a 4x4 sprite,
@@ -131,6 +133,11 @@ void gwenesis_vdp_set_buffer(unsigned short *ptr_screen_buffer)
     screen_buffer_line = ptr_screen_buffer;
     screen_buffer = ptr_screen_buffer;
 }
+// Lines that change while rendering are flagged in damage_buffer (one byte per line)
+void gwenesis_vdp_set_damage_buffer(unsigned char *damage_buffer)
+{
+    screen_damage = damage_buffer;
+}
 
 /******************************************************************************
  *
@@ -1007,7 +1014,8 @@ blit_4to5_line(uint16_t *in, uint16_t *out) {
   }
 }
 
-void gwenesis_vdp_render_line(int line)
+static inline __attribute__((always_inline))
+void render_line(int line)
 {
   mode_h40 = REG12_MODE_H40;
   //mode_pal = REG1_PAL;
@@ -1159,6 +1167,22 @@ void gwenesis_vdp_render_line(int line)
   #endif
 }
 
+void gwenesis_vdp_render_line(int line)
+{
+#ifndef _HOST_
+  /* Compare against the previous content to flag the lines that actually changed */
+  if (screen_damage && line < 240) {
+    uint8_t *line_ptr = &screen_buffer[line * 320];
+    memcpy(screen_line_backup, line_ptr, 320);
+    render_line(line);
+    if (memcmp(screen_line_backup, line_ptr, 320))
+      screen_damage[line] = 1;
+    return;
+  }
+#endif
+  render_line(line);
+}
+
 void gwenesis_vdp_gfx_save_state() {
   /*
   SaveState* state;
@@ -19,8 +19,6 @@ int16_t gwenesis_ym2612_buffer[AUDIO_BUFFER_LENGTH];
 int ym2612_index;
 int ym2612_clock;
 
-static FILE *savestate_fp = NULL;
-static int savestate_errors = 0;
 
 static bool yfm_enabled = true;
 static bool z80_enabled = true;
@@ -35,11 +33,125 @@ static const char *SETTING_Z80_EMULATION = "z80_enable";
 static const char *SETTING_SN76489_EMULATION = "sn_enable";
 // --- MAIN
 
+// Save state container:
+//   header:  magic, version, number of index slots
+//   index:   open addressing hash table of {key hash, record offset}, offset 0 means empty
+//   records: svar_t followed by the data
+// The whole thing lives in a single buffer so that files are read/written in one go and
+// rewind can use it directly. Older saves are just a sequence of records, no header/index.
+#define SAVESTATE_MAGIC 0x53535747 // "GWSS"
+#define SAVESTATE_VERSION 1
+#define SAVESTATE_SLOTS 128 // Must be a power of two, we have ~64 keys
+
 typedef struct {
     char key[28];
     uint32_t length;
 } svar_t;
 
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t reserved;
+} svheader_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+} svslot_t;
+
+static struct {
+    uint8_t *data;    // NULL when only measuring the size of a save
+    size_t size;
+    size_t pos;
+    svslot_t *index;  // NULL when reading a legacy save
+    int errors;
+} savestate;
+
+static uint32_t savestate_hash(const char *key)
+{
+    uint32_t hash = 0x811C9DC5; // FNV-1a
+    for (size_t i = 0; i < sizeof(((svar_t *)0)->key) && key[i]; i++)
+        hash = (hash ^ (uint8_t)key[i]) * 0x01000193;
+    return hash;
+}
+
+static void savestate_open(void *data, size_t size, bool write)
+{
+    savestate.data = data;
+    savestate.size = size;
+    savestate.pos = sizeof(svheader_t) + SAVESTATE_SLOTS * sizeof(svslot_t);
+    savestate.index = NULL;
+    savestate.errors = 0;
+
+    if (write && data)
+    {
+        if (size < savestate.pos)
+        {
+            savestate.errors++;
+            return;
+        }
+        svheader_t header = {SAVESTATE_MAGIC, SAVESTATE_VERSION, SAVESTATE_SLOTS, 0};
+        memset(data, 0, savestate.pos);
+        memcpy(data, &header, sizeof(header));
+        savestate.index = (svslot_t *)(savestate.data + sizeof(svheader_t));
+    }
+    else if (!write)
+    {
+        svheader_t header = {0};
+        if (size >= savestate.pos)
+            memcpy(&header, data, sizeof(header));
+        if (header.magic == SAVESTATE_MAGIC && header.slots == SAVESTATE_SLOTS)
+            savestate.index = (svslot_t *)(savestate.data + sizeof(svheader_t));
+        else
+            savestate.pos = 0;
+    }
+}
+
+static svslot_t *savestate_find_slot(const char *tagName, uint32_t hash)
+{
+    for (size_t i = 0; i < SAVESTATE_SLOTS; i++)
+    {
+        svslot_t *slot = &savestate.index[(hash + i) & (SAVESTATE_SLOTS - 1)];
+        if (slot->offset == 0)
+            return slot;
+        if (slot->hash == hash && slot->offset + sizeof(svar_t) <= savestate.size
+            && strncmp((char *)savestate.data + slot->offset, tagName, sizeof(((svar_t *)0)->key)) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static void *savestate_find_legacy(const char* tagName, uint32_t *length)
+{
+    size_t initial_pos = savestate.pos;
+    bool from_start = false;
+    svar_t var;
+
+    // Odds are that calls to this func will be in order, so try searching from current position.
+    while (!from_start || savestate.pos < initial_pos)
+    {
+        if (savestate.pos + sizeof(svar_t) > savestate.size)
+        {
+            if (!from_start)
+            {
+                savestate.pos = 0;
+                from_start = true;
+                continue;
+            }
+            break;
+        }
+        memcpy(&var, savestate.data + savestate.pos, sizeof(svar_t));
+        savestate.pos += sizeof(svar_t) + var.length;
+        if (strncmp(var.key, tagName, sizeof(var.key)) == 0)
+        {
+            *length = var.length;
+            return savestate.data + savestate.pos - var.length;
+        }
+    }
+    return NULL;
+}
+
 SaveState* saveGwenesisStateOpenForRead(const char* fileName)
 {
     return (void*)1;
@@ -64,43 +176,56 @@ void saveGwenesisStateSet(SaveState* state, const char* tagName, int value)
 
 void saveGwenesisStateGetBuffer(SaveState* state, const char* tagName, void* buffer, int length)
 {
-    size_t initial_pos = ftell(savestate_fp);
-    bool from_start = false;
-    svar_t var;
+    uint32_t var_length = 0;
+    void *ptr = NULL;
 
-    // Odds are that calls to this func will be in order, so try searching from current file position.
-    while (!from_start || ftell(savestate_fp) < initial_pos)
+    if (savestate.index)
     {
-        if (!fread(&var, sizeof(svar_t), 1, savestate_fp))
-        {
-            if (!from_start)
-            {
-                fseek(savestate_fp, 0, SEEK_SET);
-                from_start = true;
-                continue;
-            }
-            break;
-        }
-        if (strncmp(var.key, tagName, sizeof(var.key)) == 0)
+        svslot_t *slot = savestate_find_slot(tagName, savestate_hash(tagName));
+        if (slot && slot->offset)
         {
-            fread(buffer, RG_MIN(var.length, length), 1, savestate_fp);
-            RG_LOGI("Loaded key '%s'\n", tagName);
-            return;
+            memcpy(&var_length, savestate.data + slot->offset + offsetof(svar_t, length), sizeof(var_length));
+            ptr = savestate.data + slot->offset + sizeof(svar_t);
         }
-        fseek(savestate_fp, var.length, SEEK_CUR);
     }
-    RG_LOGW("Key %s NOT FOUND!\n", tagName);
-    savestate_errors++;
+    else
+    {
+        ptr = savestate_find_legacy(tagName, &var_length);
+    }
+
+    if (!ptr || (uint8_t *)ptr + var_length > savestate.data + savestate.size)
+    {
+        RG_LOGW("Key %s NOT FOUND!\n", tagName);
+        savestate.errors++;
+        return;
+    }
+
+    memcpy(buffer, ptr, RG_MIN(var_length, length));
+    RG_LOGD("Loaded key '%s'\n", tagName);
 }
 
 void saveGwenesisStateSetBuffer(SaveState* state, const char* tagName, void* buffer, int length)
 {
-    // TO DO: seek the file to find if the key already exists. It's possible it could be written twice.
     svar_t var = {{0}, length};
     strncpy(var.key, tagName, sizeof(var.key) - 1);
-    fwrite(&var, sizeof(var), 1, savestate_fp);
-    fwrite(buffer, length, 1, savestate_fp);
-    RG_LOGI("Saved key '%s'\n", tagName);
+
+    if (savestate.data)
+    {
+        svslot_t *slot = savestate.index ? savestate_find_slot(var.key, savestate_hash(var.key)) : NULL;
+        if (!slot || savestate.pos + sizeof(var) + length > savestate.size)
+        {
+            RG_LOGE("Unable to save key '%s'\n", tagName);
+            savestate.errors++;
+            return;
+        }
+        // If a key is written twice the index will point to the latest copy
+        slot->hash = savestate_hash(var.key);
+        slot->offset = savestate.pos;
+        memcpy(savestate.data + savestate.pos, &var, sizeof(var));
+        memcpy(savestate.data + savestate.pos + sizeof(var), buffer, length);
+    }
+    savestate.pos += sizeof(var) + length;
+    RG_LOGD("Saved key '%s'\n", tagName);
 }
 
 void gwenesis_io_get_buttons()
@@ -149,30 +274,50 @@ static bool screenshot_handler(const char *filename, int width, int height)
     return rg_surface_save_image_file(currentUpdate, filename, width, height);
 }
 
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    savestate_open(buffer, size, true);
+    gwenesis_save_state();
+    savestate.data = NULL;
+    return savestate.errors ? 0 : savestate.pos;
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    savestate_open((void *)buffer, size, false);
+    gwenesis_load_state();
+    savestate.data = NULL;
+    return savestate.errors == 0;
+}
+
 static bool save_state_handler(const char *filename)
 {
-    if ((savestate_fp = fopen(filename, "wb")))
-    {
-        savestate_errors = 0;
-        gwenesis_save_state();
-        fclose(savestate_fp);
-        return savestate_errors == 0;
-    }
-    return false;
+    size_t size = save_state_mem_handler(NULL, 0);
+    void *buffer = malloc(size);
+    bool success = false;
+
+    if (buffer && (size = save_state_mem_handler(buffer, size)))
+        success = rg_storage_write_file(filename, buffer, size, 0);
+
+    free(buffer);
+    return success;
 }
 
 static bool load_state_handler(const char *filename)
 {
-    if ((savestate_fp = fopen(filename, "rb")))
+    void *buffer = NULL;
+    size_t size = 0;
+    bool success = false;
+
+    if (rg_storage_read_file(filename, &buffer, &size, 0))
     {
-        savestate_errors = 0;
-        gwenesis_load_state();
-        fclose(savestate_fp);
-        if (savestate_errors == 0)
-            return true;
+        success = load_state_mem_handler(buffer, size);
+        free(buffer);
     }
-    reset_emulation();
-    return false;
+
+    if (!success)
+        reset_emulation();
+    return success;
 }
 
 static bool reset_handler(bool hard)
@@ -194,6 +339,8 @@ void app_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -205,7 +352,9 @@ void app_main(void)
         RG_DIALOG_END
     };
 
-    app = rg_system_init(AUDIO_SAMPLE_RATE / 2, &handlers, options);
+    // The YM2612 runs at an odd rate that not every audio device accepts, rg_audio resamples it for us
+    app = rg_system_init(32000, &handlers, options);
+    rg_audio_set_source_rate(AUDIO_SAMPLE_RATE / 2);
 
     yfm_enabled = rg_settings_get_number(NS_APP, SETTING_YFM_EMULATION, 1);
     sn76489_enabled = rg_settings_get_number(NS_APP, SETTING_SN76489_EMULATION, 0);
@@ -218,6 +367,7 @@ void app_main(void)
     // This is a hack because our new surface format doesn't yet support overdraw space easily
     updates[0]->data += 160;
     updates[0]->height = 240;
+    rg_surface_track_damage(updates[0], true);
     // updates[1]->data += 160;
     // updates[1]->height = 240;
 
@@ -302,6 +452,7 @@ void app_main(void)
         screen_height = REG1_PAL ? 240 : 224;
 
         gwenesis_vdp_set_buffer(currentUpdate->data);
+        gwenesis_vdp_set_damage_buffer(currentUpdate->damage);
         gwenesis_vdp_render_config();
 
         /* Reset the difference clocks and audio index */
@@ -316,6 +467,7 @@ void app_main(void)
 
         scan_line = 0;
 
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
         while (scan_line < lines_per_frame)
         {
             m68k_run(system_clock + VDP_CYCLES_PER_LINE);
@@ -375,22 +527,27 @@ void app_main(void)
         * synchronize YM2612 and SN76489 to system_clock
         * it completes the missing audio sample for accurate audio mode
         */
+        RG_TIMER_BEGIN(RG_TIMER_AUDIO);
         if (GWENESIS_AUDIO_ACCURATE == 1) {
             gwenesis_SN76489_run(system_clock);
             ym2612_run(system_clock);
         }
+        RG_TIMER_END(RG_TIMER_AUDIO);
 
         // reset m68k cycles to the begin of next frame cycle
         m68k.cycles -= system_clock;
+        RG_TIMER_END(RG_TIMER_CPU);
 
         if (drawFrame)
         {
+            RG_TIMER_BEGIN(RG_TIMER_PRESENT);
             for (int i = 0; i < 256; ++i)
                 currentUpdate->palette[i] = (CRAM565[i] << 8) | (CRAM565[i] >> 8);
             slowFrame = !rg_display_sync(false);
             currentUpdate->width = screen_width;
             currentUpdate->height = screen_height;
             rg_display_submit(currentUpdate, 0);
+            RG_TIMER_END(RG_TIMER_PRESENT);
         }
 
         rg_system_tick(rg_system_timer() - startTime);
@@ -4,27 +4,179 @@
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "applications.h"
 #include "bookmarks.h"
 #include "gui.h"
 
-#define CRC_CACHE_MAGIC 0x21112223
-#define CRC_CACHE_MAX_ENTRIES 8192
-static struct __attribute__((__packed__))
+#define CRC_CACHE_MAGIC 0x21112224
+#define CRC_CACHE_PATH RG_BASE_PATH_CACHE "/crc32.bin"
+#define CRC_JOURNAL_PATH RG_BASE_PATH_CACHE "/crc32.log"
+#define CRC_JOURNAL_MIN_COMPACT 256
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t key; // Hash of the path
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t crc;
+} crc_cache_entry_t;
+
+// The entries are append-only, an update adds a new entry and the table is pointed at it.
+// On disk we have a snapshot (crc32.bin) plus a journal of entries added since (crc32.log).
+static struct
+{
+    crc_cache_entry_t *entries;
+    size_t count, capacity;
+    uint32_t *table; // Index + 1 in entries, 0 is free
+    size_t table_mask;
+    size_t dead;     // Entries that were superseded by a newer one
+    size_t saved;    // Entries [0, saved) are on disk
+    size_t journaled;
+} crc_cache;
+
+#ifdef ESP_PLATFORM
+#define CRC_WORKERS 0 // The SD card is the bottleneck, more tasks won't help
+#define CRC_BUFFER_SIZE 0x800
+#else
+#define CRC_WORKERS 3
+#define CRC_BUFFER_SIZE 0x40000
+#endif
+
+typedef struct
+{
+    retro_file_t **files;
+    size_t count;
+    size_t next;
+    size_t done;
+    bool abort;
+} crc_job_t;
+
+#define LIBRARY_MAGIC 0x3342494C // "LIB3"
+#define LIBRARY_STRINGS_BLOCK 0x4000
+
+typedef struct __attribute__((__packed__))
 {
     uint32_t magic;
-    uint32_t count;
-    struct {
-        uint32_t key;
-        uint32_t crc;
-    } entries[CRC_CACHE_MAX_ENTRIES];
-} *crc_cache;
-static bool crc_cache_dirty = true;
+    uint32_t dirs_count;
+    uint32_t files_count;
+    uint32_t strings_size;
+} library_header_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t path;    // Offset in strings
+    uint32_t listing; // See dir_listing_checksum
+    uint8_t saves;  // 1 if this is a saves folder, 0 if roms
+} library_dir_t;
+
+// CRCs are not stored here: a rom replaced in place leaves its folder listing unchanged, so they
+// always go through crc_cache_lookup, which checks the file's size and mtime.
+typedef struct __attribute__((__packed__))
+{
+    uint32_t name;   // Offset in strings
+    uint32_t folder; // Offset in strings
+    uint32_t size;
+    uint32_t mtime;
+    uint8_t saves;
+    uint8_t type;
+} library_file_t;
+
+struct retro_strings_s
+{
+    struct retro_strings_s *next;
+    size_t used, size;
+    char data[];
+};
 
 static retro_app_t *apps[24];
 static int apps_count = 0;
 
+static const char *app_strdup(retro_app_t *app, const char *str, size_t len)
+{
+    struct retro_strings_s *block = app->strings;
+
+    // Names are never freed individually, so we pack them in large blocks
+    if (!block || block->used + len + 1 > block->size)
+    {
+        size_t size = RG_MAX(len + 1, LIBRARY_STRINGS_BLOCK);
+        if (!(block = malloc(sizeof(*block) + size)))
+            return NULL;
+        *block = (struct retro_strings_s){app->strings, 0, size};
+        app->strings = block;
+    }
+
+    char *ptr = memcpy(block->data + block->used, str, len);
+    ptr[len] = 0;
+    block->used += len + 1;
+    return ptr;
+}
+
+static void app_free_files(retro_app_t *app)
+{
+    while (app->strings)
+    {
+        struct retro_strings_s *next = app->strings->next;
+        free(app->strings);
+        app->strings = next;
+    }
+    app->files_count = 0;
+    app->dirs_count = 0;
+    app->index.valid = false;
+    app->initialized = false;
+}
+
+static bool app_add_file(retro_app_t *app, const retro_file_t *file)
+{
+    if (app->files_count + 1 > app->files_capacity)
+    {
+        size_t new_capacity = app->files_capacity * 1.5;
+        retro_file_t *new_buf = realloc(app->files, new_capacity * sizeof(retro_file_t));
+        if (!new_buf)
+        {
+            RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...", app->files_count);
+            return false;
+        }
+        app->files = new_buf;
+        app->files_capacity = new_capacity;
+    }
+    app->files[app->files_count++] = *file;
+    app->index.valid = false;
+    return true;
+}
+
+static int dir_listing_cb(const rg_scandir_t *entry, void *arg)
+{
+    *(uint32_t *)arg += rg_hash(entry->basename, strlen(entry->basename)) | 1;
+    return RG_SCANDIR_CONTINUE;
+}
+
+static uint32_t dir_listing_checksum(const char *path, uint32_t flags)
+{
+    // FAT doesn't update the mtime of folders, so we sum the hashes of the names instead. It is
+    // order independent, changes with the entry count, and readdir alone is cheap (no stat).
+    uint32_t checksum = 0;
+    rg_storage_scandir(path, dir_listing_cb, &checksum, flags);
+    return checksum;
+}
+
+static void app_add_dir(retro_app_t *app, const char *path, uint32_t listing, bool saves)
+{
+    if (app->dirs_count % 16 == 0)
+    {
+        void *new_buf = realloc(app->dirs, (app->dirs_count + 16) * sizeof(*app->dirs));
+        if (!new_buf)
+            return;
+        app->dirs = new_buf;
+    }
+    app->dirs[app->dirs_count++] = (typeof(*app->dirs)){
+        .path = rg_unique_string(path),
+        .listing = listing,
+        .saves = saves,
+    };
+}
+
 static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
 {
     retro_app_t *app = (retro_app_t *)arg;
@@ -43,57 +195,405 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
     {
         RG_LOGI("Found subdirectory '%s'", entry->path);
         type = RETRO_TYPE_FOLDER;
+        app_add_dir(app, entry->path, dir_listing_checksum(entry->path, 0), false);
     }
 
     if (type == RETRO_TYPE_INVALID)
         return RG_SCANDIR_CONTINUE;
 
-    if (app->files_count + 1 > app->files_capacity)
-    {
-        size_t new_capacity = app->files_capacity * 1.5;
-        retro_file_t *new_buf = realloc(app->files, new_capacity * sizeof(retro_file_t));
-        if (!new_buf)
-        {
-            RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...", app->files_count);
-            return RG_SCANDIR_STOP;
-        }
-        app->files = new_buf;
-        app->files_capacity = new_capacity;
-    }
-
-    app->files[app->files_count++] = (retro_file_t) {
-        .name = strdup(entry->basename),
+    retro_file_t file = {
+        .name = app_strdup(app, entry->basename, strlen(entry->basename)),
         .folder = rg_unique_string(entry->dirname),
-        .checksum = 0,
-        .missing_cover = 0,
-        .saves = 0,
         .type = type,
         .app = (void*)app,
     };
 
+    if (!file.name || !app_add_file(app, &file))
+        return RG_SCANDIR_STOP;
+
     return RG_SCANDIR_CONTINUE;
 }
 
+typedef struct
+{
+    const char *folder;
+    const char *name;
+    uint32_t file;
+    uint16_t name_len;
+    uint8_t suffix;
+    uint8_t type;
+} index_key_t;
+
+static int index_compare(const void *a, const void *b)
+{
+    const index_key_t *ka = a, *kb = b;
+    if (ka->folder != kb->folder)
+        return (uintptr_t)ka->folder < (uintptr_t)kb->folder ? -1 : 1;
+    if (ka->type != kb->type)
+        return (int)ka->type - kb->type; // Folders first, like the listbox groups
+    // Same result as list_comp_text_asc's strcasecmp on the item text built by tab_refresh
+    for (size_t i = 0;; i++)
+    {
+        int ca = i < ka->name_len ? (unsigned char)ka->name[i] : (i == ka->name_len ? ka->suffix : 0);
+        int cb = i < kb->name_len ? (unsigned char)kb->name[i] : (i == kb->name_len ? kb->suffix : 0);
+        if ((ca = tolower(ca)) != (cb = tolower(cb)) || !ca)
+            return ca - cb;
+    }
+}
+
+static bool app_build_index(retro_app_t *app)
+{
+    // Group the files by folder, sorted by the name shown in the list (without extension), so that
+    // tab_refresh only has to walk the current folder and the list is already in SORT_TEXT_ASC order.
+    index_key_t *keys = malloc((app->files_count + 1) * sizeof(index_key_t));
+    uint32_t *files = realloc(app->index.files, (app->files_count + 1) * sizeof(uint32_t));
+    size_t count = 0, folders = 0;
+
+    if (!keys || !files)
+    {
+        RG_LOGW("Not enough memory to index '%s', falling back to filtering.", app->short_name);
+        free(keys);
+        app->index.files = files;
+        return false;
+    }
+    app->index.files = files;
+
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        const retro_file_t *file = &app->files[i];
+        if (file->type == RETRO_TYPE_INVALID || !file->name)
+            continue;
+        // Folders are shown as "[%.40s]", files as their (truncated) name without extension
+        size_t name_len = strlen(file->name);
+        if (file->type == RETRO_TYPE_FOLDER)
+            name_len = RG_MIN(name_len, 40);
+        else
+        {
+            name_len = RG_MIN(name_len, sizeof(((listbox_item_t *)0)->text) - 1);
+            for (size_t j = name_len; j > 0; j--)
+                if (file->name[j - 1] == '.')
+                {
+                    name_len = j - 1;
+                    break;
+                }
+        }
+        keys[count++] = (index_key_t){
+            .folder = file->folder,
+            .name = file->name,
+            .file = i,
+            .name_len = name_len,
+            .suffix = file->type == RETRO_TYPE_FOLDER ? ']' : 0,
+            .type = file->type,
+        };
+    }
+
+    qsort(keys, count, sizeof(index_key_t), index_compare);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        files[i] = keys[i].file;
+        if (i == 0 || keys[i].folder != keys[i - 1].folder)
+            folders++;
+    }
+
+    void *new_buf = realloc(app->index.folders, (folders + 1) * sizeof(*app->index.folders));
+    if (!new_buf)
+    {
+        free(keys);
+        return false;
+    }
+    app->index.folders = new_buf;
+    app->index.folders_count = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i == 0 || keys[i].folder != keys[i - 1].folder)
+            app->index.folders[app->index.folders_count++] = (typeof(*app->index.folders)){keys[i].folder, i, 0};
+        app->index.folders[app->index.folders_count - 1].count++;
+    }
+
+    free(keys);
+
+    RG_LOGI("Indexed %d files in %d folders", (int)count, (int)app->index.folders_count);
+    app->index.valid = true;
+    return true;
+}
+
+static const uint32_t *app_get_folder_files(retro_app_t *app, const char *folder, size_t *count)
+{
+    // folder must be a unique string. Folders are sorted by pointer, so we can bisect.
+    size_t lo = 0, hi = app->index.folders_count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        const char *path = app->index.folders[mid].path;
+        if (path == folder)
+        {
+            *count = app->index.folders[mid].count;
+            return app->index.files + app->index.folders[mid].start;
+        }
+        if ((uintptr_t)path < (uintptr_t)folder)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *count = 0;
+    return NULL;
+}
+
+static uint32_t saves_calc_key(const char *folder, const char *name, size_t name_len)
+{
+    // The saves tree mirrors the roms tree, so we key on the path relative to either
+    return rg_hash(folder, strlen(folder)) ^ rg_hash(name, name_len);
+}
+
 static int scan_saves_cb(const rg_scandir_t *entry, void *arg)
 {
-    if (entry->is_file && rg_extension_match(entry->basename, "sav"))
+    struct {
+        retro_app_t *app;
+        int32_t *table;
+        size_t mask;
+    } *map = arg;
+    retro_app_t *app = map->app;
+
+    if (entry->is_dir)
+    {
+        app_add_dir(app, entry->path, dir_listing_checksum(entry->path, 0), true);
+    }
+    else if (entry->is_file && rg_extension_match(entry->basename, "sav"))
     {
-        retro_app_t *app = (retro_app_t *)arg;
-        for (size_t i = 0; i < app->files_count; i++)
+        // Saves are the rom name with `.sav` or `-N.sav` appended.
+        const char *folder = entry->dirname + strlen(RG_BASE_PATH_SAVES);
+        size_t name_len = strlen(entry->basename) - 4;
+        for (int pass = 0; pass < 2; pass++)
         {
-            retro_file_t *file = &app->files[i];
-            // Saves are the rom name with possibly `.sav` or `-0.sav` appended.
-            if (strncmp(entry->basename, file->name, strlen(file->name)) == 0)
+            uint32_t key = saves_calc_key(folder, entry->basename, name_len);
+            for (size_t pos = key & map->mask; map->table[pos] != -1; pos = (pos + 1) & map->mask)
             {
-                // FIXME: Check if folder matches first
-                file->saves++;
-                break;
+                retro_file_t *file = &app->files[map->table[pos]];
+                if (strncmp(file->name, entry->basename, name_len) == 0 && file->name[name_len] == 0
+                    && strcmp(file->folder + strlen(RG_BASE_PATH_ROMS), folder) == 0)
+                {
+                    if (file->saves < 0xFF)
+                        file->saves++;
+                    return RG_SCANDIR_CONTINUE;
+                }
             }
+            // Not found, try again without the slot suffix
+            while (name_len > 0 && isdigit((int)entry->basename[name_len - 1]))
+                name_len--;
+            if (name_len < 2 || entry->basename[name_len - 1] != '-')
+                break;
+            name_len--;
         }
     }
     return RG_SCANDIR_CONTINUE;
 }
 
+static void scan_saves(retro_app_t *app)
+{
+    struct {
+        retro_app_t *app;
+        int32_t *table;
+        size_t mask;
+    } map = {app, NULL, 15};
+
+    while (map.mask + 1 < app->files_count * 2)
+        map.mask = (map.mask << 1) | 1;
+
+    if (!(map.table = malloc((map.mask + 1) * sizeof(int32_t))))
+        return;
+    memset(map.table, 0xFF, (map.mask + 1) * sizeof(int32_t));
+
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        retro_file_t *file = &app->files[i];
+        file->saves = 0;
+        if (file->type != RETRO_TYPE_FILE)
+            continue;
+        const char *folder = file->folder + strlen(RG_BASE_PATH_ROMS);
+        size_t pos = saves_calc_key(folder, file->name, strlen(file->name)) & map.mask;
+        while (map.table[pos] != -1)
+            pos = (pos + 1) & map.mask;
+        map.table[pos] = i;
+    }
+
+    app_add_dir(app, app->paths.saves, dir_listing_checksum(app->paths.saves, 0), true);
+    rg_storage_scandir(app->paths.saves, scan_saves_cb, &map, RG_SCANDIR_RECURSIVE);
+
+    free(map.table);
+}
+
+static const char *library_get_path(retro_app_t *app)
+{
+    static char buffer[RG_PATH_MAX + 1];
+    snprintf(buffer, RG_PATH_MAX, RG_BASE_PATH_CACHE "/library_%s.bin", app->short_name);
+    return buffer;
+}
+
+static bool library_load(retro_app_t *app, bool *saves_changed)
+{
+    void *data = NULL;
+    size_t data_len = 0;
+
+    if (!rg_storage_read_file(library_get_path(app), &data, &data_len, 0))
+        return false;
+
+    const library_header_t *header = data;
+    const library_dir_t *dirs = (void *)(header + 1);
+    const library_file_t *files = (void *)(dirs + (data_len >= sizeof(*header) ? header->dirs_count : 0));
+    const char *strings = (void *)(files + (data_len >= sizeof(*header) ? header->files_count : 0));
+    bool valid = data_len >= sizeof(*header) && header->magic == LIBRARY_MAGIC
+                 && (const char *)strings + header->strings_size == (const char *)data + data_len
+                 && header->strings_size > 0 && strings[header->strings_size - 1] == 0;
+    uint32_t strings_size = valid ? header->strings_size : 0;
+
+    // The index is only good if none of the rom folders changed since it was written.
+    // Changes to the saves folders only require recounting the saves.
+    *saves_changed = false;
+    for (size_t i = 0; valid && i < header->dirs_count; i++)
+    {
+        if (dirs[i].path >= strings_size)
+            valid = false;
+        else if (dir_listing_checksum(strings + dirs[i].path, 0) != dirs[i].listing)
+        {
+            RG_LOGI("Folder '%s' has changed", strings + dirs[i].path);
+            if (dirs[i].saves)
+                *saves_changed = true;
+            else
+                valid = false;
+        }
+    }
+
+    // The names are used in place, this replaces the strdup() of every file
+    struct retro_strings_s *block = valid ? malloc(sizeof(*block) + strings_size) : NULL;
+    if (block)
+    {
+        *block = (struct retro_strings_s){app->strings, strings_size, strings_size};
+        memcpy(block->data, strings, strings_size);
+        app->strings = block;
+    }
+    else
+    {
+        valid = false;
+    }
+
+    if (valid)
+    {
+        for (size_t i = 0; i < header->dirs_count; i++)
+            app_add_dir(app, strings + dirs[i].path, dirs[i].listing, dirs[i].saves);
+        const char *folder = NULL;
+        uint32_t folder_offset = -1;
+        for (size_t i = 0; i < header->files_count && valid; i++)
+        {
+            const library_file_t *entry = &files[i];
+            if (entry->name >= strings_size || entry->folder >= strings_size)
+            {
+                valid = false;
+                break;
+            }
+            if (entry->folder != folder_offset)
+            {
+                folder = rg_unique_string(strings + entry->folder);
+                folder_offset = entry->folder;
+            }
+            retro_file_t file = {
+                .name = block->data + entry->name,
+                .folder = folder,
+                .size = entry->size,
+                .mtime = entry->mtime,
+                .saves = entry->saves,
+                .type = entry->type,
+                .app = app,
+            };
+            valid = app_add_file(app, &file);
+        }
+        if (!valid)
+            app_free_files(app);
+    }
+
+    free(data);
+
+    return valid;
+}
+
+static bool library_save(retro_app_t *app)
+{
+    size_t files_count = 0, strings_size = 0;
+
+    // Folders are stored once per run of consecutive files, so this is the worst case
+    for (size_t i = 0; i < app->dirs_count; i++)
+        strings_size += strlen(app->dirs[i].path) + 1;
+    for (size_t i = 0; i < app->files_count; i++)
+    {
+        const retro_file_t *file = &app->files[i];
+        if (file->type == RETRO_TYPE_INVALID)
+            continue;
+        strings_size += strlen(file->name) + strlen(file->folder) + 2;
+        files_count++;
+    }
+
+    size_t data_len = sizeof(library_header_t) + app->dirs_count * sizeof(library_dir_t)
+                    + files_count * sizeof(library_file_t) + strings_size;
+    library_header_t *header = malloc(data_len);
+    if (!header)
+        return false;
+
+    library_dir_t *dirs = (void *)(header + 1);
+    library_file_t *files = (void *)(dirs + app->dirs_count);
+    char *strings = (void *)(files + files_count);
+    const char *prev_folder = NULL;
+    uint32_t prev_folder_offset = 0;
+    size_t pos = 0;
+
+    #define APPEND_STRING(str) ({size_t _offset = pos; pos += strlen(strcpy(strings + pos, str)) + 1; _offset;})
+
+    for (size_t i = 0; i < app->dirs_count; i++)
+    {
+        dirs[i] = (library_dir_t){
+            .path = APPEND_STRING(app->dirs[i].path),
+            .listing = app->dirs[i].listing,
+            .saves = app->dirs[i].saves,
+        };
+    }
+
+    for (size_t i = 0, j = 0; i < app->files_count; i++)
+    {
+        const retro_file_t *file = &app->files[i];
+        if (file->type == RETRO_TYPE_INVALID)
+            continue;
+        if (file->folder != prev_folder)
+        {
+            prev_folder_offset = APPEND_STRING(file->folder);
+            prev_folder = file->folder;
+        }
+        files[j++] = (library_file_t){
+            .name = APPEND_STRING(file->name),
+            .folder = prev_folder_offset,
+            .size = file->size,
+            .mtime = file->mtime,
+            .saves = file->saves,
+            .type = file->type,
+        };
+    }
+
+    #undef APPEND_STRING
+
+    *header = (library_header_t){
+        .magic = LIBRARY_MAGIC,
+        .dirs_count = app->dirs_count,
+        .files_count = files_count,
+        .strings_size = pos,
+    };
+
+    RG_LOGI("Saving library index of '%s' (files: %d)", app->short_name, (int)files_count);
+    data_len -= strings_size - pos;
+    app->library_dirty = !rg_storage_write_file(library_get_path(app), header, data_len, RG_FILE_ATOMIC_WRITE);
+    free(header);
+
+    return !app->library_dirty;
+}
+
 static void application_init(retro_app_t *app)
 {
     RG_LOGI("Initializing application '%s' (%s)", app->description, app->partition);
@@ -101,16 +601,45 @@ static void application_init(retro_app_t *app)
     if (app->initialized)
         return;
 
-    rg_storage_mkdir(app->paths.covers);
-    rg_storage_mkdir(app->paths.saves);
-    rg_storage_mkdir(app->paths.roms);
+    bool saves_changed = false;
 
-    rg_storage_scandir(app->paths.roms, scan_folder_cb, app, RG_SCANDIR_RECURSIVE);
-    rg_storage_scandir(app->paths.saves, scan_saves_cb, app, RG_SCANDIR_RECURSIVE);
-    // rg_storage_scandir(app->paths.covers, scan_folder_cb3, app, RG_SCANDIR_RECURSIVE);
+    if (library_load(app, &saves_changed))
+    {
+        RG_LOGI("Loaded library index (files: %d)", (int)app->files_count);
+        if (saves_changed)
+        {
+            // Only the saves need to be looked at again
+            size_t roms_dirs = 0;
+            for (size_t i = 0; i < app->dirs_count; i++)
+            {
+                if (!app->dirs[i].saves)
+                    app->dirs[roms_dirs++] = app->dirs[i];
+            }
+            app->dirs_count = roms_dirs;
+            scan_saves(app);
+            app->library_dirty = true;
+        }
+    }
+    else
+    {
+        rg_storage_mkdir(app->paths.covers);
+        rg_storage_mkdir(app->paths.saves);
+        rg_storage_mkdir(app->paths.roms);
+
+        app_add_dir(app, app->paths.roms, dir_listing_checksum(app->paths.roms, 0), false);
+        rg_storage_scandir(app->paths.roms, scan_folder_cb, app, RG_SCANDIR_RECURSIVE);
+        scan_saves(app);
+        // rg_storage_scandir(app->paths.covers, scan_folder_cb3, app, RG_SCANDIR_RECURSIVE);
+        app->library_dirty = true;
+    }
 
-    app->use_crc_covers = rg_storage_exists(strcat(app->paths.covers, "/0"));
-    app->paths.covers[strlen(app->paths.covers) - 2] = 0;
+    if (app->library_dirty)
+        library_save(app);
+
+    // paths.covers may be read by the preview task at any time, it must not be modified in place
+    char path[RG_PATH_MAX + 3];
+    snprintf(path, sizeof(path), "%s/0", app->paths.covers);
+    app->use_crc_covers = rg_storage_exists(path);
 
     app->initialized = true;
 }
@@ -141,17 +670,33 @@ static void application_start(retro_file_t *file, int load_state)
 
 static uint32_t crc_read_file(retro_file_t *file, bool interactive)
 {
-    uint8_t buffer[0x800];
+    char path[RG_PATH_MAX + 1];
     uint32_t crc_tmp = 0;
     bool done = false;
-    int count = -1;
+    size_t count = -1;
+    uint8_t *buffer;
     FILE *fp;
 
     if (file == NULL)
         return 0;
 
-    if ((fp = fopen(get_file_path(file), "rb")))
+    // Not using get_file_path() because this can run on several tasks at once
+    snprintf(path, sizeof(path), "%s/%s", file->folder, file->name);
+
+    if (!(buffer = malloc(CRC_BUFFER_SIZE)))
+        return 0;
+
+    if ((fp = fopen(path, "rb")))
     {
+        struct stat statbuf;
+        if (fstat(fileno(fp), &statbuf) == 0)
+        {
+            file->size = statbuf.st_size;
+            file->mtime = statbuf.st_mtime;
+        }
+
+        // Reads are already large, stdio's buffer would only add a copy
+        setvbuf(fp, NULL, _IONBF, 0);
         fseek(fp, file->app->crc_offset, SEEK_SET);
 
         while (count != 0)
@@ -160,7 +705,7 @@ static uint32_t crc_read_file(retro_file_t *file, bool interactive)
             if (interactive && (gui.joystick = rg_input_read_gamepad()))
                 break;
 
-            count = fread(buffer, 1, sizeof(buffer), fp);
+            count = fread(buffer, 1, CRC_BUFFER_SIZE, fp);
             crc_tmp = rg_crc32(crc_tmp, buffer, count);
         }
 
@@ -169,108 +714,247 @@ static uint32_t crc_read_file(retro_file_t *file, bool interactive)
         fclose(fp);
     }
 
+    free(buffer);
+
     return done ? crc_tmp : 0;
 }
 
+static bool crc_job_step(crc_job_t *job, bool interactive)
+{
+    size_t index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (index >= job->count || __atomic_load_n(&job->abort, __ATOMIC_RELAXED))
+        return false;
+    retro_file_t *file = job->files[index];
+    file->checksum = crc_read_file(file, interactive);
+    __atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void crc_worker_task(void *arg)
+{
+    crc_job_t *job = arg;
+    while (crc_job_step(job, false))
+        continue;
+}
+
+static bool crc_cache_insert(const crc_cache_entry_t *entry)
+{
+    if (crc_cache.count + 1 > crc_cache.capacity)
+    {
+        size_t new_capacity = RG_MAX(crc_cache.capacity * 2, 256);
+        void *new_buf = realloc(crc_cache.entries, new_capacity * sizeof(crc_cache_entry_t));
+        if (!new_buf)
+            return false;
+        crc_cache.entries = new_buf;
+        crc_cache.capacity = new_capacity;
+    }
+
+    // Keep the table at most half full, rebuilding it also compacts the entries
+    if ((crc_cache.count + 1) * 2 > crc_cache.table_mask + 1)
+    {
+        size_t new_mask = crc_cache.table_mask;
+        while ((crc_cache.count - crc_cache.dead + 1) * 2 > new_mask + 1)
+            new_mask = (new_mask << 1) | 1;
+        uint32_t *new_table = calloc(new_mask + 1, sizeof(uint32_t));
+        if (!new_table)
+            return false;
+
+        // Drop the superseded entries. The order is kept, so that [0, saved) is still what's on disk
+        size_t count = 0, saved = 0;
+        for (size_t i = 0; i < crc_cache.count; i++)
+        {
+            size_t pos = crc_cache.entries[i].key & crc_cache.table_mask;
+            while (crc_cache.entries[crc_cache.table[pos] - 1].key != crc_cache.entries[i].key)
+                pos = (pos + 1) & crc_cache.table_mask;
+            if (crc_cache.table[pos] != i + 1)
+                continue;
+            if (i < crc_cache.saved)
+                saved++;
+            crc_cache.entries[count++] = crc_cache.entries[i];
+        }
+
+        free(crc_cache.table);
+        crc_cache.table = new_table;
+        crc_cache.table_mask = new_mask;
+        crc_cache.count = count;
+        crc_cache.saved = saved;
+        crc_cache.dead = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t pos = crc_cache.entries[i].key & new_mask;
+            while (new_table[pos])
+                pos = (pos + 1) & new_mask;
+            new_table[pos] = i + 1;
+        }
+    }
+
+    size_t pos = entry->key & crc_cache.table_mask;
+    while (crc_cache.table[pos] && crc_cache.entries[crc_cache.table[pos] - 1].key != entry->key)
+        pos = (pos + 1) & crc_cache.table_mask;
+    if (crc_cache.table[pos])
+        crc_cache.dead++;
+
+    crc_cache.entries[crc_cache.count] = *entry;
+    crc_cache.table[pos] = ++crc_cache.count;
+    return true;
+}
+
 static void crc_cache_init(void)
 {
-    crc_cache = calloc(1, sizeof(*crc_cache));
-    if (!crc_cache)
+    void *data = NULL;
+    size_t data_len = 0;
+
+    memset(&crc_cache, 0, sizeof(crc_cache));
+    crc_cache.table_mask = 511;
+    crc_cache.table = calloc(crc_cache.table_mask + 1, sizeof(uint32_t));
+    if (!crc_cache.table)
     {
         RG_LOGE("Failed to allocate crc_cache!");
         return;
     }
 
-    void *data_ptr = crc_cache;
-    size_t data_len = sizeof(*crc_cache);
-    rg_storage_read_file(RG_BASE_PATH_CACHE "/crc32.bin", &data_ptr, &data_len, RG_FILE_USER_BUFFER);
-    if (crc_cache->magic == CRC_CACHE_MAGIC && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
+    if (rg_storage_read_file(CRC_CACHE_PATH, &data, &data_len, 0))
     {
-        RG_LOGI("Loaded CRC cache (entries: %d)", (int)crc_cache->count);
-        crc_cache_dirty = false;
+        const uint32_t *header = data;
+        const crc_cache_entry_t *entries = (void *)(header + 2);
+        if (data_len >= 8 && header[0] == CRC_CACHE_MAGIC && 8 + header[1] * sizeof(crc_cache_entry_t) == data_len)
+        {
+            for (size_t i = 0; i < header[1]; i++)
+                crc_cache_insert(&entries[i]);
+        }
+        free(data);
     }
-    else
+
+    FILE *fp = fopen(CRC_JOURNAL_PATH, "rb");
+    if (fp)
     {
-        crc_cache->count = 0;
+        crc_cache_entry_t entry;
+        while (fread(&entry, sizeof(entry), 1, fp) == 1)
+        {
+            crc_cache_insert(&entry);
+            crc_cache.journaled++;
+        }
+        fclose(fp);
     }
+
+    crc_cache.saved = crc_cache.count;
+    RG_LOGI("Loaded CRC cache (entries: %d, journaled: %d)", (int)crc_cache.count, (int)crc_cache.journaled);
 }
 
 static void crc_cache_save(void)
 {
-    if (!crc_cache || !crc_cache_dirty)
+    if (!crc_cache.table || crc_cache.saved == crc_cache.count)
         return;
 
-    RG_LOGI("Saving CRC cache...");
-    size_t data_len = RG_MIN(8 + (crc_cache->count * sizeof(crc_cache->entries[0])), sizeof(*crc_cache));
-    crc_cache_dirty = !rg_storage_write_file(RG_BASE_PATH_CACHE"/crc32.bin", crc_cache, data_len, 0);
+    size_t live = crc_cache.count - crc_cache.dead;
+    size_t pending = crc_cache.count - crc_cache.saved;
+
+    if (crc_cache.journaled + pending < RG_MAX(live / 4, CRC_JOURNAL_MIN_COMPACT))
+    {
+        RG_LOGI("Appending %d entries to CRC journal...", (int)pending);
+        FILE *fp = fopen(CRC_JOURNAL_PATH, "ab");
+        if (fp)
+        {
+            if (fwrite(&crc_cache.entries[crc_cache.saved], sizeof(crc_cache_entry_t), pending, fp) == pending)
+            {
+                crc_cache.journaled += pending;
+                crc_cache.saved = crc_cache.count;
+            }
+            fclose(fp);
+            return;
+        }
+    }
+
+    // Compaction: write the live entries as a new snapshot, then drop the journal
+    RG_LOGI("Saving CRC cache (entries: %d)...", (int)live);
+    uint32_t *data = malloc(8 + live * sizeof(crc_cache_entry_t));
+    if (!data)
+        return;
+
+    crc_cache_entry_t *entries = (void *)(data + 2);
+    size_t count = 0;
+    for (size_t i = 0; i <= crc_cache.table_mask; i++)
+    {
+        if (crc_cache.table[i])
+            entries[count++] = crc_cache.entries[crc_cache.table[i] - 1];
+    }
+    data[0] = CRC_CACHE_MAGIC;
+    data[1] = count;
+
+    if (rg_storage_write_file(CRC_CACHE_PATH, data, 8 + count * sizeof(crc_cache_entry_t), RG_FILE_ATOMIC_WRITE))
+    {
+        rg_storage_delete(CRC_JOURNAL_PATH);
+        crc_cache.journaled = 0;
+        crc_cache.saved = crc_cache.count;
+    }
+    free(data);
 }
 
 static uint32_t crc_cache_calc_key(retro_file_t *file)
 {
-    // return ((uint64_t)rg_crc32(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
-    // This should be reasonably unique
+    // This should be reasonably unique, size and mtime take care of the rest
     const char *path = get_file_path(file);
     return rg_crc32(0, (const uint8_t *)path, strlen(path));
 }
 
-static int crc_cache_find(retro_file_t *file)
+static const crc_cache_entry_t *crc_cache_find(retro_file_t *file)
 {
-    if (!crc_cache)
-        return -1;
+    if (!crc_cache.table)
+        return NULL;
 
     uint32_t key = crc_cache_calc_key(file);
+    size_t pos = key & crc_cache.table_mask;
 
-    for (int i = 0; i < crc_cache->count; i++)
+    while (crc_cache.table[pos])
     {
-        if (crc_cache->entries[i].key == key)
-            return i;
+        const crc_cache_entry_t *entry = &crc_cache.entries[crc_cache.table[pos] - 1];
+        if (entry->key == key)
+            return entry;
+        pos = (pos + 1) & crc_cache.table_mask;
     }
 
-    return -1;
+    return NULL;
 }
 
 static uint32_t crc_cache_lookup(retro_file_t *file)
 {
-    int index = crc_cache_find(file);
-    if (index != -1)
-        return crc_cache->entries[index].crc;
-    return 0;
+    const crc_cache_entry_t *entry = crc_cache_find(file);
+    if (!entry)
+        return 0;
+
+    // The size and mtime in file may come from the library index, which can be older than the cache
+    rg_stat_t info = rg_storage_stat(get_file_path(file));
+    file->size = info.size;
+    file->mtime = info.mtime;
+
+    // The file has changed since it was hashed
+    if (entry->size != file->size || entry->mtime != file->mtime)
+        return 0;
+
+    return entry->crc;
 }
 
 static void crc_cache_update(retro_file_t *file)
 {
-    if (!crc_cache)
-        return;
-
-    uint32_t key = crc_cache_calc_key(file);
-    int index = crc_cache_find(file);
-    if (index == -1)
-    {
-        if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-            index = crc_cache->count++;
-        else
-            index = rand() % CRC_CACHE_MAX_ENTRIES;
+    crc_cache_entry_t entry = {
+        .key = crc_cache_calc_key(file),
+        .size = file->size,
+        .mtime = file->mtime,
+        .crc = file->checksum,
+    };
 
-        RG_LOGI("Adding %08X => %08X to cache (new total: %d)",
-            (int)key, (int)file->checksum, (int)crc_cache->count);
-    }
-    else
-    {
-        RG_LOGI("Updating %08X => %08X to cache (total: %d)",
-            (int)key, (int)file->checksum, (int)crc_cache->count);
-    }
+    if (!crc_cache.table || !crc_cache_insert(&entry))
+        return;
 
-    crc_cache->magic = CRC_CACHE_MAGIC;
-    crc_cache->entries[index].key = key;
-    crc_cache->entries[index].crc = file->checksum;
-    crc_cache_dirty = true;
+    RG_LOGI("Adding %08X => %08X to cache (new total: %d)",
+        (int)entry.key, (int)entry.crc, (int)(crc_cache.count - crc_cache.dead));
 
-    // crc_cache_save();
+    file->app->library_dirty = true;
 }
 
 void crc_cache_prebuild(void)
 {
-    if (!crc_cache)
+    if (!crc_cache.table)
         return;
 
     for (int i = 0; i < apps_count; i++)
@@ -283,30 +967,56 @@ void crc_cache_prebuild(void)
         if (!app->initialized)
             application_init(app);
 
+        crc_job_t job = {
+            .files = calloc(app->files_count + 1, sizeof(retro_file_t *)),
+        };
+        if (!job.files)
+            break;
+
         for (int j = 0; j < app->files_count; j++)
         {
             retro_file_t *file = &app->files[j];
+            if (file->checksum || (file->checksum = crc_cache_lookup(file)))
+                continue;
+            job.files[job.count++] = file;
+        }
 
-            rg_gui_draw_message("Scanning %s %d/%d", app->short_name, j, app->files_count);
+        // Files are hashed by a few worker tasks, this one just reports progress and polls input.
+        // If no worker could be started, or on targets without any, we do the work ourselves.
+        for (int j = 0; j < CRC_WORKERS && job.count > 1; j++)
+            rg_task_create("crc_worker", &crc_worker_task, &job, 4 * 1024, RG_TASK_PRIORITY_2, -1);
+
+        while (true)
+        {
+            size_t done = __atomic_load_n(&job.done, __ATOMIC_ACQUIRE);
+            rg_gui_draw_message("Scanning %s %d/%d", app->short_name, (int)done, (int)job.count);
 
             // Give up on any button press to improve responsiveness
             if (rg_input_read_gamepad())
-                break;
+                __atomic_store_n(&job.abort, true, __ATOMIC_RELAXED);
 
-            if (file->checksum)
-                continue;
-
-            if ((file->checksum = crc_cache_lookup(file)))
-                continue;
+            // Waiting for the task slots to be released (not just for the work to be done) is what
+            // lets the next app start its own workers without running out of slots.
+            if (rg_task_find("crc_worker"))
+                rg_task_delay(20);
+            else if (!crc_job_step(&job, true))
+                break;
+        }
 
-            if ((file->checksum = crc_read_file(file, true)))
-                crc_cache_update(file);
+        for (size_t j = 0; j < job.count; j++)
+        {
+            if (job.files[j]->checksum)
+                crc_cache_update(job.files[j]);
         }
+        free(job.files);
+
+        crc_cache_save();
+        if (app->library_dirty)
+            library_save(app);
 
-        if (rg_input_read_gamepad())
+        if (job.abort)
             break;
 
-        crc_cache_save();
         gui_redraw();
     }
 
@@ -329,16 +1039,22 @@ static void tab_refresh(tab_t *tab, const char *selected)
 
     if (app->files_count > 0)
     {
-        gui_resize_list(tab, app->files_count);
+        const uint32_t *children = NULL;
+        size_t count = app->files_count;
+
+        if (app->index.valid || app_build_index(app))
+            children = app_get_folder_files(app, folder, &count);
 
-        for (size_t i = 0; i < app->files_count; i++)
+        gui_resize_list(tab, count);
+
+        for (size_t i = 0; i < count; i++)
         {
-            retro_file_t *file = &app->files[i];
+            retro_file_t *file = &app->files[children ? children[i] : i];
 
             if (file->type == RETRO_TYPE_INVALID || !file->name)
                 continue;
 
-            if (file->folder != folder && strcmp(file->folder, folder) != 0)
+            if (file->folder != folder) // Both are unique strings
                 continue;
 
             if (file->type == RETRO_TYPE_FOLDER)
@@ -361,6 +1077,8 @@ static void tab_refresh(tab_t *tab, const char *selected)
     }
 
     gui_resize_list(tab, items_count);
+    if (app->index.valid)
+        tab->listbox.sorted = SORT_TEXT_ASC;
     gui_sort_list(tab);
 
     if (items_count == 0)
@@ -400,10 +1118,10 @@ static void event_handler(gui_event_t event, tab_t *tab)
     {
         if (event == TAB_RESCAN && app->initialized)
         {
-            for (size_t i = 0; i < app->files_count; ++i)
-                free((char *)app->files[i].name);
-            app->files_count = 0;
-            app->initialized = false;
+            // Files overwritten in place keep the same listing, a rescan must ignore the index
+            rg_storage_delete(library_get_path(app));
+            app_free_files(app);
+            __atomic_store_n(&app->covers_listing, 0, __ATOMIC_RELAXED);
         }
 
         application_init(app);
@@ -413,9 +1131,13 @@ static void event_handler(gui_event_t event, tab_t *tab)
         if (selected) // && !rg_storage_exists(get_file_path(selected)))
         {
             // rg_storage_exists can take a long time on large folders (200ms), this is much faster
-            for (size_t i = 0; i < app->files_count; ++i)
+            size_t count = app->files_count;
+            const uint32_t *children = NULL;
+            if (app->index.valid || app_build_index(app))
+                children = app_get_folder_files(app, selected->folder, &count);
+            for (size_t i = 0; i < count; ++i)
             {
-                retro_file_t *file = &app->files[i];
+                retro_file_t *file = &app->files[children ? children[i] : i];
                 if (selected->folder == file->folder && strcmp(selected->name, file->name) == 0)
                 {
                     tab->navpath = file->folder;
@@ -441,7 +1163,7 @@ static void event_handler(gui_event_t event, tab_t *tab)
     }
     else if (event == TAB_IDLE)
     {
-        if (file && !tab->preview && gui.browse && gui.idle_counter == 1)
+        if (file && !tab->preview && gui.browse && (gui.idle_counter == 1 || tab->preview_pending))
             gui_load_preview(tab);
     }
     else if (event == TAB_ACTION)
@@ -497,6 +1219,42 @@ bool application_path_to_file(const char *path, retro_file_t *file)
     return false;
 }
 
+uint32_t application_get_covers_listing(retro_app_t *app)
+{
+    // Covers known to be missing are only trusted while this is unchanged. It's computed once per
+    // session (or rescan) and can be called from any task, the first call scans the covers folder.
+    uint32_t listing = __atomic_load_n(&app->covers_listing, __ATOMIC_RELAXED);
+    if (!listing)
+    {
+        listing = dir_listing_checksum(app->paths.covers, RG_SCANDIR_RECURSIVE) ?: 1;
+        __atomic_store_n(&app->covers_listing, listing, __ATOMIC_RELAXED);
+    }
+    return listing;
+}
+
+uint32_t application_peek_file_crc32(retro_file_t *file, uint32_t *size, uint32_t *mtime)
+{
+    // Unlike crc_cache_lookup this does no I/O, the caller must check size and mtime against the file
+    const crc_cache_entry_t *entry = crc_cache_find(file);
+    if (!entry)
+        return 0;
+    *size = entry->size;
+    *mtime = entry->mtime;
+    return entry->crc;
+}
+
+uint32_t application_read_file_crc32(retro_file_t *file)
+{
+    // Unlike application_get_file_crc32, this doesn't use the cache and can be called from any task
+    return crc_read_file(file, false);
+}
+
+void application_set_file_crc32(retro_file_t *file, uint32_t crc)
+{
+    file->checksum = crc;
+    crc_cache_update(file);
+}
+
 bool application_get_file_crc32(retro_file_t *file)
 {
     uint32_t crc_tmp = 0;
@@ -614,6 +1372,8 @@ void application_show_file_menu(retro_file_t *file, bool advanced)
         /* fallthrough */
     case 1:
         crc_cache_save();
+        if (file->app->library_dirty)
+            library_save(file->app);
         gui_save_config();
         application_start(file, slot);
         break;
@@ -18,6 +18,8 @@ typedef struct
 {
     const char *name;
     const char *folder;
+    uint32_t size;
+    uint32_t mtime;
     uint32_t checksum;
     uint16_t missing_cover;
     uint8_t saves;
@@ -40,6 +42,25 @@ typedef struct retro_app_s
     retro_file_t *files;
     size_t files_capacity;
     size_t files_count;
+    struct {
+        const char *path;
+        uint32_t listing;
+        bool saves;
+    } *dirs;
+    size_t dirs_count;
+    struct {
+        uint32_t *files; // Indices into files, grouped by folder and presorted by name
+        struct {
+            const char *path;
+            uint32_t start;
+            uint32_t count;
+        } *folders;
+        size_t folders_count;
+        bool valid;
+    } index;
+    struct retro_strings_s *strings;
+    uint32_t covers_listing; // See application_get_covers_listing, 0 until computed
+    bool library_dirty;
     bool use_crc_covers;
     bool initialized;
     bool available;
@@ -50,5 +71,9 @@ typedef struct tab_s tab_t;
 void applications_init(void);
 void application_show_file_menu(retro_file_t *file, bool simplified);
 bool application_get_file_crc32(retro_file_t *file);
+uint32_t application_read_file_crc32(retro_file_t *file);
+uint32_t application_peek_file_crc32(retro_file_t *file, uint32_t *size, uint32_t *mtime);
+void application_set_file_crc32(retro_file_t *file, uint32_t crc);
 bool application_path_to_file(const char *path, retro_file_t *out_file);
+uint32_t application_get_covers_listing(retro_app_t *app);
 void crc_cache_prebuild(void);
@@ -9,6 +9,63 @@
 #define LOGO_WIDTH          (46)
 #define PREVIEW_HEIGHT      ((int)(gui.height * 0.70f))
 #define PREVIEW_WIDTH       ((int)(gui.width * 0.50f))
+#define PREVIEW_PREFETCH    (2) // Neighbors on each side of the selected item
+#define PREVIEW_QUEUE_SIZE  (1 + PREVIEW_PREFETCH * 2)
+#define PREVIEW_MISSING_PATH RG_BASE_PATH_CACHE "/nocover.bin"
+#define PREVIEW_MISSING_MAGIC 0x32434F4E // "NOC2"
+#define PREVIEW_COVERS_MASK ((1 << 1) | (1 << 2) | (1 << 3))
+
+typedef struct
+{
+    uint32_t key;
+    uint32_t checksum;
+    uint32_t size, mtime;
+    uint32_t last_used;
+    uint16_t missing;
+    bool checksum_cached; // checksum came from the CRC cache, no need to add it again
+    bool incomplete;      // A prefetch stopped at a cover that needs a CRC we don't have yet
+    rg_image_t *image;
+} preview_t;
+
+typedef struct
+{
+    uint32_t key;     // preview_calc_key, 0 is free
+    uint32_t missing; // Cover types that weren't found
+    uint32_t listing; // The app's covers listing when they weren't found, see application_get_covers_listing
+} preview_missing_t;
+
+typedef struct
+{
+    uint32_t key;      // Identifies the cache entry (file and preview order)
+    uint32_t file_key; // Identifies the file only
+    uint32_t order;
+    uint32_t cached_crc; // From the CRC cache, valid only if the file still has this size and mtime
+    uint32_t cached_size, cached_mtime;
+    bool prefetch;     // Not the selected item, don't spend time hashing the file
+    retro_file_t file; // name and folder point to the buffers below
+    char name[RG_PATH_MAX + 1];
+    char folder[RG_PATH_MAX + 1];
+} preview_request_t;
+
+// Previews are loaded by a background task, the UI only ever looks into the cache
+static struct
+{
+    rg_mutex_t *lock;
+    rg_semaphore_t *wakeup; // Given whenever the queue is filled
+    rg_task_t *task;
+    preview_request_t queue[PREVIEW_QUEUE_SIZE];
+    size_t queue_count;
+    uint32_t loading;    // Key of the request being processed
+    uint32_t generation; // Bumped by previews_clear, the result of an older request is dropped
+    preview_t *cache;
+    size_t cache_size;
+    uint32_t clock;
+    // Covers known to be missing, persisted across sessions. Open addressing, key 0 is free.
+    preview_missing_t *missing;
+    size_t missing_mask;
+    size_t missing_count;
+    bool missing_dirty;
+} previews;
 
 retro_gui_t gui;
 
@@ -100,8 +157,13 @@ tab_t *gui_get_tab(int index)
     return (index >= 0 && index < gui.tabs_count) ? gui.tabs[index] : NULL;
 }
 
+static void previews_clear(void);
+
 void gui_invalidate(void)
 {
+    // Files may have been added or removed, forget what we know about covers
+    previews_clear();
+
     for (size_t i = 0; i < gui.tabs_count; ++i)
     {
         if (gui.tabs[i]->initialized)
@@ -222,6 +284,22 @@ void gui_save_config(void)
     for (int i = 0; i < gui.tabs_count; i++)
         rg_settings_set_number(NS_APP, SETTING_HIDE_TAB(gui.tabs[i]->name), !gui.tabs[i]->enabled);
     rg_settings_commit();
+
+    if (previews.lock && previews.missing_dirty)
+    {
+        rg_mutex_take(previews.lock, -1);
+        size_t data_len = 8 + (previews.missing_mask + 1) * sizeof(*previews.missing);
+        uint32_t *data = malloc(data_len);
+        if (data)
+        {
+            data[0] = PREVIEW_MISSING_MAGIC;
+            data[1] = previews.missing_mask;
+            memcpy(data + 2, previews.missing, data_len - 8);
+            previews.missing_dirty = !rg_storage_write_file(PREVIEW_MISSING_PATH, data, data_len, 0);
+            free(data);
+        }
+        rg_mutex_give(previews.lock);
+    }
 }
 
 listbox_item_t *gui_get_selected_item(tab_t *tab)
@@ -260,16 +338,39 @@ void gui_sort_list(tab_t *tab)
     void *comp[] = {&list_comp_id_asc, &list_comp_id_desc, &list_comp_text_asc, &list_comp_text_desc};
     size_t sort_mode = tab->listbox.sort_mode - 1;
 
-    if (!tab->listbox.length || sort_mode > RG_COUNT(comp) - 1)
+    listbox_t *list = &tab->listbox;
+
+    if (!list->length || sort_mode > RG_COUNT(comp) - 1 || list->sorted == list->sort_mode)
         return;
 
-    qsort((void*)tab->listbox.items, tab->listbox.length, sizeof(listbox_item_t), comp[sort_mode]);
+    // Going from ASC to DESC (or back) on the same key only needs each group reversed
+    if (list->sorted != SORT_NONE && (list->sorted - 1) / 2 == sort_mode / 2)
+    {
+        for (int start = 0, end; start < list->length; start = end)
+        {
+            for (end = start + 1; end < list->length && list->items[end].group == list->items[start].group;)
+                end++;
+            for (int i = start, j = end - 1; i < j; i++, j--)
+            {
+                listbox_item_t tmp = list->items[i];
+                list->items[i] = list->items[j];
+                list->items[j] = tmp;
+            }
+        }
+    }
+    else
+    {
+        qsort((void*)list->items, list->length, sizeof(listbox_item_t), comp[sort_mode]);
+    }
+    list->sorted = list->sort_mode;
 }
 
 void gui_resize_list(tab_t *tab, int new_size)
 {
     listbox_t *list = &tab->listbox;
 
+    list->sorted = SORT_NONE;
+
     if (new_size == list->length)
         return;
 
@@ -501,51 +602,83 @@ void gui_set_preview(tab_t *tab, rg_image_t *preview)
     if (!tab)
         return;
 
-    if (tab->preview)
-        rg_surface_free(tab->preview);
-
+    // Previews belong to the preview cache, we never free them here
     tab->preview = preview;
 }
 
-void gui_load_preview(tab_t *tab)
+static preview_missing_t *previews_find_missing(uint32_t key, bool insert)
 {
-    listbox_item_t *item = gui_get_selected_item(tab);
-    bool show_missing_cover = false;
-    uint32_t order;
+    size_t pos = key & previews.missing_mask;
+    while (previews.missing[pos].key && previews.missing[pos].key != key)
+        pos = (pos + 1) & previews.missing_mask;
+    if (previews.missing[pos].key == key)
+        return &previews.missing[pos];
+    if (!insert)
+        return NULL;
+
+    // Keep the table at most half full
+    if ((previews.missing_count + 1) * 2 > previews.missing_mask + 1)
+    {
+        size_t new_mask = (previews.missing_mask << 1) | 1;
+        preview_missing_t *new_table = calloc(new_mask + 1, sizeof(preview_missing_t));
+        if (!new_table)
+            return NULL;
+        for (size_t i = 0; i <= previews.missing_mask; i++)
+        {
+            if (!previews.missing[i].key)
+                continue;
+            pos = previews.missing[i].key & new_mask;
+            while (new_table[pos].key)
+                pos = (pos + 1) & new_mask;
+            new_table[pos] = previews.missing[i];
+        }
+        free(previews.missing);
+        previews.missing = new_table;
+        previews.missing_mask = new_mask;
+        pos = key & new_mask;
+        while (previews.missing[pos].key)
+            pos = (pos + 1) & new_mask;
+    }
 
-    gui_set_preview(tab, NULL);
+    previews.missing[pos].key = key;
+    previews.missing_count++;
+    return &previews.missing[pos];
+}
 
-    if (!item || !item->arg)
+static void previews_clear(void)
+{
+    if (!previews.lock)
         return;
 
-    switch (gui.show_preview)
+    rg_mutex_take(previews.lock, -1);
+    for (size_t i = 0; i < previews.cache_size; i++)
     {
-        case PREVIEW_MODE_COVER_SAVE:
-            show_missing_cover = true;
-            order = 0x4123;
-            break;
-        case PREVIEW_MODE_SAVE_COVER:
-            show_missing_cover = true;
-            order = 0x1234;
-            break;
-        case PREVIEW_MODE_COVER_ONLY:
-            show_missing_cover = true;
-            order = 0x0123;
-            break;
-        case PREVIEW_MODE_SAVE_ONLY:
-            show_missing_cover = false;
-            order = 0x0004;
-            break;
-        default:
-            show_missing_cover = false;
-            order = 0x0000;
+        rg_image_t *image = previews.cache[i].image;
+        previews.cache[i] = (preview_t){0};
+        for (size_t j = 0; j < gui.tabs_count; j++)
+        {
+            if (gui.tabs[j]->preview == image)
+                gui.tabs[j]->preview = NULL;
+        }
+        rg_surface_free(image);
     }
+    memset(previews.missing, 0, (previews.missing_mask + 1) * sizeof(*previews.missing));
+    previews.missing_count = 0;
+    previews.missing_dirty = true;
+    previews.queue_count = 0;
+    previews.loading = 0;
+    previews.generation++;
+    rg_mutex_give(previews.lock);
+}
 
-    retro_file_t *file = item->arg;
+static rg_image_t *preview_load(preview_request_t *req, preview_t *result)
+{
+    retro_file_t *file = &req->file;
     retro_app_t *app = file->app;
-    uint32_t errors = 0;
+    rg_image_t *image = NULL;
+    uint32_t order = req->order;
 
-    while (order && !tab->preview)
+    while (order && !image)
     {
         char path[RG_PATH_MAX + 1];
         size_t path_len = 0;
@@ -553,16 +686,40 @@ void gui_load_preview(tab_t *tab)
 
         order >>= 4;
 
-        // Give up on any button press to improve responsiveness
-        if ((gui.joystick |= rg_input_read_gamepad()))
-            break;
-
         if (file->missing_cover & (1 << type))
             continue;
 
-        if (type == 0x1 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (old format)
+        // The CRC is only computed if we actually need it, and we report it back to the UI task
+        if ((type == 0x1 || type == 0x2) && app->use_crc_covers && !file->checksum)
+        {
+            if (req->cached_crc)
+            {
+                snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
+                rg_stat_t info = rg_storage_stat(path);
+                if (info.exists && info.size == req->cached_size && (uint32_t)info.mtime == req->cached_mtime)
+                {
+                    file->checksum = req->cached_crc;
+                    file->size = info.size;
+                    file->mtime = info.mtime;
+                    result->checksum_cached = true;
+                }
+            }
+            if (!file->checksum && req->prefetch)
+            {
+                // Hashing a whole ROM for a neighbor isn't worth it, it will be done if it gets selected
+                result->incomplete = true;
+                break;
+            }
+            if (!file->checksum)
+                file->checksum = application_read_file_crc32(file);
+            result->checksum = file->checksum;
+            result->size = file->size;
+            result->mtime = file->mtime;
+        }
+
+        if (type == 0x1 && app->use_crc_covers && file->checksum) // Game cover (old format)
             path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
-        else if (type == 0x2 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (png)
+        else if (type == 0x2 && app->use_crc_covers && file->checksum) // Game cover (png)
             path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
         else if (type == 0x3) // Game cover (based on filename)
         {
@@ -585,18 +742,264 @@ void gui_load_preview(tab_t *tab)
         if (path_len > 0 && path_len < RG_PATH_MAX)
         {
             RG_LOGD("Looking for %s", path);
-            gui_set_preview(tab, rg_surface_load_image_file(path, 0));
-            // if (!tab->preview && rg_storage_exists(path))
-            //     errors++;
+            // Covers are static so we can keep them pre-scaled, save state screenshots change too often
+            if (type < 0x4)
+                image = rg_surface_load_image_cached(path, PREVIEW_WIDTH, PREVIEW_HEIGHT);
+            else
+                image = rg_surface_load_image_file(path, 0);
+        }
+
+        result->missing |= (image ? 0 : 1) << type;
+    }
+
+    return image;
+}
+
+static void preview_task(void *arg)
+{
+    preview_request_t *req = malloc(sizeof(preview_request_t));
+    if (!req)
+        return;
+
+    while (true)
+    {
+        rg_mutex_take(previews.lock, -1);
+        if (previews.queue_count == 0)
+        {
+            rg_mutex_give(previews.lock);
+            rg_semaphore_take(previews.wakeup, -1);
+            continue;
+        }
+        // The queue is sorted by priority: selected item first, then the nearest neighbors
+        *req = previews.queue[0];
+        req->file.name = req->name;
+        req->file.folder = req->folder;
+        memmove(&previews.queue[0], &previews.queue[1], --previews.queue_count * sizeof(preview_request_t));
+        previews.loading = req->key;
+        uint32_t generation = previews.generation;
+        rg_mutex_give(previews.lock);
+
+        preview_t result = {.key = req->key};
+        result.image = preview_load(req, &result);
+        uint32_t listing = application_get_covers_listing(req->file.app);
+
+        rg_mutex_take(previews.lock, -1);
+        if (generation != previews.generation || result.incomplete)
+        {
+            // previews_clear was called while we were loading (the files may be gone), or there's
+            // nothing worth caching yet
+            previews.loading = 0;
+            rg_mutex_give(previews.lock);
+            rg_surface_free(result.image);
+            continue;
+        }
+        previews.loading = 0;
+        // Evict the least recently used preview, unless it's on screen
+        preview_t *slot = NULL;
+        for (size_t i = 0; i < previews.cache_size; i++)
+        {
+            preview_t *entry = &previews.cache[i];
+            bool visible = false;
+            for (size_t j = 0; j < gui.tabs_count && entry->image; j++)
+                visible |= gui.tabs[j]->preview == entry->image;
+            if (!visible && (!slot || entry->last_used < slot->last_used))
+                slot = entry;
+        }
+        if (slot)
+        {
+            rg_surface_free(slot->image);
+            result.last_used = previews.clock;
+            *slot = result;
+            preview_missing_t *missing = previews_find_missing(req->file_key, result.missing & PREVIEW_COVERS_MASK);
+            if (missing && missing->listing != listing)
+            {
+                // Covers were added or removed since, what we knew about this file no longer holds
+                missing->missing = 0;
+                missing->listing = listing;
+                previews.missing_dirty = true;
+            }
+            if (missing && (missing->missing | (result.missing & PREVIEW_COVERS_MASK)) != missing->missing)
+            {
+                missing->missing |= result.missing & PREVIEW_COVERS_MASK;
+                previews.missing_dirty = true;
+            }
+        }
+        else
+        {
+            rg_surface_free(result.image);
+        }
+        rg_mutex_give(previews.lock);
+    }
+}
+
+static bool previews_init(void)
+{
+    if (previews.lock)
+        return true;
+
+    // A preview can easily take 100KB, keep it reasonable on devices without PSRAM
+    bool big_memory = rg_system_get_app()->availableMemory >= 0x600000;
+    previews.cache_size = big_memory ? 32 : PREVIEW_QUEUE_SIZE;
+    previews.cache = calloc(previews.cache_size, sizeof(preview_t));
+    previews.missing_mask = 0x7FF; // It grows as needed
+
+    void *data = NULL;
+    size_t data_len = 0;
+    if (rg_storage_read_file(PREVIEW_MISSING_PATH, &data, &data_len, 0))
+    {
+        const uint32_t *header = data;
+        if (data_len >= 8 && header[0] == PREVIEW_MISSING_MAGIC && ((header[1] + 1) & header[1]) == 0
+            && data_len == 8 + (header[1] + 1) * sizeof(preview_missing_t))
+        {
+            previews.missing_mask = header[1];
+            previews.missing = malloc(data_len - 8);
+            if (previews.missing)
+            {
+                memcpy(previews.missing, header + 2, data_len - 8);
+                for (size_t i = 0; i <= previews.missing_mask; i++)
+                    previews.missing_count += previews.missing[i].key != 0;
+            }
+        }
+        free(data);
+    }
+    if (!previews.missing)
+        previews.missing = calloc(previews.missing_mask + 1, sizeof(*previews.missing));
+
+    if (!previews.cache || !previews.missing)
+    {
+        RG_LOGE("Failed to allocate preview cache!");
+        free(previews.cache);
+        free(previews.missing);
+        return false;
+    }
+
+    previews.lock = rg_mutex_create();
+    previews.wakeup = rg_semaphore_create();
+    previews.task = rg_task_create("gui_preview", &preview_task, NULL, 8 * 1024, RG_TASK_PRIORITY_2, -1);
+    return true;
+}
+
+static uint32_t preview_calc_key(const retro_file_t *file)
+{
+    char path[RG_PATH_MAX + 1];
+    size_t path_len = snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
+    return rg_hash(path, path_len) ?: 1; // 0 is the free key in our tables
+}
+
+void gui_load_preview(tab_t *tab)
+{
+    listbox_item_t *item = gui_get_selected_item(tab);
+    bool show_missing_cover = false;
+    uint32_t order;
+
+    gui_set_preview(tab, NULL);
+    tab->preview_pending = false;
+
+    if (!item || !item->arg || !previews_init())
+        return;
+
+    switch (gui.show_preview)
+    {
+        case PREVIEW_MODE_COVER_SAVE:
+            show_missing_cover = true;
+            order = 0x4123;
+            break;
+        case PREVIEW_MODE_SAVE_COVER:
+            show_missing_cover = true;
+            order = 0x1234;
+            break;
+        case PREVIEW_MODE_COVER_ONLY:
+            show_missing_cover = true;
+            order = 0x0123;
+            break;
+        case PREVIEW_MODE_SAVE_ONLY:
+            show_missing_cover = false;
+            order = 0x0004;
+            break;
+        default:
+            show_missing_cover = false;
+            order = 0x0000;
+    }
+
+    if (!order)
+        return;
+
+    retro_file_t *file = item->arg;
+    uint32_t key = preview_calc_key(file);
+    preview_t found = {0};
+
+    rg_mutex_take(previews.lock, -1);
+
+    for (size_t i = 0; i < previews.cache_size && !found.key; i++)
+    {
+        if (previews.cache[i].key == (key ^ order))
+        {
+            previews.cache[i].last_used = ++previews.clock;
+            found = previews.cache[i];
+            // Must be done while locked, so that the preview task doesn't evict it
+            gui_set_preview(tab, found.image);
         }
+    }
+    tab->preview_pending = !found.key;
+
+    if (!found.key && previews.loading != (key ^ order))
+    {
+        // Replace whatever was queued, it's no longer relevant. The selected item comes first.
+        previews.queue_count = 0;
+        for (int i = 0; i < PREVIEW_QUEUE_SIZE; i++)
+        {
+            int index = tab->listbox.cursor + ((i & 1) ? (i + 1) / 2 : -(i / 2));
+            if (index < 0 || index >= tab->listbox.length || !tab->listbox.items[index].arg)
+                continue;
+
+            retro_file_t *file = tab->listbox.items[index].arg;
+            uint32_t key = preview_calc_key(file);
+            bool cached = previews.loading == (key ^ order);
+            for (size_t j = 0; j < previews.cache_size && !cached; j++)
+                cached = previews.cache[j].key == (key ^ order);
+            if (cached)
+                continue;
+
+            preview_missing_t *missing = previews_find_missing(key, false);
+            if (missing && missing->listing == __atomic_load_n(&file->app->covers_listing, __ATOMIC_RELAXED))
+                file->missing_cover |= missing->missing;
+
+            preview_request_t *req = &previews.queue[previews.queue_count++];
+            req->key = key ^ order;
+            req->file_key = key;
+            req->order = order;
+            req->file = *file;
+            req->prefetch = i > 0;
+            req->cached_crc = 0;
+            if (!file->checksum && file->app->use_crc_covers)
+                req->cached_crc = application_peek_file_crc32(file, &req->cached_size, &req->cached_mtime);
+            snprintf(req->name, sizeof(req->name), "%s", file->name);
+            snprintf(req->folder, sizeof(req->folder), "%s", file->folder);
+        }
+        if (previews.queue_count > 0)
+            rg_semaphore_give(previews.wakeup);
+    }
+
+    rg_mutex_give(previews.lock);
 
-        file->missing_cover |= (tab->preview ? 0 : 1) << type;
+    if (found.key)
+    {
+        file->missing_cover |= found.missing;
+        if (found.checksum && !file->checksum)
+        {
+            file->size = found.size;
+            file->mtime = found.mtime;
+            if (found.checksum_cached)
+                file->checksum = found.checksum;
+            else
+                application_set_file_crc32(file, found.checksum);
+        }
     }
 
-    if (!tab->preview && file->checksum && (show_missing_cover || errors))
+    if (found.key && !found.image && file->checksum && show_missing_cover)
     {
         RG_LOGI("No image found for '%s'\n", file->name);
-        gui_set_status(tab, NULL, errors ? "Bad cover" : "No cover");
+        gui_set_status(tab, NULL, "No cover");
         // gui_draw_status(tab);
         // tab->preview = gui_get_image("cover", file->app);
     }
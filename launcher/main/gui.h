@@ -78,6 +78,7 @@ typedef struct {
     int length;
     int cursor;
     int sort_mode;
+    int sorted; // The order the items are already in, if known
 } listbox_t;
 
 typedef struct {
@@ -110,6 +111,7 @@ typedef struct tab_s {
     rg_image_t *banner;
     rg_image_t *logo;
     rg_image_t *preview;
+    bool preview_pending; // gui_load_preview is waiting on the preview task, it must be called again
     int background_shade;
     gui_event_handler_t event_handler;
 } tab_t;
@@ -52,6 +52,13 @@ void gnuboy_set_framebuffer(void *buffer)
 }
 
 
+// The damage buffer belongs to the current framebuffer and must be updated along with it
+void gnuboy_set_damagebuffer(uint8_t *damage)
+{
+	GB.video.damage = damage;
+}
+
+
 void gnuboy_set_soundbuffer(void *buffer, size_t length)
 {
 	GB.audio.buffer = buffer;
@@ -101,6 +108,8 @@ void gnuboy_run(bool draw)
 	   because the palette can be modified below before gnuboy_run returns. */
 	if (draw && GB.video.callback) {
 		(GB.video.callback)(GB.video.buffer);
+		// Damage is relative to what's on screen, so only a submitted frame can be the reference
+		GB.video.prev_buffer = GB.video.buffer;
 	}
 
 	gb_hw_vblank();
@@ -174,37 +183,192 @@ int gnuboy_load_bios_file(const char *file)
 }
 
 
-void gnuboy_load_bank(int bank)
+/*
+ * ROM bank cache. When the ROM is read from a file we allocate 16K banks on demand and, once
+ * we reach the budget (or run out of memory), recycle the least recently mapped one. Bank 0
+ * and the currently mapped bank are never evicted.
+ * We also remember which bank followed each bank the last time it was mapped, which lets
+ * the host prefetch the likely next bank during idle time instead of stalling on the switch.
+ */
+static struct
 {
-	const size_t OFFSET = bank * BANK_SIZE;
+	uint32_t *last_used; // Clock value of the last time each bank was mapped
+	uint16_t *next;      // Bank that was mapped after this one, last time
+	uint32_t clock;
+	int current;
+	int budget;
+	bool replay; // Frames being replayed (run-ahead) must not skew the history and stats
+	gb_bank_stats_t stats;
+} banks;
 
-	if (!cart.rombanks[bank])
-		cart.rombanks[bank] = malloc(BANK_SIZE);
+#define PREFETCH_MIN_AGE 64 // A prefetch won't evict a bank mapped within that many switches
+#define NO_BANK 0xFFFF
 
-	if (!cart.romFile)
-		return;
 
-	MESSAGE_INFO("loading bank %d.\n", bank);
-	while (!cart.rombanks[bank])
+static void bank_cache_init(void)
+{
+	free(banks.last_used);
+	free(banks.next);
+	banks.last_used = calloc(cart.romsize, sizeof(*banks.last_used));
+	banks.next = malloc(cart.romsize * sizeof(*banks.next));
+	banks.clock = 0;
+	banks.current = 0;
+	banks.stats = (gb_bank_stats_t){0};
+	if (banks.next)
+		memset(banks.next, 0xFF, cart.romsize * sizeof(*banks.next));
+}
+
+
+static byte *bank_cache_alloc(int bank, bool prefetch)
+{
+	byte *buffer = NULL;
+
+	if (!banks.budget || banks.stats.loaded < banks.budget)
+		buffer = malloc(BANK_SIZE);
+
+	if (buffer)
 	{
-		int i = rand() & 0xFF;
-		if (cart.rombanks[i])
-		{
-			MESSAGE_INFO("reclaiming bank %d.\n", i);
-			cart.rombanks[bank] = cart.rombanks[i];
-			cart.rombanks[i] = NULL;
-			break;
-		}
+		banks.stats.loaded++;
+		return buffer;
+	}
+
+	int victim = -1;
+	for (int i = 1; i < cart.romsize && banks.last_used; i++)
+	{
+		if (!cart.rombanks[i] || i == bank || i == banks.current)
+			continue;
+		if (victim < 0 || banks.last_used[i] < banks.last_used[victim])
+			victim = i;
 	}
 
+	if (victim < 0 || (prefetch && banks.clock - banks.last_used[victim] < PREFETCH_MIN_AGE))
+		return NULL;
+
+	MESSAGE_INFO("reclaiming bank %d.\n", victim);
+	buffer = cart.rombanks[victim];
+	cart.rombanks[victim] = NULL;
+	banks.stats.evictions++;
+	return buffer;
+}
+
+
+static bool bank_cache_load(int bank, bool prefetch)
+{
+	const size_t OFFSET = bank * BANK_SIZE;
+
+	if (!cart.rombanks[bank] && !(cart.rombanks[bank] = bank_cache_alloc(bank, prefetch)))
+		return false;
+
 	// Load the 16K page
-	if (fseek(cart.romFile, OFFSET, SEEK_SET) != 0
+	if (cart.romReader)
+	{
+		if (cart.romReader(cart.rombanks[bank], OFFSET, BANK_SIZE) != BANK_SIZE)
+			MESSAGE_WARN("ROM bank loading failed\n");
+	}
+	else if (fseek(cart.romFile, OFFSET, SEEK_SET) != 0
 		|| !fread(cart.rombanks[bank], BANK_SIZE, 1, cart.romFile))
 	{
 		MESSAGE_WARN("ROM bank loading failed\n");
 		if (!feof(cart.romFile))
 			abort(); // This indicates an SD Card failure
 	}
+
+	if (banks.last_used)
+		banks.last_used[bank] = banks.clock;
+
+	return true;
+}
+
+
+void gnuboy_load_bank(int bank)
+{
+	if (!cart.romFile && !cart.romReader)
+	{
+		if (!cart.rombanks[bank])
+			cart.rombanks[bank] = malloc(BANK_SIZE);
+		return;
+	}
+
+	MESSAGE_INFO("loading bank %d.\n", bank);
+	if (!bank_cache_load(bank, false))
+	{
+		MESSAGE_ERROR("No memory for bank %d!\n", bank);
+		abort();
+	}
+}
+
+
+/*
+ * Called by gb_hw_updatemap to make sure the bank is resident before it's mapped,
+ * it also feeds the LRU clock and the switch history.
+ */
+void gnuboy_select_bank(int bank)
+{
+	if (bank == banks.current && cart.rombanks[bank])
+		return;
+
+	if (!cart.rombanks[bank])
+	{
+		if (!banks.replay)
+			banks.stats.misses++;
+		gnuboy_load_bank(bank);
+	}
+	else if (!banks.replay)
+	{
+		banks.stats.hits++;
+	}
+
+	if (banks.last_used && banks.next)
+	{
+		if (!banks.replay)
+			banks.next[banks.current] = bank;
+		banks.last_used[bank] = ++banks.clock;
+	}
+
+	banks.current = bank;
+}
+
+
+int gnuboy_prefetch_bank(void)
+{
+	// Streamed ROMs (zip) may have to inflate a lot of data to reach a bank, that doesn't fit
+	// in a frame's spare time. Only plain files are prefetched, a 16K read is cheap and bounded.
+	if (!banks.next || !cart.romFile)
+		return -1;
+
+	int bank = banks.next[banks.current];
+	if (bank == NO_BANK || bank >= cart.romsize || cart.rombanks[bank])
+		return -1;
+
+	if (!bank_cache_load(bank, true))
+		return -1;
+
+	MESSAGE_INFO("prefetched bank %d.\n", bank);
+	banks.stats.prefetches++;
+	return bank;
+}
+
+
+void gnuboy_set_bank_budget(size_t bytes)
+{
+	banks.budget = bytes / BANK_SIZE;
+}
+
+
+/*
+ * While set, bank switches still page banks in but are not recorded in the history or the
+ * hit/miss stats. The host sets it around run-ahead replays, including the state reload.
+ */
+void gnuboy_set_bank_replay(bool replay)
+{
+	banks.replay = replay;
+}
+
+
+void gnuboy_get_bank_stats(gb_bank_stats_t *out)
+{
+	*out = banks.stats;
+	out->budget = banks.budget;
 }
 
 
@@ -405,6 +569,32 @@ int gnuboy_load_rom(const byte *data, size_t size)
 }
 
 
+static void preload_banks(void)
+{
+	// Gameboy color games can be very large so we preload a maximum of 128 banks for faster boot
+	// Also 4/8MB games do not fully fit anyway, we need to leave room for our bank manager's swapping.
+
+	int preload = cart.romsize < 128 ? cart.romsize : 128;
+
+	bank_cache_init();
+
+	if (cart.romsize > 64 && (strncmp(cart.name, "RAYMAN", 6) == 0 || strncmp(cart.name, "NONAME", 6) == 0))
+	{
+		MESSAGE_INFO("Special preloading for Rayman 1/2\n");
+		preload = cart.romsize - 40;
+	}
+
+	if (banks.budget && preload > banks.budget)
+		preload = banks.budget;
+
+	MESSAGE_INFO("Preloading the first %d banks\n", preload);
+	for (int i = 0; i < preload; i++)
+	{
+		gnuboy_load_bank(i);
+	}
+}
+
+
 int gnuboy_load_rom_file(const char *file)
 {
 	MESSAGE_INFO("Loading file: '%s'\n", file);
@@ -433,31 +623,42 @@ int gnuboy_load_rom_file(const char *file)
 		return ret;
 	}
 
-	// Gameboy color games can be very large so we preload a maximum of 128 banks for faster boot
-	// Also 4/8MB games do not fully fit anyway, we need to leave room for our bank manager's swapping.
+	preload_banks();
 
-	int preload = cart.romsize < 128 ? cart.romsize : 128;
+	return 0;
+}
 
-	if (cart.romsize > 64 && (strncmp(cart.name, "RAYMAN", 6) == 0 || strncmp(cart.name, "NONAME", 6) == 0))
+
+int gnuboy_load_rom_stream(gb_rom_cb_t *read_callback)
+{
+	MESSAGE_INFO("Loading ROM through callback\n");
+
+	byte header[0x200];
+
+	if (!read_callback || read_callback(header, 0, 0x200) != 0x200)
 	{
-		MESSAGE_INFO("Special preloading for Rayman 1/2\n");
-		preload = cart.romsize - 40;
+		MESSAGE_ERROR("ROM header read failed\n");
+		return -1;
 	}
 
-	MESSAGE_INFO("Preloading the first %d banks\n", preload);
-	for (int i = 0; i < preload; i++)
+	int ret = gnuboy_load_rom(header, 0x200);
+	if (ret != 0)
 	{
-		gnuboy_load_bank(i);
+		MESSAGE_ERROR("ROM setup failed\n");
+		return ret;
 	}
 
+	cart.romReader = read_callback;
+	preload_banks();
+
 	return 0;
 }
 
 
 void gnuboy_free_rom(void)
 {
-	// If cart.romFile isn't NULL it indicates that we haven't allocated those buffers, don't free them.
-	if (cart.romFile && cart.rombanks)
+	// If cart.romFile/romReader isn't NULL it indicates that we allocated those buffers, free them.
+	if ((cart.romFile || cart.romReader) && cart.rombanks)
 	{
 		for (int i = 0; i < cart.romsize; i++)
 			free(cart.rombanks[i]);
@@ -466,6 +667,14 @@ void gnuboy_free_rom(void)
 	free(cart.rombanks);
 	cart.rombanks = NULL;
 
+	MESSAGE_INFO("Bank cache: %d loaded, %d hits, %d misses, %d evictions, %d prefetches\n",
+		banks.stats.loaded, banks.stats.hits, banks.stats.misses, banks.stats.evictions, banks.stats.prefetches);
+	free(banks.last_used);
+	free(banks.next);
+	banks.last_used = NULL;
+	banks.next = NULL;
+	banks.stats = (gb_bank_stats_t){0};
+
 	free(cart.rambanks);
 	cart.rambanks = NULL;
 
@@ -700,7 +909,11 @@ typedef struct
 } sblock_t;
 
 
-static int do_save_load(const char *file, bool save)
+/**
+ * When `file` is NULL the state is transferred to/from `mem` instead. In that case the
+ * return value is the number of bytes used (or needed, if `mem` is NULL) rather than 0.
+ */
+static int do_save_load(const char *file, void *mem, size_t mem_size, bool save)
 {
 	uint32_t sav_ver = SAVE_VERSION;
 	const svar_t svars[] =
@@ -785,11 +998,22 @@ static int do_save_load(const char *file, bool save)
 		{NULL, 0},
 	};
 
+	size_t total_size = 0;
+	for (int i = 0; blocks[i].ptr != NULL; i++)
+		total_size += blocks[i].len * 4096;
+
+	byte *mem_ptr = mem;
 	FILE *fp = NULL;
 
+	if (!file && (!mem || mem_size < total_size))
+	{
+		free(buf);
+		return mem ? -1 : (int)total_size;
+	}
+
 	if (save)
 	{
-		if (!(fp = fopen(file, "wb")))
+		if (file && !(fp = fopen(file, "wb")))
 			goto _error;
 
 		for (int i = 0; svars[i].ptr; i++)
@@ -820,7 +1044,12 @@ static int do_save_load(const char *file, bool save)
 
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (!fp)
+			{
+				memcpy(mem_ptr, blocks[i].ptr, blocks[i].len * 4096);
+				mem_ptr += blocks[i].len * 4096;
+			}
+			else if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
 			{
 				MESSAGE_ERROR("Write error in block %d\n", i);
 				goto _error;
@@ -829,12 +1058,17 @@ static int do_save_load(const char *file, bool save)
 	}
 	else
 	{
-		if (!(fp = fopen(file, "rb")))
+		if (file && !(fp = fopen(file, "rb")))
 			goto _error;
 
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (!fp)
+			{
+				memcpy(blocks[i].ptr, mem_ptr, blocks[i].len * 4096);
+				mem_ptr += blocks[i].len * 4096;
+			}
+			else if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
 			{
 				MESSAGE_ERROR("Read error in block %d\n", i);
 				goto _error;
@@ -887,10 +1121,10 @@ static int do_save_load(const char *file, bool save)
 		gb_hw_updatemap();
 	}
 
-	fclose(fp);
+	if (fp) fclose(fp);
 	free(buf);
 
-	return 0;
+	return fp ? 0 : (int)total_size;
 
 _error:
 	if (fp) fclose(fp);
@@ -902,11 +1136,118 @@ _error:
 
 int gnuboy_save_state(const char *file)
 {
-	return do_save_load(file, true);
+	return do_save_load(file, NULL, 0, true);
 }
 
 
 int gnuboy_load_state(const char *file)
 {
-	return do_save_load(file, false);
+	return do_save_load(file, NULL, 0, false);
+}
+
+
+int gnuboy_save_state_mem(void *buffer, size_t size)
+{
+	return do_save_load(NULL, buffer, size, true);
+}
+
+
+int gnuboy_load_state_mem(const void *buffer, size_t size)
+{
+	return do_save_load(NULL, (void *)buffer, size, false);
+}
+
+
+/**
+ * Snapshots are a raw copy of the machine for run-ahead. Unlike save states nothing is
+ * re-derived from the I/O registers on load (sound lengths and envelopes, BIOS mapping),
+ * only the memory map and the host palette which are caches. They aren't portable.
+ */
+typedef struct
+{
+	gb_cpu_t cpu;
+	gb_snd_t snd;
+	gb_rtc_t rtc;
+	int cycles, ilines, pad, serial, hdma, frames;
+	int bankmode, enableram, rombank, rambank;
+	int lcd_wy;
+	byte ioregs[256];
+	byte oam[256];
+	byte pal[128];
+} snapshot_t;
+
+static int do_snapshot(byte *mem, size_t mem_size, bool save)
+{
+	sblock_t blocks[] = {
+		{hw.rambanks, (IS_CGB ? 8 : 2) * 4096},
+		{hw.vbanks, (IS_CGB ? 2 : 1) * 8192},
+		{cart.rambanks, cart.ramsize * 8192},
+		{NULL, 0},
+	};
+
+	size_t total_size = sizeof(snapshot_t);
+	for (int i = 0; blocks[i].ptr != NULL; i++)
+		total_size += blocks[i].len;
+
+	if (!mem || mem_size < total_size)
+		return mem ? -1 : (int)total_size;
+
+	snapshot_t *snap = (snapshot_t *)mem;
+	byte *ptr = mem + sizeof(snapshot_t);
+
+	if (save)
+	{
+		*snap = (snapshot_t){
+			.cpu = *hw.cpu, .snd = *hw.snd, .rtc = cart.rtc,
+			.cycles = hw.cycles, .ilines = hw.ilines, .pad = hw.pad,
+			.serial = hw.serial, .hdma = hw.hdma, .frames = hw.frames,
+			.bankmode = cart.bankmode, .enableram = cart.enableram,
+			.rombank = cart.rombank, .rambank = cart.rambank,
+			.lcd_wy = gb_lcd_get_wy(),
+		};
+		memcpy(snap->ioregs, hw.ioregs, 256);
+		memcpy(snap->oam, hw.oam, 256);
+		memcpy(snap->pal, hw.pal, 128);
+		for (int i = 0; blocks[i].ptr != NULL; ptr += blocks[i++].len)
+			memcpy(ptr, blocks[i].ptr, blocks[i].len);
+	}
+	else
+	{
+		*hw.cpu = snap->cpu;
+		*hw.snd = snap->snd;
+		cart.rtc = snap->rtc;
+		hw.cycles = snap->cycles;
+		hw.ilines = snap->ilines;
+		hw.pad = snap->pad;
+		hw.serial = snap->serial;
+		hw.hdma = snap->hdma;
+		hw.frames = snap->frames;
+		cart.bankmode = snap->bankmode;
+		cart.enableram = snap->enableram;
+		cart.rombank = snap->rombank;
+		cart.rambank = snap->rambank;
+		gb_lcd_set_wy(snap->lcd_wy);
+		memcpy(hw.ioregs, snap->ioregs, 256);
+		memcpy(hw.oam, snap->oam, 256);
+		memcpy(hw.pal, snap->pal, 128);
+		for (int i = 0; blocks[i].ptr != NULL; ptr += blocks[i++].len)
+			memcpy(blocks[i].ptr, ptr, blocks[i].len);
+
+		gb_lcd_pal_dirty();
+		gb_hw_updatemap();
+	}
+
+	return (int)total_size;
+}
+
+
+int gnuboy_save_snapshot(void *buffer, size_t size)
+{
+	return do_snapshot(buffer, size, true);
+}
+
+
+int gnuboy_load_snapshot(const void *buffer, size_t size)
+{
+	return do_snapshot((void *)buffer, size, false);
 }
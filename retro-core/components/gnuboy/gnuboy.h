@@ -99,6 +99,13 @@ typedef enum
 
 typedef void (gb_video_cb_t)(void *buffer);
 typedef void (gb_audio_cb_t)(void *buffer, size_t length);
+typedef size_t (gb_rom_cb_t)(void *buffer, size_t offset, size_t length);
+
+typedef struct
+{
+	int loaded, budget; // In banks
+	int hits, misses, evictions, prefetches;
+} gb_bank_stats_t;
 
 int  gnuboy_init(int samplerate, gb_audio_fmt_t audio_fmt, gb_video_fmt_t video_fmt, gb_video_cb_t *video_callback, gb_audio_cb_t *audio_callback);
 int  gnuboy_load_bios(const byte *data, size_t size);
@@ -106,14 +113,21 @@ int  gnuboy_load_bios_file(const char *file);
 void gnuboy_free_bios(void);
 int  gnuboy_load_rom(const byte *data, size_t size);
 int  gnuboy_load_rom_file(const char *file);
+int  gnuboy_load_rom_stream(gb_rom_cb_t *read_callback);
 void gnuboy_free_rom(void);
 void gnuboy_reset(bool hard);
 void gnuboy_run(bool draw);
 bool gnuboy_sram_dirty(void);
 void gnuboy_load_bank(int);
+void gnuboy_select_bank(int);
+int  gnuboy_prefetch_bank(void);
+void gnuboy_set_bank_budget(size_t bytes);
+void gnuboy_set_bank_replay(bool replay);
+void gnuboy_get_bank_stats(gb_bank_stats_t *out);
 void gnuboy_set_pad(int);
 
 void gnuboy_set_framebuffer(void *buffer);
+void gnuboy_set_damagebuffer(uint8_t *damage);
 void gnuboy_set_soundbuffer(void *buffer, size_t length);
 
 void gnuboy_get_time(int *day, int *hour, int *minute, int *second);
@@ -127,3 +141,7 @@ int gnuboy_load_sram(const char *file);
 int gnuboy_save_sram(const char *file, bool quick_save);
 int gnuboy_load_state(const char *file);
 int gnuboy_save_state(const char *file);
+int gnuboy_load_state_mem(const void *buffer, size_t size);
+int gnuboy_save_state_mem(void *buffer, size_t size);
+int gnuboy_load_snapshot(const void *buffer, size_t size);
+int gnuboy_save_snapshot(void *buffer, size_t size);
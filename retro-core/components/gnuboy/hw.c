@@ -288,7 +288,11 @@ void gb_hw_updatemap(void)
 {
 	int rombank = cart.rombank & (cart.romsize - 1);
 
-	if (cart.rombanks[rombank] == NULL)
+	if (cart.romFile || cart.romReader)
+	{
+		gnuboy_select_bank(rombank);
+	}
+	else if (cart.rombanks[rombank] == NULL)
 	{
 		gnuboy_load_bank(rombank);
 	}
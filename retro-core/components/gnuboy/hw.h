@@ -203,6 +203,9 @@ typedef struct
 	// File descriptors that we keep open
 	FILE *romFile;
 	FILE *sramFile;
+
+	// Alternative to romFile, banks are read through the host (eg from a zip file)
+	gb_rom_cb_t *romReader;
 } gb_cart_t;
 
 typedef struct
@@ -241,6 +244,8 @@ typedef struct
 			uint8_t *buffer8;
 			void *buffer;
 		};
+		void *prev_buffer;	// Last framebuffer passed to the video callback, used to detect changed lines
+		uint8_t *damage;	// Lines that differ from prev_buffer are flagged here
 		uint16_t palette[64];
 	} video;
 
@@ -544,6 +544,19 @@ void gb_lcd_lcdc_change(byte b)
 }
 
 
+// The window line is latched when the LCD is turned on and isn't part of the I/O registers
+int gb_lcd_get_wy(void)
+{
+	return WY;
+}
+
+
+void gb_lcd_set_wy(int wy)
+{
+	WY = wy;
+}
+
+
 static inline void sync_palette(void)
 {
 	MESSAGE_DEBUG("Syncing palette...\n");
@@ -690,9 +703,12 @@ static inline void lcd_renderline()
 		sync_palette();
 	}
 
+	size_t line_size;
+
 	if (host.video.format == GB_PIXEL_PALETTED)
 	{
 		memcpy(host.video.buffer8 + SL * 160 , BUF, 160);
+		line_size = 160;
 	}
 	else
 	{
@@ -701,6 +717,15 @@ static inline void lcd_renderline()
 
 		for (int i = 0; i < 160; ++i)
 			dst[i] = pal[BUF[i]];
+		line_size = 160 * 2;
+	}
+
+	if (host.video.damage)
+	{
+		byte *prev = host.video.prev_buffer;
+		byte *line = host.video.buffer;
+		if (!prev || prev == line || memcmp(line + SL * line_size, prev + SL * line_size, line_size))
+			host.video.damage[SL] = 1;
 	}
 }
 
@@ -8,3 +8,5 @@ void gb_lcd_emulate(int cycles);
 void gb_lcd_stat_trigger(void);
 void gb_lcd_lcdc_change(byte b);
 void gb_lcd_pal_dirty(void);
+int  gb_lcd_get_wy(void);
+void gb_lcd_set_wy(int wy);
@@ -7,6 +7,9 @@
 /* Uncomment to enable live dissassembler */
 // #define NES6502_DISASM
 
+/* Uncomment to use threaded (computed goto) dispatch in the 6502 core */
+// #define NES6502_JUMPTABLE
+
 /* Uncomment to save/load a game's SRAM to disk */
 // #define USE_SRAM_FILE
 
@@ -26,7 +26,6 @@
 /* internal CPU context */
 static nes6502_t cpu;
 
-// #define NES6502_JUMPTABLE
 #define NES6502_FASTMEM
 
 
@@ -1051,8 +1050,21 @@ static nes6502_t cpu;
 #endif
 
 #define readword(a) mem_getword(a)
+
+#ifdef NES6502_FASTMEM
+
+/* Plain memory pages are read directly, only pages with handlers go through mem_getbyte */
+#define PAGE_IS_MEMORY(flags) \
+   (((flags) & (MEM_PAGE_HAS_MEMORY | MEM_PAGE_HAS_READ_HANDLER)) == MEM_PAGE_HAS_MEMORY)
+#define readbyte(a) ({uint16 _a = (a); PAGE_IS_MEMORY(cpu.page_flags[_a >> MEM_PAGESHIFT]) \
+   ? cpu.pages[_a >> MEM_PAGESHIFT][_a] : mem_getbyte(_a);})
+
+#else /* !NES6502_FASTMEM */
+
 #define readbyte(a) mem_getbyte(a)
 
+#endif /* !NES6502_FASTMEM */
+
 /*
 ** Middle man for faster albeit unsafe/inaccurate/unchecked memory access.
 ** Used only when address = PC, which is always a valid ROM access (in theory)
@@ -1062,7 +1074,9 @@ static nes6502_t cpu;
 
 #define fast_readbyte(a) ({uint16 _a = (a); cpu.pages[_a >> MEM_PAGESHIFT][_a];})
 #define fast_readword(a) ({uint16 _a = (a); ((_a & MEM_PAGEMASK) != MEM_PAGEMASK) ? PAGE_READWORD(cpu.pages[_a >> MEM_PAGESHIFT], _a) : mem_getword(_a);})
-#define writebyte(a, v)  {uint16 _a = (a), _v = (v); if (_a < 0x2000) cpu.pages[0][_a & 0x7FF] = _v; else mem_putbyte(_a, _v);}
+#define writebyte(a, v)  {uint16 _a = (a), _v = (v); if (_a < 0x2000) cpu.pages[0][_a & 0x7FF] = _v; \
+   else if ((cpu.page_flags[_a >> MEM_PAGESHIFT] & (MEM_PAGE_HAS_MEMORY | MEM_PAGE_HAS_WRITE_HANDLER)) \
+      == MEM_PAGE_HAS_MEMORY) cpu.pages[_a >> MEM_PAGESHIFT][_a] = _v; else mem_putbyte(_a, _v);}
 
 #else /* !NES6502_FASTMEM */
 
@@ -1531,10 +1545,11 @@ void nes6502_reset(void)
 }
 
 /* Create a nes6502 object */
-nes6502_t *nes6502_init(uint8 **memmap)
+nes6502_t *nes6502_init(uint8 **memmap, uint32 *page_flags)
 {
    memset(&cpu, 0, sizeof(nes6502_t));
    cpu.pages = memmap;
+   cpu.page_flags = page_flags;
 
    return &cpu;
 }
@@ -58,6 +58,7 @@ typedef struct
 
    uint8 *zp, *stack;
    uint8 **pages;
+   uint32 *page_flags;
 
    bool int_pending;
    bool jammed;
@@ -74,7 +75,7 @@ void nes6502_irq_clear(void);
 uint32 nes6502_getcycles(void);
 void nes6502_burn(int cycles);
 
-nes6502_t *nes6502_init(uint8 **memmap);
+nes6502_t *nes6502_init(uint8 **memmap, uint32 *page_flags);
 void nes6502_reset(void);
 void nes6502_shutdown(void);
 
@@ -142,6 +142,9 @@ void mmc_reset(void)
    /* The mapper's init will undo all we've just done, oh well :) */
    if (mapper.init)
       mapper.init(cart);
+
+   /* Some mappers write to CHR-RAM directly */
+   ppu_invalidate_tiles();
 }
 
 void mmc_shutdown()
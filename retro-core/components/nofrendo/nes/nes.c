@@ -42,6 +42,14 @@ void nes_emulate(bool draw)
 
         ppu_renderline(nes.vidbuf, nes.scanline, draw);
 
+        if (draw && nes.damage && nes.scanline < NES_SCREEN_HEIGHT)
+        {
+            if (!nes.vidbuf_prev || nes.vidbuf_prev == nes.vidbuf ||
+                memcmp(NES_SCREEN_GETPTR(nes.vidbuf, 0, nes.scanline),
+                       NES_SCREEN_GETPTR(nes.vidbuf_prev, 0, nes.scanline), NES_SCREEN_WIDTH))
+                nes.damage[nes.scanline] = 1;
+        }
+
         if (nes.scanline == 241)
         {
             elapsed_cycles += nes6502_execute(6);
@@ -73,18 +81,31 @@ void nes_emulate(bool draw)
     nes.scanline = 0;
 
     if (draw && nes.blit_func)
+    {
+        RG_TIMER_BEGIN(RG_TIMER_PRESENT);
         nes.blit_func(nes.vidbuf);
+        RG_TIMER_END(RG_TIMER_PRESENT);
+    }
 
+    RG_TIMER_BEGIN(RG_TIMER_AUDIO);
     apu_emulate();
+    RG_TIMER_END(RG_TIMER_AUDIO);
 }
 
 uint8 *nes_setvidbuf(uint8 *vidbuf)
 {
     uint8 *prevbuf = nes.vidbuf;
+    nes.vidbuf_prev = prevbuf;
     nes.vidbuf = vidbuf;
     return prevbuf;
 }
 
+/* The damage buffer belongs to the current vidbuf and must be updated along with it */
+void nes_setdamagebuf(uint8 *damage)
+{
+    nes.damage = damage;
+}
+
 /* This sets a timer to be fired every `period` cpu cycles. It is NOT accurate. */
 void nes_settimer(nes_timer_t *func, int period)
 {
@@ -201,6 +222,7 @@ void nes_reset(bool hard_reset)
     nes6502_reset();
 
     nes.vidbuf = NULL;
+    nes.vidbuf_prev = NULL;
     nes.scanline = 241;
     nes.cycles = 0;
 
@@ -235,7 +257,7 @@ nes_t *nes_init(nes_type_t system, int sample_rate, bool stereo, const char *fds
         goto _fail;
 
     /* cpu */
-    nes.cpu = nes6502_init(nes.mem->pages);
+    nes.cpu = nes6502_init(nes.mem->pages, nes.mem->flags);
     if (NULL == nes.cpu)
         goto _fail;
 
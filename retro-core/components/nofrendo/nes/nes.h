@@ -88,6 +88,8 @@ typedef struct nes_s
 
     /* Video buffer */
     uint8 *vidbuf; // [NES_SCREEN_PITCH * NES_SCREEN_HEIGHT]
+    uint8 *vidbuf_prev; // Previous vidbuf, used to detect changed lines
+    uint8 *damage; // [NES_SCREEN_HEIGHT] Lines that differ from vidbuf_prev are flagged here
 
     /* Misc */
     nes_type_t system;
@@ -115,6 +117,7 @@ typedef struct nes_s
 nes_t *nes_getptr(void);
 nes_t *nes_init(nes_type_t system, int sample_rate, bool stereo, const char *fds_bios);
 uint8 *nes_setvidbuf(uint8 *vidbuf);
+void nes_setdamagebuf(uint8 *damage);
 void nes_shutdown(void);
 int nes_insertcart(rom_t *cart);
 int nes_loadfile(const char *filename);
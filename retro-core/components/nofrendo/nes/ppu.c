@@ -53,6 +53,18 @@ static const uint8 mirroring_maps[][4] = {
 /* the NES PPU */
 static ppu_t ppu;
 
+/* Pattern tables pre-decoded to one color index (0-3) per byte, for each of the 8 CHR pages.
+** A page is tagged with the memory it was decoded from and its tiles are decoded on first use.
+*/
+typedef struct
+{
+   uint8 *source;
+   uint64 valid; /* one bit per tile */
+   uint8 pixels[64][8][8];
+} ppu_tiles_t;
+
+static ppu_tiles_t *tiles;
+
 
 #ifndef PPU_MEM_READ
 INLINE uint8 PPU_MEM_READ(uint32 x)
@@ -83,6 +95,13 @@ void ppu_setpage(uint32 page, uint8 *location)
    }
    ppu.page[page] = location - (page << PPU_PAGESHIFT);
 
+   /* Decoded tiles are only valid for the memory they came from */
+   if (page < 8 && tiles && tiles[page].source != location)
+   {
+      tiles[page].source = location;
+      tiles[page].valid = 0;
+   }
+
    /* Setup mirror if required (8-11 <=> 12-15) */
    if (page >= 12)
       ppu.page[page - 4] = location - ((page - 4) << PPU_PAGESHIFT);
@@ -100,6 +119,25 @@ uint8 *ppu_getpage(uint32 page)
    return ppu.page[page] + (page << PPU_PAGESHIFT);
 }
 
+void ppu_invalidate_tiles(void)
+{
+   for (int page = 0; page < 8 && tiles; page++)
+      tiles[page].valid = 0;
+}
+
+INLINE void invalidate_tile(uint32 address)
+{
+   const uint8 *source = tiles[address >> PPU_PAGESHIFT].source;
+   uint64 mask = ~(1ull << ((address >> 4) & 63));
+
+   /* The same CHR-RAM page may be mapped more than once */
+   for (int page = 0; page < 8; page++)
+   {
+      if (tiles[page].source == source)
+         tiles[page].valid &= mask;
+   }
+}
+
 void ppu_setnametable(uint8 index, uint8 table)
 {
    index &= 3;
@@ -296,6 +334,8 @@ void ppu_write(uint32 address, uint8 value)
             MESSAGE_DEBUG("VRAM write to $%04X, scanline %d\n",
                            ppu.vaddr, nes_getptr()->scanline);
             PPU_MEM_WRITE(ppu.vaddr, 0xFF); /* corrupt */
+            if (ppu.vaddr < 0x2000)
+               invalidate_tile(ppu.vaddr);
          }
          else
          {
@@ -305,6 +345,8 @@ void ppu_write(uint32 address, uint8 value)
                ppu.vaddr -= 0x1000;
 
             PPU_MEM_WRITE(addr, value);
+            if (addr < 0x2000)
+               invalidate_tile(addr);
          }
       }
       else
@@ -357,59 +399,50 @@ void ppu_setvreadfunc(ppu_vreadfunc_t func)
 }
 
 /* rendering routines */
-INLINE uint32 get_patpix(uint32 tile_addr)
+static void decode_tile(ppu_tiles_t *page, uint32 tile, uint32 tile_addr)
 {
-   uint32 pat1 = PPU_MEM_READ(tile_addr);
-   uint32 pat2 = PPU_MEM_READ(tile_addr + 8);
-   return ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
-        | ((pat1 & 0xAA) << 7) | ((pat1 & 0x55) << 0);
+   for (int row = 0; row < 8; row++)
+   {
+      uint32 pat1 = PPU_MEM_READ(tile_addr + row);
+      uint32 pat2 = PPU_MEM_READ(tile_addr + row + 8) << 1;
+      uint8 *pixels = page->pixels[tile][row];
+
+      for (int x = 0; x < 8; x++)
+         pixels[x] = ((pat1 >> (7 - x)) & 1) | ((pat2 >> (7 - x)) & 2);
+   }
+   page->valid |= 1ull << tile;
 }
 
-INLINE void build_tile_colors(bool flip, uint32 pattern, uint8 *colors)
+/* Returns the 8 color indices of a tile row, in display order */
+INLINE const uint8 *get_tile_row(uint32 tile_addr)
 {
-   /* swap pixels around if our tile is flipped */
-   if (flip)
-   {
-      colors[7] = (pattern >> 14) & 3;
-      colors[6] = (pattern >> 6) & 3;
-      colors[5] = (pattern >> 12) & 3;
-      colors[4] = (pattern >> 4) & 3;
-      colors[3] = (pattern >> 10) & 3;
-      colors[2] = (pattern >> 2) & 3;
-      colors[1] = (pattern >> 8) & 3;
-      colors[0] = pattern & 3;
-   }
-   else
-   {
-      colors[0] = (pattern >> 14) & 3;
-      colors[1] = (pattern >> 6) & 3;
-      colors[2] = (pattern >> 12) & 3;
-      colors[3] = (pattern >> 4) & 3;
-      colors[4] = (pattern >> 10) & 3;
-      colors[5] = (pattern >> 2) & 3;
-      colors[6] = (pattern >> 8) & 3;
-      colors[7] = pattern & 3;
-   }
+   ppu_tiles_t *page = &tiles[(tile_addr >> PPU_PAGESHIFT) & 7];
+   uint32 tile = (tile_addr >> 4) & 63;
+
+   if (!(page->valid & (1ull << tile)))
+      decode_tile(page, tile, tile_addr & ~0xF);
+
+   return page->pixels[tile][tile_addr & 7];
+}
+
+/* Same as above but packed for sprites, which need to be tested and flipped */
+INLINE uint64 get_tile_pixels(uint32 tile_addr, bool flip)
+{
+   uint64 pixels;
+   memcpy(&pixels, get_tile_row(tile_addr), 8);
+   return flip ? __builtin_bswap64(pixels) : pixels;
 }
 
 /* we render a scanline of graphics first so we know exactly
 ** where the sprite 0 strike is going to occur (in terms of
 ** cpu cycles), using the relation that 3 pixels == 1 cpu cycle
 */
-INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
+INLINE void check_strike(uint8 *surface, const uint8 *colors)
 {
-   uint8 colors[8];
-
    /* Flag already set */
    if (ppu.strikeflag)
       return;
 
-   /* sprite is 100% transparent */
-   if (0 == pattern)
-      return;
-
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
-
    for (int i = 0; i < 8; i++)
    {
       if (colors[i] && (!surface || BG_SOLID(surface[i])))
@@ -422,28 +455,20 @@ INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
    }
 }
 
-INLINE void draw_bgtile(uint8 *surface, uint32 pattern, const uint8 *colors)
+INLINE void draw_bgtile(uint8 *surface, const uint8 *pixels, const uint8 *colors)
 {
-   *surface++ = colors[(pattern >> 14) & 3];
-   *surface++ = colors[(pattern >> 6) & 3];
-   *surface++ = colors[(pattern >> 12) & 3];
-   *surface++ = colors[(pattern >> 4) & 3];
-   *surface++ = colors[(pattern >> 10) & 3];
-   *surface++ = colors[(pattern >> 2) & 3];
-   *surface++ = colors[(pattern >> 8) & 3];
-   *surface   = colors[pattern & 3];
+   surface[0] = colors[pixels[0]];
+   surface[1] = colors[pixels[1]];
+   surface[2] = colors[pixels[2]];
+   surface[3] = colors[pixels[3]];
+   surface[4] = colors[pixels[4]];
+   surface[5] = colors[pixels[5]];
+   surface[6] = colors[pixels[6]];
+   surface[7] = colors[pixels[7]];
 }
 
-INLINE void draw_oamtile(uint8 *surface, uint8 attrib, uint32 pattern, const uint8 *col_tbl)
+INLINE void draw_oamtile(uint8 *surface, uint8 attrib, const uint8 *colors, const uint8 *col_tbl)
 {
-   uint8 colors[8];
-
-   /* sprite is 100% transparent */
-   if (0 == pattern)
-      return;
-
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
-
    /* draw the character */
    if (attrib & OAMF_BEHIND)
    {
@@ -499,7 +524,7 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
          ppu.latchfunc(ppu.bg_base, tile_index);
 
       /* Fetch tile and draw it */
-      draw_bgtile(bmp_ptr, get_patpix(bg_offset + (tile_index << 4)), ppu.palette + col_high);
+      draw_bgtile(bmp_ptr, get_tile_row(bg_offset + (tile_index << 4)), ppu.palette + col_high);
       bmp_ptr += 8;
 
       x_tile++;
@@ -591,22 +616,27 @@ INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
          tile_addr += y_offset;
       }
 
+      /* Fetch tile, it doesn't need drawing if it's 100% transparent */
+      uint64 pixels = get_tile_pixels(tile_addr, sprite->attr & OAMF_HFLIP);
+
       /* Check for a strike on sprite 0 if strike flag isn't set */
-      if (sprite_num == 0 && !ppu.strikeflag)
+      if (sprite_num == 0 && !ppu.strikeflag && pixels)
       {
-         check_strike(draw ? vidbuf + sprite->x_loc : NULL, sprite->attr, get_patpix(tile_addr));
+         check_strike(draw ? vidbuf + sprite->x_loc : NULL, (uint8 *)&pixels);
       }
 
       /* If we don't draw to buffer then we're done after sprite 0 */
       if (!draw)
          return;
 
-      /* Fetch tile and draw it */
-      draw_oamtile(
-         vidbuf + sprite->x_loc,
-         sprite->attr,
-         get_patpix(tile_addr),
-         ppu.palette + 16 + ((sprite->attr & 3) << 2));
+      if (pixels)
+      {
+         draw_oamtile(
+            vidbuf + sprite->x_loc,
+            sprite->attr,
+            (uint8 *)&pixels,
+            ppu.palette + 16 + ((sprite->attr & 3) << 2));
+      }
 
       /* maximum of 8 sprites per scanline */
       if (OPT(PPU_LIMIT_SPRITES) && ++count == PPU_MAXSPRITE)
@@ -721,7 +751,8 @@ ppu_t *ppu_init(void)
    memset(&ppu, 0, sizeof(ppu_t));
 
    ppu.nametab = malloc(0x400 * 4);
-   if (!ppu.nametab)
+   tiles = calloc(8, sizeof(ppu_tiles_t));
+   if (!ppu.nametab || !tiles)
       return NULL;
 
    ppu_setopt(PPU_DRAW_BACKGROUND, true);
@@ -735,6 +766,8 @@ void ppu_shutdown(void)
 {
    free(ppu.nametab);
    ppu.nametab = NULL;
+   free(tiles);
+   tiles = NULL;
 }
 
 
@@ -812,7 +845,7 @@ static void draw_sprite(uint8 *bmp, int x, int y, uint8 tile_num, uint8 attrib)
       if (line == 8)
          tile_addr += 8;
 
-      draw_bgtile(vid, get_patpix(tile_addr), ppu.palette + 16 + col_high);
+      draw_bgtile(vid, get_tile_row(tile_addr), ppu.palette + 16 + col_high);
       //draw_oamtile(vid, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
 
       tile_addr++;
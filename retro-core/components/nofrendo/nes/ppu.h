@@ -161,6 +161,7 @@ void ppu_setnametable(uint8 index, uint8 table);
 void ppu_setmirroring(ppu_mirror_t type);
 uint8 *ppu_getpage(uint32 page_num);
 uint8 *ppu_getnametable(uint8 table);
+void ppu_invalidate_tiles(void);
 
 /* Control */
 ppu_t *ppu_init(void);
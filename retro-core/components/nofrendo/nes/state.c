@@ -62,8 +62,49 @@ typedef struct
    uint8  data[];
 } block_t;
 
+typedef struct
+{
+   FILE  *file;   // File backend, or NULL for memory
+   uint8 *buffer; // Memory backend, or NULL to only count bytes
+   size_t size;
+   size_t pos;
+} state_io_t;
+
+static bool io_read(state_io_t *io, void *dest, size_t size)
+{
+   if (io->file)
+      return fread(dest, size, 1, io->file) == 1;
+   if (!io->buffer || io->pos + size > io->size)
+      return false;
+   memcpy(dest, io->buffer + io->pos, size);
+   io->pos += size;
+   return true;
+}
+
+static bool io_write(state_io_t *io, const void *src, size_t size)
+{
+   if (io->file)
+      return fwrite(src, size, 1, io->file) == 1;
+   if (io->buffer)
+   {
+      if (io->pos + size > io->size)
+         return false;
+      memcpy(io->buffer + io->pos, src, size);
+   }
+   io->pos += size;
+   return true;
+}
+
+static void io_seek(state_io_t *io, size_t pos)
+{
+   if (io->file)
+      fseek(io->file, pos, SEEK_SET);
+   else
+      io->pos = pos;
+}
+
 #define _fread(buffer, size) {                       \
-   if (fread(buffer, size, 1, file) != 1)            \
+   if (!io_read(io, buffer, size))                   \
    {                                                 \
       MESSAGE_ERROR("state_load: fread failed.\n");  \
       goto _error;                                   \
@@ -71,7 +112,7 @@ typedef struct
 }
 
 #define _fwrite(buffer, size) {                      \
-   if (fwrite(buffer, size, 1, file) != 1)           \
+   if (!io_write(io, buffer, size))                  \
    {                                                 \
       MESSAGE_ERROR("state_save: fwrite failed.\n"); \
       goto _error;                                   \
@@ -116,27 +157,18 @@ static bool memory_zone_dirty(const void *ptr, size_t size)
 }
 
 
-int state_save(const char* fn)
+static int save_blocks(state_io_t *io)
 {
    uint32 numberOfBlocks = 0;
    uint8 buffer[600];
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "wb")))
-   {
-       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-   }
-
-   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
 
    _fwrite("SNSS\x00\x00\x00\x05", 8);
 
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving base block\n");
+   MESSAGE_DEBUG("  - Saving base block\n");
 
    buffer[0] = machine->cpu->a_reg;
    buffer[1] = machine->cpu->x_reg;
@@ -173,7 +205,7 @@ int state_save(const char* fn)
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving info block\n");
+   MESSAGE_DEBUG("  - Saving info block\n");
 
    _fwrite("INFO\x00\x00\x00\x01\x00\x00\x01\x00", 12);
    _fwrite(&buffer, 0x100);
@@ -182,7 +214,7 @@ int state_save(const char* fn)
 
    /****************************************************/
 
-   MESSAGE_INFO("  - Saving sound block\n");
+   MESSAGE_DEBUG("  - Saving sound block\n");
 
    buffer[0x00] = machine->apu->rectangle[0].regs[0];
    buffer[0x01] = machine->apu->rectangle[0].regs[1];
@@ -213,7 +245,7 @@ int state_save(const char* fn)
 
    if (memory_zone_dirty(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks))
    {
-      MESSAGE_INFO("  - Saving VRAM block\n");
+      MESSAGE_DEBUG("  - Saving VRAM block\n");
 
       _fwrite("VRAM\x00\x00\x00\x01\x00\x00\x20\x00", 12);
       _fwrite(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks);
@@ -225,7 +257,7 @@ int state_save(const char* fn)
 
    if (memory_zone_dirty(machine->cart->prg_ram, 0x2000 * machine->cart->prg_ram_banks))
    {
-      MESSAGE_INFO("  - Saving SRAM block\n");
+      MESSAGE_DEBUG("  - Saving SRAM block\n");
 
       // Byte 0 = SRAM enabled (unused)
       // Length is always $2001
@@ -239,7 +271,7 @@ int state_save(const char* fn)
 
    if (machine->mapper->number > 0)
    {
-      MESSAGE_INFO("  - Saving mapper block\n");
+      MESSAGE_DEBUG("  - Saving mapper block\n");
 
       memset(buffer, 0, sizeof(buffer));
 
@@ -273,52 +305,41 @@ int state_save(const char* fn)
    /****************************************************/
 
    // Update number of blocks
-   fseek(file, 4, SEEK_SET);
+   size_t length = io->pos;
+   io_seek(io, 4);
    numberOfBlocks = swap32(numberOfBlocks);
    _fwrite(&numberOfBlocks, 4);
-
-   fclose(file);
-
-   MESSAGE_INFO("state_save: Game saved!\n");
+   io_seek(io, length);
 
    return 0;
 
 _error:
-   MESSAGE_ERROR("state_save: Save failed!\n");
-   fclose(file);
    return -1;
 }
 
 
-int state_load(const char* fn)
+static int load_blocks(state_io_t *io)
 {
    uint8 buffer[600];
 
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "rb")))
-   {
-       MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-  }
 
    _fread(buffer, 8);
 
    if (memcmp(buffer, "SNSS", 4) != 0)
    {
-      MESSAGE_ERROR("state_load: file '%s' is not a save file.\n", fn);
+      MESSAGE_ERROR("state_load: not a save file.\n");
       goto _error;
    }
 
    uint32 numberOfBlocks = swap32(*((uint32*)&buffer[4]));
    uint32 nextBlock = 8;
 
-   MESSAGE_INFO("state_load: file '%s' opened, blocks=%u.\n", fn, numberOfBlocks);
+   MESSAGE_DEBUG("state_load: blocks=%u.\n", numberOfBlocks);
 
    for (uint32 blk = 0; blk < numberOfBlocks; blk++)
    {
-      fseek(file, nextBlock, SEEK_SET);
+      io_seek(io, nextBlock);
       _fread(buffer, 12);
 
       uint32 blockVersion = swap32(*((uint32*)&buffer[4]));
@@ -332,7 +353,7 @@ int state_load(const char* fn)
 
       if (memcmp(buffer, "BASR", 4) == 0)
       {
-         MESSAGE_INFO("  - Found base block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found base block (%u bytes)\n", blockLength);
 
          _fread(buffer, 9);
 
@@ -380,7 +401,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "VRAM", 4) == 0)
       {
-         MESSAGE_INFO("  - Found VRAM block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found VRAM block (%u bytes)\n", blockLength);
 
          if (machine->cart->chr_ram_banks < (blockLength / ROM_CHR_BANK_SIZE))
          {
@@ -389,6 +410,7 @@ int state_load(const char* fn)
          }
 
          _fread(machine->cart->chr_ram, blockLength);
+         ppu_invalidate_tiles();
       }
 
 
@@ -396,7 +418,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "SRAM", 4) == 0)
       {
-         MESSAGE_INFO("  - Found SRAM block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found SRAM block (%u bytes)\n", blockLength);
 
          if (machine->cart->prg_ram_banks < ((blockLength-1) / ROM_PRG_BANK_SIZE))
          {
@@ -413,7 +435,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "MPRD", 4) == 0)
       {
-         MESSAGE_INFO("  - Found mapper block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found mapper block (%u bytes)\n", blockLength);
 
          _fread(buffer, MIN(blockLength, sizeof(buffer)));
 
@@ -440,7 +462,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "SOUN", 4) == 0)
       {
-         MESSAGE_INFO("  - Found sound block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found sound block (%u bytes)\n", blockLength);
 
          _fread(buffer, 0x16);
 
@@ -455,7 +477,7 @@ int state_load(const char* fn)
 
       else if (memcmp(buffer, "INFO", 4) == 0)
       {
-         MESSAGE_INFO("  - Found info block (%u bytes)\n", blockLength);
+         MESSAGE_DEBUG("  - Found info block (%u bytes)\n", blockLength);
 
          _fread(buffer, 0x100);
 
@@ -471,15 +493,78 @@ int state_load(const char* fn)
       }
    }
 
-   /* close file, we're done */
-   fclose(file);
-
-   MESSAGE_INFO("state_load: Game restored\n");
-
    return 0;
 
 _error:
-   MESSAGE_ERROR("state_load: Load failed!\n");
-   fclose(file);
    return -1;
 }
+
+
+int state_save(const char* fn)
+{
+   state_io_t io = {0};
+
+   if (!(io.file = fopen(fn, "wb")))
+   {
+      MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
+      return -1;
+   }
+
+   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
+
+   int ret = save_blocks(&io);
+   fclose(io.file);
+
+   if (ret < 0)
+      MESSAGE_ERROR("state_save: Save failed!\n");
+   else
+      MESSAGE_INFO("state_save: Game saved!\n");
+
+   return ret;
+}
+
+
+int state_load(const char* fn)
+{
+   state_io_t io = {0};
+
+   if (!(io.file = fopen(fn, "rb")))
+   {
+      MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
+      return -1;
+   }
+
+   MESSAGE_INFO("state_load: file '%s' opened.\n", fn);
+
+   int ret = load_blocks(&io);
+   fclose(io.file);
+
+   if (ret < 0)
+      MESSAGE_ERROR("state_load: Load failed!\n");
+   else
+      MESSAGE_INFO("state_load: Game restored\n");
+
+   return ret;
+}
+
+
+/* Saves to a memory buffer, returns the number of bytes used or -1 on failure.
+** When buffer is NULL nothing is written and the required size is returned.
+*/
+int state_save_mem(void *buffer, size_t size)
+{
+   state_io_t io = {NULL, buffer, buffer ? size : SIZE_MAX, 0};
+
+   if (save_blocks(&io) < 0)
+      return -1;
+
+   return io.pos;
+}
+
+
+int state_load_mem(const void *buffer, size_t size)
+{
+   state_io_t io = {NULL, (uint8 *)buffer, size, 0};
+
+   return load_blocks(&io);
+}
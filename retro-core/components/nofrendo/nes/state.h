@@ -25,3 +25,5 @@
 
 int state_load(const char *fn);
 int state_save(const char *fn);
+int state_load_mem(const void *buffer, size_t size);
+int state_save_mem(void *buffer, size_t size);
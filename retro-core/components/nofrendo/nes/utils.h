@@ -9,6 +9,8 @@
 #define LOG_PRINTF(level, x...) printf(x)
 #define IRAM_ATTR
 #define CRC32(a, b, c) (0)
+#define RG_TIMER_BEGIN(id)
+#define RG_TIMER_END(id)
 #endif
 
 #define MESSAGE_ERROR(x...) LOG_PRINTF(1, "!! " x)
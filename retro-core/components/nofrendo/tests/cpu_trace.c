@@ -0,0 +1,108 @@
+/*
+** cpu_trace.c
+**
+** Runs random code through the 6502 core and prints the registers and cycle count after
+** every step, then a hash of memory. Two builds of the core (switch and NES6502_JUMPTABLE)
+** must produce identical traces, see the Makefile.
+**
+** Usage: cpu_trace <seed> [cycles per step]
+*/
+
+#include "nes/nes.h"
+#include <stdio.h>
+
+static uint8 *pages[MEM_PAGECOUNT];
+static uint32 flags[MEM_PAGECOUNT];
+static uint8 ram[0x800], prgram[0x2000], rom[0x8000];
+static uint32 io_counter;
+
+/* The core calls these for pages with handlers. PPU/APU registers return a deterministic
+** value, writes to them or to ROM are only counted. */
+uint8 mem_getbyte(uint32 address)
+{
+   uint32 page = address >> MEM_PAGESHIFT;
+   if (flags[page] & MEM_PAGE_HAS_READ_HANDLER)
+      return (uint8)(address * 31 + io_counter++);
+   return pages[page][address];
+}
+
+void mem_putbyte(uint32 address, uint8 value)
+{
+   uint32 page = address >> MEM_PAGESHIFT;
+   if (flags[page] & MEM_PAGE_HAS_WRITE_HANDLER)
+      io_counter += value;
+   else
+      pages[page][address] = value;
+}
+
+uint32 mem_getword(uint32 address)
+{
+   return mem_getbyte(address + 1) << 8 | mem_getbyte(address);
+}
+
+static void map_page(int page, uint8 *ptr, uint32 page_flags)
+{
+   /* Pages are pointers to the start of the address space, like mem_setpage does */
+   pages[page] = ptr - page * MEM_PAGESIZE;
+   flags[page] = page_flags | MEM_PAGE_HAS_MEMORY;
+}
+
+int main(int argc, char **argv)
+{
+   /* JAM opcodes would stop the CPU for good */
+   static const uint8 jams[] = {0x02, 0x12, 0x22, 0x32, 0x42, 0x52, 0x62, 0x72, 0x92, 0xB2, 0xD2, 0xF2};
+   int seed = argc > 1 ? atoi(argv[1]) : 1;
+   int chunk = argc > 2 ? atoi(argv[2]) : 1;
+   nes6502_t ctx;
+
+   srand(seed);
+
+   for (int i = 0; i < sizeof(rom); i++)
+   {
+      rom[i] = rand();
+      for (int j = 0; j < sizeof(jams); j++)
+         if (rom[i] == jams[j])
+            rom[i] = 0xEA;
+   }
+   for (int i = 0; i < sizeof(ram); i++)
+      ram[i] = rand();
+   for (int i = 0; i < sizeof(prgram); i++)
+      prgram[i] = rand();
+
+   /* NMI $9000, RESET $8000, IRQ $A000 */
+   memcpy(rom + 0x7FFA, (uint8[]){0x00, 0x90, 0x00, 0x80, 0x00, 0xA0}, 6);
+
+   /* RAM, IO registers, PRG-RAM and PRG-ROM (with a write handler, like a mapper's) */
+   for (int page = 0; page < 4; page++)
+      map_page(page, ram, 0);
+   for (int page = 4; page < 12; page++)
+      map_page(page, ram, MEM_PAGE_HAS_READ_HANDLER | MEM_PAGE_HAS_WRITE_HANDLER);
+   for (int page = 12; page < 16; page++)
+      map_page(page, prgram + (page - 12) * MEM_PAGESIZE, 0);
+   for (int page = 16; page < 32; page++)
+      map_page(page, rom + (page - 16) * MEM_PAGESIZE, MEM_PAGE_HAS_WRITE_HANDLER);
+
+   nes6502_init(pages, flags);
+   nes6502_reset();
+
+   for (int step = 0; step < 200000; step++)
+   {
+      if (step % 997 == 0)
+         nes6502_nmi();
+      if (step % 1499 == 0)
+         nes6502_irq();
+      int cycles = nes6502_execute(chunk);
+      nes6502_getcontext(&ctx);
+      printf("%d %04X %02X %02X %02X %02X %02X %ld\n", cycles, (int)ctx.pc_reg, ctx.a_reg,
+         ctx.x_reg, ctx.y_reg, ctx.p_reg, ctx.s_reg, ctx.total_cycles);
+   }
+
+   uint32 hash = 0;
+   for (int i = 0; i < sizeof(ram); i++)
+      hash = hash * 31 + ram[i];
+   for (int i = 0; i < sizeof(prgram); i++)
+      hash = hash * 31 + prgram[i];
+   printf("memory %08X io %u\n", (unsigned)hash, (unsigned)io_counter);
+
+   return 0;
+}
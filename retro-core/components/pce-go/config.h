@@ -9,3 +9,8 @@
 #define ENABLE_IO_TRACING      0
 
 #define USE_MEM_MACROS         0
+
+// Use threaded (computed goto) dispatch in the CPU core
+#ifndef USE_JUMP_TABLE
+#define USE_JUMP_TABLE         0
+#endif
@@ -5,7 +5,8 @@
 #include "pce.h"
 #include "gfx.h"
 
-#define PAL(nibble) (PAL[(L >> ((nibble) * 4)) & 15])
+// Plot pixel `i` (a nibble of L) at P[x], unless it's transparent
+#define PLOT(x, i) if ((c = (L >> ((i) * 4)) & 15)) P[x] = PAL[c]
 
 #define V_FLIP  0x8000
 #define H_FLIP  0x0800
@@ -22,6 +23,59 @@ static struct {
 
 static uint8_t *framebuffer_top, *framebuffer_bottom;
 
+// VRAM patterns decoded to 4bit color indices, 8 pixels per uint32 (leftmost pixel in the low nibble).
+// Tiles use one uint32 per row, sprites two. They're refreshed from PCE.TileDirty/SpriteDirty on use.
+static uint32_t *tile_cache;   // [2048 * 8]
+static uint32_t *sprite_cache; // [512 * 16 * 2]
+
+
+static inline uint32_t
+decode_row(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+	uint32_t L = 0;
+	for (int x = 0; x < 8; x++) {
+		int bit = 7 - x;
+		L |= (((p0 >> bit) & 1) | (((p1 >> bit) & 1) << 1) | (((p2 >> bit) & 1) << 2)
+			| (((p3 >> bit) & 1) << 3)) << (x * 4);
+	}
+	return L;
+}
+
+
+static inline const uint32_t *
+get_tile(int no)
+{
+	uint32_t *L = tile_cache + no * 8;
+
+	if (PCE.TileDirty[no >> 3] & (1 << (no & 7))) {
+		const uint16_t *C = PCE.VRAM + no * 16;
+		for (int row = 0; row < 8; row++, C++) {
+			L[row] = decode_row(C[0] & 0xFF, C[0] >> 8, C[8] & 0xFF, C[8] >> 8);
+		}
+		PCE.TileDirty[no >> 3] &= ~(1 << (no & 7));
+	}
+
+	return L;
+}
+
+
+static inline const uint32_t *
+get_sprite(int no)
+{
+	uint32_t *L = sprite_cache + no * 32;
+
+	if (PCE.SpriteDirty[no >> 3] & (1 << (no & 7))) {
+		const uint16_t *C = PCE.VRAM + no * 64;
+		for (int row = 0; row < 16; row++, C++) {
+			L[row * 2 + 0] = decode_row(C[0] >> 8, C[16] >> 8, C[32] >> 8, C[48] >> 8);
+			L[row * 2 + 1] = decode_row(C[0] & 0xFF, C[16] & 0xFF, C[32] & 0xFF, C[48] & 0xFF);
+		}
+		PCE.SpriteDirty[no >> 3] &= ~(1 << (no & 7));
+	}
+
+	return L;
+}
+
 /*
 	Draw background tiles between two lines
 */
@@ -55,15 +109,13 @@ draw_tiles(uint8_t *screen_buffer, int Y1, int Y2, int scroll_x, int scroll_y)
 			int no = PCE.VRAM[x + y * bg_w];
 
 			uint8_t *PAL = &PCE.Palette[(no >> 8) & 0x1F0];
-			uint8_t *C = (uint8_t*)(PCE.VRAM + (no & 0x7FF) * 16 + offset);
+			const uint32_t *C = get_tile(no & 0x7FF) + offset;
 			uint8_t *P = PP;
 
-			for (int i = 0; i < h; i++, P += XBUF_WIDTH, C += 2) {
-				uint32_t J, L, M;
-
-				J = C[0] | C[1] | C[16] | C[17];
+			for (int i = 0; i < h; i++, P += XBUF_WIDTH, C++) {
+				uint32_t L = *C, c;
 
-				if (!J)
+				if (!L)
 					continue;
 
 				if (P + 8 >= framebuffer_bottom) {
@@ -74,23 +126,8 @@ draw_tiles(uint8_t *screen_buffer, int Y1, int Y2, int scroll_x, int scroll_y)
 					continue;
 				}
 
-				M = C[0];
-				L = ((M & 0x88) >> 3) | ((M & 0x44) << 6) | ((M & 0x22) << 15) | ((M & 0x11) << 24);
-				M = C[1];
-				L |= ((M & 0x88) >> 2) | ((M & 0x44) << 7) | ((M & 0x22) << 16) | ((M & 0x11) << 25);
-				M = C[16];
-				L |= ((M & 0x88) >> 1) | ((M & 0x44) << 8) | ((M & 0x22) << 17) | ((M & 0x11) << 26);
-				M = C[17];
-				L |= ((M & 0x88) >> 0) | ((M & 0x44) << 9) | ((M & 0x22) << 18) | ((M & 0x11) << 27);
-
-				if (J & 0x80) P[0] = PAL(1);
-				if (J & 0x40) P[1] = PAL(3);
-				if (J & 0x20) P[2] = PAL(5);
-				if (J & 0x10) P[3] = PAL(7);
-				if (J & 0x08) P[4] = PAL(0);
-				if (J & 0x04) P[5] = PAL(2);
-				if (J & 0x02) P[6] = PAL(4);
-				if (J & 0x01) P[7] = PAL(6);
+				PLOT(0, 0); PLOT(1, 1); PLOT(2, 2); PLOT(3, 3);
+				PLOT(4, 4); PLOT(5, 5); PLOT(6, 6); PLOT(7, 7);
 			}
 		}
 		line += h;
@@ -109,20 +146,22 @@ draw_sprite(uint8_t *P, const uint16_t *C, int height, uint32_t attr)
 {
 	uint8_t *PAL = &PCE.Palette[256 + ((attr & 0xF) << 4)];
 
+	// C points to a row of a sprite in VRAM, use the decoded copy instead
+	size_t offset = C - PCE.VRAM;
+	const uint32_t *S = get_sprite(offset >> 6) + (offset & 15) * 2;
+
 	bool hflip = attr & H_FLIP;
-	int inc = 1; //(attr & V_FLIP) ? -1 : 1;
+	int inc = 2; //(attr & V_FLIP) ? -2 : 2;
 
 	if (attr & V_FLIP) {
-		inc = -1;
-		C = C + height - 1;
+		inc = -2;
+		S = S + (height - 1) * 2;
 	}
 
-	for (int i = 0; i < height; i++, C += inc, P += XBUF_WIDTH) {
-
-		uint32_t J = C[0] | C[16] | C[32] | C[48];
-		uint32_t L1, L2, L, M;
+	for (int i = 0; i < height; i++, S += inc, P += XBUF_WIDTH) {
+		uint32_t L, c;
 
-		if (!J)
+		if (!(S[0] | S[1]))
 			continue;
 
 		// This will also need to be handled in draw_sprites... (it could adjust simply constrain the height)
@@ -134,59 +173,20 @@ draw_sprite(uint8_t *P, const uint16_t *C, int height, uint32_t attr)
 			continue;
 		}
 
-		M = C[0];
-		L1 = ((M & 0x88) >> 3) | ((M & 0x44) << 6) | ((M & 0x22) << 15) | ((M & 0x11) << 24);
-		L2 = ((M & 0x8800) >> 11) | ((M & 0x4400) >> 2) | ((M & 0x2200) << 7) | ((M & 0x1100) << 16);
-		M = C[16];
-		L1 |= ((M & 0x88) >> 2) | ((M & 0x44) << 7) | ((M & 0x22) << 16) | ((M & 0x11) << 25);
-		L2 |= ((M & 0x8800) >> 10) | ((M & 0x4400) >> 1) | ((M & 0x2200) << 8) | ((M & 0x1100) << 17);
-		M = C[32];
-		L1 |= ((M & 0x88) >> 1) | ((M & 0x44) << 8) | ((M & 0x22) << 17) | ((M & 0x11) << 26);
-		L2 |= ((M & 0x8800) >> 9) | ((M & 0x4400) >> 0) | ((M & 0x2200) << 9) | ((M & 0x1100) << 18);
-		M = C[48];
-		L1 |= ((M & 0x88) >> 0) | ((M & 0x44) << 9) | ((M & 0x22) << 18) | ((M & 0x11) << 27);
-		L2 |= ((M & 0x8800) >> 8) | ((M & 0x4400) << 1) | ((M & 0x2200) << 10) | ((M & 0x1100) << 19);
-
 		if (hflip) {
-			L = L2;
-			if ((J & 0x8000)) P[15] = PAL(1);
-			if ((J & 0x4000)) P[14] = PAL(3);
-			if ((J & 0x2000)) P[13] = PAL(5);
-			if ((J & 0x1000)) P[12] = PAL(7);
-			if ((J & 0x0800)) P[11] = PAL(0);
-			if ((J & 0x0400)) P[10] = PAL(2);
-			if ((J & 0x0200)) P[9]  = PAL(4);
-			if ((J & 0x0100)) P[8]  = PAL(6);
-
-			L = L1;
-			if ((J & 0x80)) P[7] = PAL(1);
-			if ((J & 0x40)) P[6] = PAL(3);
-			if ((J & 0x20)) P[5] = PAL(5);
-			if ((J & 0x10)) P[4] = PAL(7);
-			if ((J & 0x08)) P[3] = PAL(0);
-			if ((J & 0x04)) P[2] = PAL(2);
-			if ((J & 0x02)) P[1] = PAL(4);
-			if ((J & 0x01)) P[0] = PAL(6);
+			L = S[0];
+			PLOT(15, 0); PLOT(14, 1); PLOT(13, 2); PLOT(12, 3);
+			PLOT(11, 4); PLOT(10, 5); PLOT(9, 6);  PLOT(8, 7);
+			L = S[1];
+			PLOT(7, 0);  PLOT(6, 1);  PLOT(5, 2);  PLOT(4, 3);
+			PLOT(3, 4);  PLOT(2, 5);  PLOT(1, 6);  PLOT(0, 7);
 		} else {
-			L = L2;
-			if ((J & 0x8000)) P[0] = PAL(1);
-			if ((J & 0x4000)) P[1] = PAL(3);
-			if ((J & 0x2000)) P[2] = PAL(5);
-			if ((J & 0x1000)) P[3] = PAL(7);
-			if ((J & 0x0800)) P[4] = PAL(0);
-			if ((J & 0x0400)) P[5] = PAL(2);
-			if ((J & 0x0200)) P[6] = PAL(4);
-			if ((J & 0x0100)) P[7] = PAL(6);
-
-			L = L1;
-			if ((J & 0x80)) P[8]  = PAL(1);
-			if ((J & 0x40)) P[9]  = PAL(3);
-			if ((J & 0x20)) P[10] = PAL(5);
-			if ((J & 0x10)) P[11] = PAL(7);
-			if ((J & 0x08)) P[12] = PAL(0);
-			if ((J & 0x04)) P[13] = PAL(2);
-			if ((J & 0x02)) P[14] = PAL(4);
-			if ((J & 0x01)) P[15] = PAL(6);
+			L = S[0];
+			PLOT(0, 0);  PLOT(1, 1);  PLOT(2, 2);  PLOT(3, 3);
+			PLOT(4, 4);  PLOT(5, 5);  PLOT(6, 6);  PLOT(7, 7);
+			L = S[1];
+			PLOT(8, 0);  PLOT(9, 1);  PLOT(10, 2); PLOT(11, 3);
+			PLOT(12, 4); PLOT(13, 5); PLOT(14, 6); PLOT(15, 7);
 		}
 	}
 }
@@ -348,6 +348,14 @@ render_lines(int min_line, int max_line)
 int
 gfx_init(void)
 {
+	tile_cache = malloc(2048 * 8 * sizeof(uint32_t));
+	sprite_cache = malloc(512 * 16 * 2 * sizeof(uint32_t));
+
+	if (!tile_cache || !sprite_cache) {
+		gfx_term();
+		return -1;
+	}
+
 	gfx_reset(true);
 	return 0;
 }
@@ -358,13 +366,20 @@ gfx_reset(bool hard)
 {
 	last_line_counter = 0;
 	line_counter = 0;
+
+	// VRAM may have been cleared or loaded from a save state
+	memset(PCE.TileDirty, 0xFF, sizeof(PCE.TileDirty));
+	memset(PCE.SpriteDirty, 0xFF, sizeof(PCE.SpriteDirty));
 }
 
 
 void
 gfx_term(void)
 {
-	//
+	free(tile_cache);
+	tile_cache = NULL;
+	free(sprite_cache);
+	sprite_cache = NULL;
 }
 
 
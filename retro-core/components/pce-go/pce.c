@@ -422,7 +422,7 @@ pce_writeIO(uint16_t A, uint8_t V)
 			case VWR:                           // VRAM Write Register
 				// I am not 100% sure if MAWR should wrap instead, eg IO_VDC_REG[MAWR].W & 0x7FFF
 				if (IO_VDC_REG[MAWR].W < 0x8000) {
-					PCE.VRAM[IO_VDC_REG[MAWR].W] = (V << 8) | IO_VDC_REG_ACTIVE.B.l;
+					IO_VRAM_WRITE(IO_VDC_REG[MAWR].W, (V << 8) | IO_VDC_REG_ACTIVE.B.l);
 				}
 				IO_VDC_REG_INC(MAWR);
 				break;
@@ -501,7 +501,7 @@ pce_writeIO(uint16_t A, uint8_t V)
 
 				while (IO_VDC_REG[LENR].W != 0xFFFF) {
 					if (IO_VDC_REG[DISTR].W < 0x8000) {
-						PCE.VRAM[IO_VDC_REG[DISTR].W] = PCE.VRAM[IO_VDC_REG[SOUR].W];
+						IO_VRAM_WRITE(IO_VDC_REG[DISTR].W, PCE.VRAM[IO_VDC_REG[SOUR].W]);
 					}
 					IO_VDC_REG[SOUR].W += src_inc;
 					IO_VDC_REG[DISTR].W += dst_inc;
@@ -127,6 +127,10 @@ typedef struct {
 	// Video RAM
 	uint16_t *VRAM; // [0x8000]
 
+	// VRAM patterns modified since gfx.c last decoded them (one bit per tile/sprite)
+	uint8_t TileDirty[2048 / 8];
+	uint8_t SpriteDirty[512 / 8];
+
 	// Sprite RAM
 	sprite_t SPRAM[64];
 
@@ -237,6 +241,10 @@ extern uint8_t *PageW[8];
 #define IO_VDC_REG           PCE.VDC.regs
 #define IO_VDC_REG_ACTIVE    PCE.VDC.regs[PCE.VDC.reg]
 #define IO_VDC_REG_INC(reg)  {unsigned _i[] = {1,32,64,128}; PCE.VDC.regs[(reg)].W += _i[(PCE.VDC.regs[CR].W >> 11) & 3];}
+#define IO_VRAM_WRITE(addr, val) { \
+	PCE.VRAM[(addr)] = (val); \
+	PCE.TileDirty[(addr) >> 7] |= 1 << (((addr) >> 4) & 7); \
+	PCE.SpriteDirty[(addr) >> 9] |= 1 << (((addr) >> 6) & 7); }
 #define IO_VDC_STATUS(bit)   ((PCE.VDC.status >> bit) & 1)
 #define IO_VDC_MINLINE       (IO_VDC_REG[VPR].B.h + IO_VDC_REG[VPR].B.l)
 #define IO_VDC_MAXLINE       (IO_VDC_MINLINE + IO_VDC_REG[VDW].W)
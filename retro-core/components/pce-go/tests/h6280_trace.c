@@ -0,0 +1,85 @@
+// h6280_trace.c - CPU trace for comparing dispatch modes
+//
+// Runs random code through h6280_run and prints the registers and cycle count after every
+// step, then a hash of memory. Two builds of the core (switch and USE_JUMP_TABLE) must
+// produce identical traces, see the Makefile.
+//
+// Usage: h6280_trace <seed> [cycles per step]
+#include <stdlib.h>
+
+#include "pce.h"
+
+PCE_t PCE;
+uint8_t *PageR[8];
+uint8_t *PageW[8];
+
+static uint8_t memory[0x10000];
+static uint8_t ioarea[0x10000]; // pce_read16 doesn't check for IO, it reads IOAREA + addr
+static uint8_t *memory_map[0x100];
+static uint32_t io_counter;
+
+uint8_t
+pce_readIO(uint16_t A)
+{
+	// Any deterministic value will do, it only has to be the same for both builds
+	return (uint8_t)(A * 13 + io_counter++);
+}
+
+void
+pce_writeIO(uint16_t A, uint8_t V)
+{
+	io_counter += V;
+}
+
+int
+main(int argc, char **argv)
+{
+	int seed = argc > 1 ? atoi(argv[1]) : 1;
+	int chunk = argc > 2 ? atoi(argv[2]) : 1;
+
+	srand(seed);
+
+	for (int i = 0; i < 0x10000; i++)
+		memory[i] = rand();
+
+	// Flat RAM in the first 7 pages, the last one is IO (PageR == IOAREA selects the handlers)
+	PCE.RAM = memory;
+	PCE.IOAREA = ioarea;
+	for (int i = 0; i < 7; i++)
+		PageR[i] = PageW[i] = memory;
+	PageR[7] = PageW[7] = PCE.IOAREA;
+
+	// TAM can map any bank, point them all to the start of RAM
+	PCE.MemoryMapR = PCE.MemoryMapW = memory_map;
+	for (int i = 0; i < 0x100; i++)
+		memory_map[i] = memory;
+
+	// The vectors are in the IO page, start directly instead of going through h6280_reset
+	CPU.PC = 0x4000;
+	CPU.S = 0xFF;
+	CPU.P = FL_I;
+
+	// Cycles are rebased after every step like pce_run does, block transfers can take a lot of them
+	int max_cycles = 0;
+	int64_t total_cycles = 0;
+
+	for (int step = 0; step < 100000; step++)
+	{
+		max_cycles += chunk;
+		h6280_run(max_cycles);
+		max_cycles -= PCE.Cycles;
+		total_cycles += PCE.Cycles;
+		PCE.Cycles = 0;
+		printf("%04X %02X %02X %02X %02X %02X %lld\n", CPU.PC, CPU.A, CPU.X, CPU.Y, CPU.P, CPU.S, (long long)total_cycles);
+		// Random code eventually runs into the IO page, jump back somewhere else in RAM
+		if (CPU.PC >= 0xE000)
+			CPU.PC = 0x4000 + ((step * 7) & 0x7FFF);
+	}
+
+	uint32_t hash = 0;
+	for (int i = 0; i < 0xE000; i++)
+		hash = hash * 31 + memory[i];
+	printf("memory %08X io %u\n", (unsigned)hash, (unsigned)io_counter);
+
+	return 0;
+}
@@ -130,5 +130,6 @@ extern void (* const S9xApuOpcodes [256])(void);
 #define ONE_APU_CYCLE 21
 #define APU_EXECUTE1() do {} while(0)
 #define APU_EXECUTE()  do {} while(0)
+#define APU_SYNC()     do {} while(0)
 
 #endif
@@ -14,7 +14,9 @@ void S9xMainLoop()
 {
    do
    {
+#if !LAZY_APU_SYNC
       APU_EXECUTE();
+#endif
       if (CPU.Flags)
       {
          if (CPU.Flags & NMI_FLAG)
@@ -55,13 +57,31 @@ void S9xMainLoop()
             break;
       }
 
+#if LAZY_APU_SYNC
+      /* Run until something needs attention: an event or a flag set by the code we ran */
+      do
+      {
+         CPU.PCAtOpcodeStart = CPU.PC;
+         CPU.Cycles += CPU.MemSpeed;
+         (*ICPU.S9xOpcodes [*CPU.PC++].S9xOpcode)();
+      } while (CPU.Cycles < CPU.NextEvent && !CPU.Flags);
+
+      if (CPU.Cycles >= CPU.NextEvent)
+      {
+         APU_SYNC();
+         S9xDoHBlankProcessing();
+      }
+#else
       CPU.PCAtOpcodeStart = CPU.PC;
       CPU.Cycles += CPU.MemSpeed;
       (*ICPU.S9xOpcodes [*CPU.PC++].S9xOpcode)();
       if (CPU.Cycles >= CPU.NextEvent)
          S9xDoHBlankProcessing();
+#endif
    } while(true);
 
+   APU_SYNC();
+
    ICPU.Registers.PC = CPU.PC - CPU.PCBase;
 #ifndef USE_BLARGG_APU
    IAPU.Registers.PC = IAPU.PC - IAPU.RAM;
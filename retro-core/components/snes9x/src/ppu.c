@@ -584,6 +584,7 @@ void S9xSetPPU(uint8_t Byte, uint16_t Address)
       case 0x217e:
       case 0x217f:
 #ifndef USE_BLARGG_APU
+         APU_SYNC();
          Memory.FillRAM [Address] = Byte;
          IAPU.RAM [(Address & 3) + 0xf4] = Byte;
          IAPU.APUExecuting = Settings.APUEnabled;
@@ -833,6 +834,7 @@ uint8_t S9xGetPPU(uint16_t Address)
       case 0x217e:
       case 0x217f:
 #ifndef USE_BLARGG_APU
+         APU_SYNC();
          IAPU.APUExecuting = Settings.APUEnabled;
          IAPU.WaitCounter++;
 
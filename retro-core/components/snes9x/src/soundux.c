@@ -19,7 +19,22 @@
 #define CLIP8(v) \
 (v) = (((v) <= -128) ? -128 : (((v) >= 127) ? 127 : (v)))
 
+/* A decoded BRR block only depends on its 9 bytes and, unless it uses filter 0,
+ * the two previous samples, so looped instruments keep producing the same blocks.
+ * Entries are checked against the current APU RAM content, which takes care of
+ * SPC700 writes. */
+#define BRR_CACHE_SIZE 128
+
+typedef struct
+{
+   uint8_t source [9];
+   int32_t previous [2];
+   int32_t next [2];
+   int16_t samples [SOUND_DECODE_LENGTH];
+} BRRCacheEntry;
+
 static struct {
+   BRRCacheEntry BRRCache [BRR_CACHE_SIZE];
    int32_t wave[SOUND_BUFFER_SIZE];
    int32_t Echo [24000];
    int32_t MixBuffer [SOUND_BUFFER_SIZE];
@@ -48,6 +63,7 @@ static struct {
    int32_t MixOutputPrev[2];
 } *LocalState;
 
+#define BRRCache LocalState->BRRCache
 #define wave LocalState->wave
 #define Echo LocalState->Echo
 #define MixBuffer LocalState->MixBuffer
@@ -375,6 +391,7 @@ void DecodeBlock(Channel* ch)
    int16_t *raw;
    uint32_t i;
    int32_t prev0, prev1;
+   BRRCacheEntry *entry;
 
    if (ch->block_pointer > 0x10000 - 9)
    {
@@ -392,10 +409,26 @@ void DecodeBlock(Channel* ch)
 
    raw = ch->block = ch->decoded;
 
-   compressed++;
-
    prev0 = ch->previous [0];
    prev1 = ch->previous [1];
+
+   entry = &BRRCache [(ch->block_pointer / 9) & (BRR_CACHE_SIZE - 1)];
+   ch->block_pointer += 9;
+
+   if ((!(filter & 0x0c) || (entry->previous [0] == prev0 && entry->previous [1] == prev1))
+         && memcmp(entry->source, compressed, 9) == 0)
+   {
+      memcpy(raw, entry->samples, sizeof(entry->samples));
+      ch->previous [0] = entry->next [0];
+      ch->previous [1] = entry->next [1];
+      return;
+   }
+
+   memcpy(entry->source, compressed, 9);
+   entry->previous [0] = prev0;
+   entry->previous [1] = prev1;
+
+   compressed++;
    shift = filter >> 4;
 
    switch ((filter >> 2) & 3)
@@ -463,9 +496,9 @@ void DecodeBlock(Channel* ch)
       }
       break;
    }
-   ch->previous [0] = prev0;
-   ch->previous [1] = prev1;
-   ch->block_pointer += 9;
+   ch->previous [0] = entry->next [0] = prev0;
+   ch->previous [1] = entry->next [1] = prev1;
+   memcpy(entry->samples, ch->decoded, sizeof(entry->samples));
 }
 
 static INLINE void MixStereo(int32_t sample_count)
@@ -507,17 +540,24 @@ static INLINE void MixStereo(int32_t sample_count)
       VL = (ch->sample * ch-> left_vol_level) / 128;
       VR = (ch->sample * ch->right_vol_level) / 128;
 
-      for (I = 0; I < (uint32_t) sample_count; I += 2)
+      for (I = 0; I < (uint32_t) sample_count; )
       {
-         uint32_t freq = freq0;
+         uint32_t end = sample_count;
 
-         if (mod)
-            freq = PITCH_MOD(freq, wave [I / 2]);
-
-         ch->env_error += ch->erate;
-         if (ch->env_error >= FIXED_POINT)
+         /* Mix up to the next envelope step in one run, the envelope
+          * only needs attention on the sample where env_error overflows. */
+         if (ch->env_error + ch->erate < FIXED_POINT)
+         {
+            if (ch->erate && I + 2 * ((FIXED_POINT - 1 - ch->env_error) / ch->erate) < end)
+               end = I + 2 * ((FIXED_POINT - 1 - ch->env_error) / ch->erate);
+            ch->env_error += ch->erate * ((end - I + 1) / 2);
+         }
+         else
          {
-            uint32_t step = ch->env_error >> FIXED_POINT_SHIFT;
+            uint32_t step;
+
+            ch->env_error += ch->erate;
+            step = ch->env_error >> FIXED_POINT_SHIFT;
 
             switch (ch->state)
             {
@@ -656,99 +696,108 @@ static INLINE void MixStereo(int32_t sample_count)
             ch->right_vol_level = (ch->envx * ch->volume_right) / 128;
             VL = (ch->sample * ch-> left_vol_level) / 128;
             VR = (ch->sample * ch->right_vol_level) / 128;
+            end = I + 2;
          }
 
-         ch->count += freq;
-         if (ch->count >= FIXED_POINT)
+         for (; I < end; I += 2)
          {
-            VL = ch->count >> FIXED_POINT_SHIFT;
-            ch->sample_pointer += VL;
-            ch->count &= FIXED_POINT_REMAINDER;
+            uint32_t freq = freq0;
+
+            if (mod)
+               freq = PITCH_MOD(freq, wave [I / 2]);
 
-            ch->sample = ch->next_sample;
-            if (ch->sample_pointer >= SOUND_DECODE_LENGTH)
+            ch->count += freq;
+            if (ch->count >= FIXED_POINT)
             {
-               if (JUST_PLAYED_LAST_SAMPLE(ch))
-               {
-                  S9xAPUSetEndOfSample(J, ch);
-                  goto stereo_exit;
-               }
-               do
+               VL = ch->count >> FIXED_POINT_SHIFT;
+               ch->sample_pointer += VL;
+               ch->count &= FIXED_POINT_REMAINDER;
+
+               ch->sample = ch->next_sample;
+               if (ch->sample_pointer >= SOUND_DECODE_LENGTH)
                {
-                  ch->sample_pointer -= SOUND_DECODE_LENGTH;
-                  if (ch->last_block)
+                  if (JUST_PLAYED_LAST_SAMPLE(ch))
                   {
-                     if (!ch->loop)
-                     {
-                        ch->sample_pointer = LAST_SAMPLE;
-                        ch->next_sample = ch->sample;
-                        break;
-                     }
-                     else
+                     S9xAPUSetEndOfSample(J, ch);
+                     goto stereo_exit;
+                  }
+                  do
+                  {
+                     ch->sample_pointer -= SOUND_DECODE_LENGTH;
+                     if (ch->last_block)
                      {
-                        uint8_t *dir;
-
-                        S9xAPUSetEndX(J);
-                        ch->last_block = false;
-                        dir = S9xGetSampleAddress(ch->sample_number);
-                        ch->block_pointer = READ_WORD(dir + 2);
+                        if (!ch->loop)
+                        {
+                           ch->sample_pointer = LAST_SAMPLE;
+                           ch->next_sample = ch->sample;
+                           break;
+                        }
+                        else
+                        {
+                           uint8_t *dir;
+
+                           S9xAPUSetEndX(J);
+                           ch->last_block = false;
+                           dir = S9xGetSampleAddress(ch->sample_number);
+                           ch->block_pointer = READ_WORD(dir + 2);
+                        }
                      }
+                     DecodeBlock(ch);
                   }
-                  DecodeBlock(ch);
+                  while (ch->sample_pointer >= SOUND_DECODE_LENGTH);
+                  if (!JUST_PLAYED_LAST_SAMPLE(ch))
+                     ch->next_sample = ch->block [ch->sample_pointer];
                }
-               while (ch->sample_pointer >= SOUND_DECODE_LENGTH);
-               if (!JUST_PLAYED_LAST_SAMPLE(ch))
+               else
                   ch->next_sample = ch->block [ch->sample_pointer];
-            }
-            else
-               ch->next_sample = ch->block [ch->sample_pointer];
 
-            if (ch->type == SOUND_SAMPLE)
-            {
-               if (Settings.InterpolatedSound && freq < FIXED_POINT && !mod)
+               if (ch->type == SOUND_SAMPLE)
                {
-                  ch->interpolate = ((ch->next_sample - ch->sample) * (int32_t) freq) / (int32_t) FIXED_POINT;
-                  ch->sample = (int16_t)(ch->sample + (((ch->next_sample - ch->sample) * (int32_t)(ch->count)) / (int32_t) FIXED_POINT));
+                  if (Settings.InterpolatedSound && freq < FIXED_POINT && !mod)
+                  {
+                     ch->interpolate = ((ch->next_sample - ch->sample) * (int32_t) freq) / (int32_t) FIXED_POINT;
+                     ch->sample = (int16_t)(ch->sample + (((ch->next_sample - ch->sample) * (int32_t)(ch->count)) / (int32_t) FIXED_POINT));
+                  }
+                  else
+                     ch->interpolate = 0;
                }
                else
+               {
+                  /* Snes9x 1.53's SPC_DSP.cpp, by blargg */
+                  int32_t feedback = (so.noise_gen << 13) ^ (so.noise_gen << 14);
+                  so.noise_gen = (feedback & 0x4000) ^ (so.noise_gen >> 1);
+                  ch->sample = (so.noise_gen << 17) >> 17;
                   ch->interpolate = 0;
+               }
+
+               VL = (ch->sample * ch-> left_vol_level) / 128;
+               VR = (ch->sample * ch->right_vol_level) / 128;
             }
             else
             {
-               /* Snes9x 1.53's SPC_DSP.cpp, by blargg */
-               int32_t feedback = (so.noise_gen << 13) ^ (so.noise_gen << 14);
-               so.noise_gen = (feedback & 0x4000) ^ (so.noise_gen >> 1);
-               ch->sample = (so.noise_gen << 17) >> 17;
-               ch->interpolate = 0;
-            }
-
-            VL = (ch->sample * ch-> left_vol_level) / 128;
-            VR = (ch->sample * ch->right_vol_level) / 128;
-         }
-         else
-         {
-            if (ch->interpolate)
-            {
-               int32_t s = (int32_t) ch->sample + ch->interpolate;
+               if (ch->interpolate)
+               {
+                  int32_t s = (int32_t) ch->sample + ch->interpolate;
 
-               CLIP16(s);
-               ch->sample = (int16_t) s;
-               VL = (ch->sample * ch-> left_vol_level) / 128;
-               VR = (ch->sample * ch->right_vol_level) / 128;
+                  CLIP16(s);
+                  ch->sample = (int16_t) s;
+                  VL = (ch->sample * ch-> left_vol_level) / 128;
+                  VR = (ch->sample * ch->right_vol_level) / 128;
+               }
             }
-         }
 
-         if (pitch_mod & (1 << (J + 1)))
-            wave [I / 2] = ch->sample * ch->envx;
+            if (pitch_mod & (1 << (J + 1)))
+               wave [I / 2] = ch->sample * ch->envx;
 
-         MixBuffer [I    ] += VL;
-         MixBuffer [I + 1] += VR;
+            MixBuffer [I    ] += VL;
+            MixBuffer [I + 1] += VR;
 
-         if (!ch->echo_buf_ptr)
-            continue;
+            if (!ch->echo_buf_ptr)
+               continue;
 
-         ch->echo_buf_ptr [I    ] += VL;
-         ch->echo_buf_ptr [I + 1] += VR;
+            ch->echo_buf_ptr [I    ] += VL;
+            ch->echo_buf_ptr [I + 1] += VR;
+         }
       }
 stereo_exit:;
    }
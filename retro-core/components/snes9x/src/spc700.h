@@ -73,5 +73,19 @@ if (IAPU.APUExecuting) \
     while (APU.Cycles <= CPU.Cycles) \
        APU_EXECUTE1();
 
+/* With LAZY_APU_SYNC the SPC700 is no longer stepped after every CPU instruction.
+ * It only catches up when the two CPUs can observe each other: on $2140-$217F
+ * accesses and before H-Blank events (which rebase the cycle counters and tick
+ * the APU timers). This lets S9xMainLoop run straight-line code in one burst. */
+#ifndef LAZY_APU_SYNC
+#define LAZY_APU_SYNC 1
+#endif
+
+#if LAZY_APU_SYNC
+#define APU_SYNC() { APU_EXECUTE(); }
+#else
+#define APU_SYNC() do {} while(0)
+#endif
+
 #endif
 #endif
@@ -6,22 +6,25 @@
 static int skipFrames = 20; // The 20 is to hide startup flicker in some games
 static bool slowFrame = false;
 
-static int video_time;
 static int audio_time;
+static bool runningAhead;
 
 static const char *sramFile;
 static int autoSaveSRAM = 0;
 static int autoSaveSRAM_Timer = 0;
 static bool useSystemTime = true;
 static bool loadBIOSFile = false;
+static int romCacheSize = 0; // KB, 0 means as much as memory allows
 
 static rg_surface_t *updates[2];
 static rg_surface_t *currentUpdate;
+static rg_unzip_t *romZip;
 
 static const char *SETTING_SAVESRAM = "SaveSRAM";
 static const char *SETTING_PALETTE  = "Palette";
 static const char *SETTING_SYSTIME = "SysTime";
 static const char *SETTING_LOADBIOS = "LoadBIOS";
+static const char *SETTING_ROMCACHE = "ROMCache";
 // --- MAIN
 
 
@@ -74,6 +77,28 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    int ret = gnuboy_save_state_mem(buffer, size);
+    return ret > 0 ? ret : 0;
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return gnuboy_load_state_mem(buffer, size) > 0;
+}
+
+static size_t save_snapshot_handler(void *buffer, size_t size)
+{
+    int ret = gnuboy_save_snapshot(buffer, size);
+    return ret > 0 ? ret : 0;
+}
+
+static bool load_snapshot_handler(const void *buffer, size_t size)
+{
+    return gnuboy_load_snapshot(buffer, size) > 0;
+}
+
 static bool reset_handler(bool hard)
 {
     gnuboy_reset(hard);
@@ -155,6 +180,28 @@ static rg_gui_event_t enable_bios_cb(rg_gui_option_t *option, rg_gui_event_t eve
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rom_cache_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    static const int sizes[] = {0, 512, 1024, 2048, 4096};
+    int index = 0;
+
+    while (index < RG_COUNT(sizes) - 1 && sizes[index] != romCacheSize)
+        index++;
+
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        index = (index + (event == RG_DIALOG_PREV ? RG_COUNT(sizes) - 1 : 1)) % RG_COUNT(sizes);
+        romCacheSize = sizes[index];
+        rg_settings_set_number(NS_APP, SETTING_ROMCACHE, romCacheSize);
+        gnuboy_set_bank_budget(romCacheSize * 1024);
+    }
+
+    if (romCacheSize == 0) strcpy(option->value, "Auto");
+    else sprintf(option->value, "%dK", romCacheSize);
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t rtc_t_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     int d, h, m, s;
@@ -217,15 +264,22 @@ static rg_gui_event_t rtc_update_cb(rg_gui_option_t *option, rg_gui_event_t even
 
 static void video_callback(void *buffer)
 {
-    int64_t startTime = rg_system_timer();
+    RG_TIMER_BEGIN(RG_TIMER_PRESENT);
     slowFrame = !rg_display_sync(false);
     rg_display_submit(currentUpdate, 0);
-    video_time += rg_system_timer() - startTime;
+    RG_TIMER_END(RG_TIMER_PRESENT);
 }
 
 
+static size_t rom_read_callback(void *buffer, size_t offset, size_t length)
+{
+    return rg_storage_unzip_read(romZip, offset, buffer, length);
+}
+
 static void audio_callback(void *buffer, size_t length)
 {
+    if (runningAhead)
+        return;
     int64_t startTime = rg_system_timer();
     rg_audio_submit(buffer, length >> 1);
     audio_time += rg_system_timer() - startTime;
@@ -236,6 +290,10 @@ void gbc_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
+        .loadSnapshot = &load_snapshot_handler,
+        .saveSnapshot = &save_snapshot_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -245,6 +303,7 @@ void gbc_main(void)
         {0, "RTC config   ", "-", RG_DIALOG_FLAG_NORMAL, &rtc_update_cb},
         {0, "SRAM autosave", "-", RG_DIALOG_FLAG_NORMAL, &sram_autosave_cb},
         {0, "Enable BIOS  ", "-", RG_DIALOG_FLAG_NORMAL, &enable_bios_cb},
+        {0, "ROM cache    ", "-", RG_DIALOG_FLAG_NORMAL, &rom_cache_cb},
         RG_DIALOG_END
     };
 
@@ -252,11 +311,15 @@ void gbc_main(void)
 
     updates[0] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
     updates[1] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
+    rg_surface_track_damage(updates[0], true);
+    rg_surface_track_damage(updates[1], true);
+    rg_display_set_frames(updates, 2);
     currentUpdate = updates[0];
 
     useSystemTime = (bool)rg_settings_get_number(NS_APP, SETTING_SYSTIME, 1);
     loadBIOSFile = (bool)rg_settings_get_number(NS_APP, SETTING_LOADBIOS, 0);
     autoSaveSRAM = (int)rg_settings_get_number(NS_APP, SETTING_SAVESRAM, 0);
+    romCacheSize = (int)rg_settings_get_number(NS_APP, SETTING_ROMCACHE, 0);
     sramFile = rg_emu_get_path(RG_PATH_SAVE_SRAM, app->romPath);
 
     if (!rg_storage_mkdir(rg_dirname(sramFile)))
@@ -267,16 +330,17 @@ void gbc_main(void)
         RG_PANIC("Emulator init failed!");
 
     gnuboy_set_framebuffer(currentUpdate->data);
+    gnuboy_set_damagebuffer(currentUpdate->damage);
     gnuboy_set_soundbuffer((void *)audioBuffer, sizeof(audioBuffer) / 2);
 
-    // Load ROM
+    // Load ROM. Only large ROMs read from a file or zip are paged, the budget caps their bank cache
+    gnuboy_set_bank_budget(romCacheSize * 1024);
     if (rg_extension_match(app->romPath, "zip"))
     {
-        void *data;
-        size_t size;
-        if (!rg_storage_unzip_file(app->romPath, NULL, &data, &size, RG_FILE_ALIGN_16KB))
+        // Banks are paged straight out of the archive, like we do with uncompressed files
+        if (!(romZip = rg_storage_unzip_open(app->romPath, "gb gbc", NULL)))
             RG_PANIC("ROM file unzipping failed!");
-        if (gnuboy_load_rom(data, size) < 0)
+        if (gnuboy_load_rom_stream(&rom_read_callback) < 0)
             RG_PANIC("ROM Loading failed!");
     }
     else if (gnuboy_load_rom_file(app->romPath) < 0)
@@ -343,15 +407,35 @@ void gbc_main(void)
 
         int64_t startTime = rg_system_timer();
         bool drawFrame = !skipFrames;
+        int runAhead = drawFrame ? rg_emu_get_runahead() : 0;
 
-        video_time = audio_time = 0;
+        audio_time = 0;
 
         if (drawFrame)
         {
-            currentUpdate = updates[currentUpdate == updates[0]];
+            currentUpdate = rg_display_acquire_frame(true);
             gnuboy_set_framebuffer(currentUpdate->data);
+            gnuboy_set_damagebuffer(currentUpdate->damage);
+        }
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
+        gnuboy_run(drawFrame && !runAhead);
+
+        if (runAhead && rg_emu_runahead_save())
+        {
+            // Emulate a few frames ahead with the same input, show the last one, then go back
+            runningAhead = true;
+            gnuboy_set_bank_replay(true);
+            for (int i = 1; i <= runAhead; i++)
+                gnuboy_run(i == runAhead);
+            rg_emu_runahead_load();
+            gnuboy_set_bank_replay(false);
+            runningAhead = false;
         }
-        gnuboy_run(drawFrame);
+        RG_TIMER_END(RG_TIMER_CPU);
+
+        // The frame won't be submitted if the LCD is off, give it back
+        if (drawFrame)
+            rg_display_release_frame(currentUpdate);
 
         if (autoSaveSRAM > 0)
         {
@@ -381,6 +465,8 @@ void gbc_main(void)
                 skipFrames = 1; // (elapsed / frameTime)
             else if (drawFrame && slowFrame)
                 skipFrames = 1;
+            else if (elapsed - audio_time < frameTime / 2)
+                gnuboy_prefetch_bank(); // Use our spare time to page in the bank the game will likely switch to next
         }
         else if (skipFrames > 0)
         {
@@ -255,14 +255,18 @@ extern "C" void lynx_main(void)
     	if (joystick & RG_KEY_SELECT) buttons |= BUTTON_OPT1;
 
         lynx->SetButtonData(buttons);
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
         lynx->UpdateFrame(drawFrame);
+        RG_TIMER_END(RG_TIMER_CPU);
 
         if (drawFrame)
         {
+            RG_TIMER_BEGIN(RG_TIMER_VIDEO);
             slowFrame = !rg_display_sync(false);
             rg_display_submit(currentUpdate, 0);
             currentUpdate = updates[currentUpdate == updates[0]];
             gPrimaryFrameBuffer = (UBYTE*)currentUpdate->data;
+            RG_TIMER_END(RG_TIMER_VIDEO);
         }
 
         app->tickRate = AUDIO_SAMPLE_RATE / (gAudioBufferPointer / 2);
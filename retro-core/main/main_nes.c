@@ -50,6 +50,17 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    int ret = state_save_mem(buffer, size);
+    return ret > 0 ? ret : 0;
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    return state_load_mem(buffer, size) == 0;
+}
+
 static bool reset_handler(bool hard)
 {
     nes_reset(hard);
@@ -183,6 +194,8 @@ void nes_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .event = &event_handler,
         .screenshot = &screenshot_handler,
@@ -203,6 +216,9 @@ void nes_main(void)
 
     updates[0] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
     updates[1] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
+    rg_surface_track_damage(updates[0], true);
+    rg_surface_track_damage(updates[1], true);
+    rg_display_set_frames(updates, 2);
     currentUpdate = updates[0];
 
     nes = nes_init(SYS_DETECT, app->sampleRate, true, RG_BASE_PATH_BIOS "/fds_bios.bin");
@@ -281,12 +297,15 @@ void nes_main(void)
 
         if (drawFrame)
         {
-            currentUpdate = updates[currentUpdate == updates[0]];
+            currentUpdate = rg_display_acquire_frame(true);
             nes_setvidbuf(currentUpdate->data);
+            nes_setdamagebuf(currentUpdate->damage);
         }
 
         input_update(0, buttons);
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
         nes_emulate(drawFrame);
+        RG_TIMER_END(RG_TIMER_CPU);
 
         // Tick before submitting audio/syncing
         rg_system_tick(rg_system_timer() - startTime);
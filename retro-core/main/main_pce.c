@@ -53,11 +53,16 @@ void osd_vsync(void)
 {
     static int64_t lasttime, prevtime;
 
+    // The core runs its own loop, everything between two vsyncs is counted as CPU
+    RG_TIMER_END(RG_TIMER_CPU);
+
     if (drawFrame)
     {
+        RG_TIMER_BEGIN(RG_TIMER_PRESENT);
         slowFrame = !rg_display_sync(false);
         rg_display_submit(currentUpdate, 0);
         currentUpdate = updates[currentUpdate == updates[0]];
+        RG_TIMER_END(RG_TIMER_PRESENT);
     }
 
     // See if we need to skip a frame to keep up
@@ -98,6 +103,8 @@ void osd_vsync(void)
     if ((lasttime + frameTime) < prevtime)
         lasttime = prevtime;
 
+    RG_TIMER_BEGIN(RG_TIMER_CPU);
+
     drawFrame = (skipFrames == 0);
 }
 
@@ -138,7 +145,9 @@ static void audioTask(void *arg)
         // TODO: Clearly we need to add a better way to remain in sync with the main task...
         while (emulationPaused)
             rg_task_yield();
+        int64_t startTime = rg_system_timer();
         psg_update((int16_t *)audioBuffer, numSamples, 0xFF);
+        RG_TIMER_ADD(RG_TIMER_AUDIO, rg_system_timer() - startTime);
         rg_audio_submit(audioBuffer, numSamples);
     }
 }
@@ -58,6 +58,39 @@ static bool load_state_handler(const char *filename)
     return false;
 }
 
+// smsplus' state code works on a FILE, so we give it a memory stream
+static size_t save_state_mem_handler(void *buffer, size_t size)
+{
+    static size_t state_size = 0;
+    if (!buffer)
+    {
+        // The state has a fixed size, measure it once
+        if (!state_size && (buffer = malloc(0x20000)))
+        {
+            state_size = save_state_mem_handler(buffer, 0x20000);
+            free(buffer);
+        }
+        return state_size;
+    }
+    FILE *f = fmemopen(buffer, size, "wb");
+    if (!f)
+        return 0;
+    system_save_state(f);
+    size_t used = ferror(f) ? 0 : ftell(f);
+    fclose(f);
+    return used;
+}
+
+static bool load_state_mem_handler(const void *buffer, size_t size)
+{
+    FILE *f = fmemopen((void *)buffer, size, "rb");
+    if (!f)
+        return false;
+    system_load_state(f);
+    fclose(f);
+    return true;
+}
+
 static bool reset_handler(bool hard)
 {
     system_reset();
@@ -97,6 +130,8 @@ void sms_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .loadStateMem = &load_state_mem_handler,
+        .saveStateMem = &save_state_mem_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -236,25 +271,31 @@ void sms_main(void)
             }
         }
 
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
         system_frame(!drawFrame);
+        RG_TIMER_END(RG_TIMER_CPU);
+
+        // The emulator's sound buffer isn't in a very convenient format, we must remix it.
+        RG_TIMER_BEGIN(RG_TIMER_AUDIO);
+        size_t sample_count = snd.sample_count;
+        rg_audio_sample_t mixbuffer[sample_count];
+        for (size_t i = 0; i < sample_count; i++)
+        {
+            mixbuffer[i].left = snd.stream[0][i] * 2.75f;
+            mixbuffer[i].right = snd.stream[1][i] * 2.75f;
+        }
+        RG_TIMER_END(RG_TIMER_AUDIO);
 
         if (drawFrame)
         {
+            RG_TIMER_BEGIN(RG_TIMER_PRESENT);
             if (render_copy_palette(currentUpdate->palette))
                 memcpy(updates[currentUpdate == updates[0]]->palette, currentUpdate->palette, 512);
             slowFrame = !rg_display_sync(false);
             rg_display_submit(currentUpdate, 0);
             currentUpdate = updates[currentUpdate == updates[0]]; // Swap
             bitmap.data = currentUpdate->data;
-        }
-
-        // The emulator's sound buffer isn't in a very convenient format, we must remix it.
-        size_t sample_count = snd.sample_count;
-        rg_audio_sample_t mixbuffer[sample_count];
-        for (size_t i = 0; i < sample_count; i++)
-        {
-            mixbuffer[i].left = snd.stream[0][i] * 2.75f;
-            mixbuffer[i].right = snd.stream[1][i] * 2.75f;
+            RG_TIMER_END(RG_TIMER_PRESENT);
         }
 
         // Tick before submitting audio/syncing
@@ -338,19 +338,25 @@ void snes_main(void)
         IPPU.RenderThisFrame = drawFrame;
         GFX.Screen = currentUpdate->data;
 
+        RG_TIMER_BEGIN(RG_TIMER_CPU);
         S9xMainLoop();
+        RG_TIMER_END(RG_TIMER_CPU);
 
         if (drawFrame)
         {
+            RG_TIMER_BEGIN(RG_TIMER_PRESENT);
             slowFrame = !rg_display_sync(false);
             rg_display_submit(currentUpdate, 0);
+            RG_TIMER_END(RG_TIMER_PRESENT);
         }
 
     #ifndef USE_BLARGG_APU
+        RG_TIMER_BEGIN(RG_TIMER_AUDIO);
         if (apu_enabled && lowpass_filter)
             S9xMixSamplesLowPass((void *)audioBuffer, AUDIO_BUFFER_LENGTH << 1, AUDIO_LOW_PASS_RANGE);
         else if (apu_enabled)
             S9xMixSamples((void *)audioBuffer, AUDIO_BUFFER_LENGTH << 1);
+        RG_TIMER_END(RG_TIMER_AUDIO);
     #endif
 
         rg_system_tick(rg_system_timer() - startTime);